@@ -0,0 +1,183 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Measure what it costs to look up the GL entry points of the real libGL, as
+ * glxtrace does, all at once with TRACE_BIND_NOW=1 or lazily otherwise, and
+ * what a call through each kind of dispatch stub costs afterwards.  The calls
+ * are to glGetError, without a current context, so they do next to nothing.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include <iostream>
+
+#include "os.hpp"
+#include "bench_bind.hpp"
+
+
+static void usage(void) {
+    std::cout <<
+        "Usage: bench_bind [OPTION]...\n"
+        "Look up every GL function with glXGetProcAddressARB, and time calls\n"
+        "through the dispatch stubs.\n"
+        "\n"
+        "  -l LIBGL     libGL to load (default libGL.so.1)\n"
+        "  -n CALLS     calls through each stub (default 10000000)\n";
+}
+
+
+typedef void (*PROC)(void);
+typedef PROC (*PFNGETPROCADDRESS)(const unsigned char *name);
+typedef unsigned (*PFNGETERROR)(void);
+
+static PFNGETPROCADDRESS getProcAddress = NULL;
+
+
+static PFNGETERROR
+lookupGetError(void) {
+    return (PFNGETERROR)getProcAddress((const unsigned char *)"glGetError");
+}
+
+
+/*
+ * Stub as dispatch.py generates them: the pointer starts out pointing at a
+ * resolver, which patches it on the first call.
+ */
+static unsigned resolveGetError(void);
+static PFNGETERROR patched_ptr = &resolveGetError;
+
+static unsigned
+resolveGetError(void) {
+    PFNGETERROR ptr = lookupGetError();
+    patched_ptr = ptr;
+    return ptr();
+}
+
+static __attribute__((noinline)) unsigned
+patchedStub(void) {
+    return patched_ptr();
+}
+
+
+/*
+ * Stub that tests the pointer on every call, looking it up when unset.
+ */
+static PFNGETERROR checked_ptr = NULL;
+
+static __attribute__((noinline)) unsigned
+checkedStub(void) {
+    if (!checked_ptr) {
+        checked_ptr = lookupGetError();
+        if (!checked_ptr) {
+            return 0;
+        }
+    }
+    return checked_ptr();
+}
+
+
+/*
+ * Best time per call through a stub, in nanoseconds.
+ */
+static double
+timeStub(unsigned (*stub)(void), unsigned num_calls) {
+    const unsigned runs = 10;
+    double best = 0;
+    for (unsigned run = 0; run < runs; ++run) {
+        long long start = OS::GetTime();
+        for (unsigned i = 0; i < num_calls; ++i) {
+            stub();
+        }
+        double elapsed = (double)(OS::GetTime() - start) * 1000.0 / num_calls;
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *libgl_filename = "libGL.so.1";
+    unsigned num_calls = 10000000;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if (!strcmp(arg, "-l") && i + 1 < argc) {
+            libgl_filename = argv[++i];
+        } else if (!strcmp(arg, "-n") && i + 1 < argc) {
+            num_calls = atoi(argv[++i]);
+        } else if (!strcmp(arg, "--help")) {
+            usage();
+            return 0;
+        } else {
+            std::cerr << "error: unknown option " << arg << "\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (num_calls < 1) {
+        usage();
+        return 1;
+    }
+
+    long long start = OS::GetTime();
+    void *libgl_handle = dlopen(libgl_filename, RTLD_LOCAL | RTLD_NOW);
+    long long open_time = OS::GetTime() - start;
+    if (!libgl_handle) {
+        std::cerr << "error: couldn't load " << libgl_filename << ": " << dlerror() << "\n";
+        return 1;
+    }
+
+    getProcAddress = (PFNGETPROCADDRESS)dlsym(libgl_handle, "glXGetProcAddressARB");
+    if (!getProcAddress) {
+        std::cerr << "error: couldn't find glXGetProcAddressARB in " << libgl_filename << "\n";
+        return 1;
+    }
+
+    const unsigned num_names = sizeof function_names / sizeof function_names[0];
+    unsigned num_found = 0;
+    start = OS::GetTime();
+    for (unsigned i = 0; i < num_names; ++i) {
+        if (getProcAddress((const unsigned char *)function_names[i])) {
+            ++num_found;
+        }
+    }
+    long long resolve_time = OS::GetTime() - start;
+
+    std::cout << "load " << open_time << " us\n";
+    std::cout << "resolve " << num_found << " of " << num_names << " functions in " << resolve_time << " us\n";
+    std::cout << "self-patching stub " << timeStub(&patchedStub, num_calls) << " ns per call\n";
+    std::cout << "checking stub " << timeStub(&checkedStub, num_calls) << " ns per call\n";
+
+    return 0;
+}
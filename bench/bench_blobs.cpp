@@ -0,0 +1,247 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Measure how much memory parsing a trace of large texture uploads takes.
+ *
+ * Blobs are views into the buffers the chunks are decompressed into, so once
+ * the calls are deleted their memory should be released, and the peak resident
+ * set size should stay well below the size of the trace.
+ *
+ * The trace is compressed as TRACE_CODEC says.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "os.hpp"
+#include "trace_writer.hpp"
+#include "trace_parser.hpp"
+
+
+static void usage(void) {
+    std::cout <<
+        "Usage: bench_blobs [OPTION]... TRACE\n"
+        "Write a trace of texture uploads to TRACE, parse it back, and report the\n"
+        "peak resident set size and the CPU time taken.\n"
+        "\n"
+        "  -n CALLS     texture uploads in the trace (default 1000)\n"
+        "  -s KB        size of each texture in KB (default 512)\n"
+        "  -p           only parse TRACE, which must already exist, so that the\n"
+        "               peak RSS is that of parsing alone\n";
+}
+
+
+static const char *teximage_args[] = {"target", "level", "internalformat", "width", "height", "border", "format", "type", "pixels"};
+static const Trace::FunctionSig teximage_sig = {0, "glTexImage2D", 9, teximage_args, NULL, 0};
+
+static const Trace::FunctionSig swap_sig = {1, "glXSwapBuffers", 0, NULL, NULL, 0};
+
+static const Trace::EnumSig texture_2d_sig = {0, "GL_TEXTURE_2D", 0x0DE1, NULL, 0};
+static const Trace::EnumSig rgba_sig = {1, "GL_RGBA", 0x1908, NULL, 0};
+static const Trace::EnumSig unsigned_byte_sig = {2, "GL_UNSIGNED_BYTE", 0x1401, NULL, 0};
+
+
+static void
+writeTrace(const char *filename, unsigned num_calls, size_t size) {
+#ifdef _WIN32
+    _putenv_s("TRACE_FILE", filename);
+#else
+    setenv("TRACE_FILE", filename, 1);
+#endif
+
+    /* RGBA texels, 1024 wide */
+    unsigned width = 1024;
+    unsigned height = (unsigned)(size / (width * 4));
+    size = width * height * 4;
+
+    std::vector<unsigned> pixels(size / 4);
+    unsigned seed = 1;
+
+    Trace::Open();
+
+    for (unsigned i = 0; i < num_calls; ++i) {
+        /* Noisy texels, so that compression has work to do */
+        for (size_t j = 0; j < pixels.size(); ++j) {
+            seed = seed * 1103515245 + 12345;
+            pixels[j] = 0xff000000 | ((seed >> 16) & 0x0f0f0f);
+        }
+
+        unsigned call = Trace::BeginEnter(teximage_sig);
+        Trace::BeginArg(0);
+        Trace::LiteralEnum(&texture_2d_sig);
+        Trace::EndArg();
+        Trace::BeginArg(1);
+        Trace::LiteralSInt(0);
+        Trace::EndArg();
+        Trace::BeginArg(2);
+        Trace::LiteralEnum(&rgba_sig);
+        Trace::EndArg();
+        Trace::BeginArg(3);
+        Trace::LiteralSInt(width);
+        Trace::EndArg();
+        Trace::BeginArg(4);
+        Trace::LiteralSInt(height);
+        Trace::EndArg();
+        Trace::BeginArg(5);
+        Trace::LiteralSInt(0);
+        Trace::EndArg();
+        Trace::BeginArg(6);
+        Trace::LiteralEnum(&rgba_sig);
+        Trace::EndArg();
+        Trace::BeginArg(7);
+        Trace::LiteralEnum(&unsigned_byte_sig);
+        Trace::EndArg();
+        Trace::BeginArg(8);
+        Trace::LiteralBlob(&pixels[0], size);
+        Trace::EndArg();
+        Trace::EndEnter();
+        Trace::BeginLeave(call);
+        Trace::EndLeave();
+
+        call = Trace::BeginEnter(swap_sig);
+        Trace::EndEnter();
+        Trace::BeginLeave(call);
+        Trace::EndLeave();
+        Trace::EndFrame();
+    }
+
+    Trace::Close();
+}
+
+
+/*
+ * Peak resident set size of the process so far, in KB.
+ */
+static unsigned long
+getPeakRSS(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters)) {
+        return 0;
+    }
+    return (unsigned long)(counters.PeakWorkingSetSize / 1024);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned num_calls = 1000;
+    size_t size = 512 * 1024;
+    bool parse_only = false;
+
+    int i;
+    for (i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if (arg[0] != '-') {
+            break;
+        }
+
+        if (!strcmp(arg, "-n") && i + 1 < argc) {
+            num_calls = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-s") && i + 1 < argc) {
+            size = atoi(argv[++i]) * 1024;
+        } else if (!strcmp(arg, "-p")) {
+            parse_only = true;
+        } else if (!strcmp(arg, "--help")) {
+            usage();
+            return 0;
+        } else {
+            std::cerr << "error: unknown option " << arg << "\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (i + 1 != argc || size < 4096) {
+        usage();
+        return 1;
+    }
+    const char *filename = argv[i];
+
+    if (!parse_only) {
+        writeTrace(filename, num_calls, size);
+    }
+
+    unsigned long written_rss = getPeakRSS();
+
+    Trace::Parser p;
+    if (!p.open(filename)) {
+        std::cerr << "error: failed to open " << filename << "\n";
+        return 1;
+    }
+
+    unsigned long long parsed = 0;
+    clock_t start = clock();
+    Trace::Call *call;
+    while ((call = p.parse_call())) {
+        delete call;
+        ++parsed;
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    p.close();
+
+    unsigned long parsed_rss = getPeakRSS();
+
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    double megabytes = (double)file.tellg() / (1024.0 * 1024.0);
+
+    std::cout << parsed << " calls, " << megabytes << " MB, parsed in " << seconds << " s of CPU time\n";
+    if (parse_only) {
+        std::cout << "peak RSS " << parsed_rss / 1024.0 << " MB\n";
+    } else {
+        /* The writer's buffers count towards the peak too */
+        std::cout << "peak RSS " << parsed_rss / 1024.0 << " MB, " << written_rss / 1024.0 << " MB of it while writing\n"
+                     "run again with -p to measure parsing alone\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Measure how long encoding the arguments of a call takes, in time stamp
+ * counter ticks, for a glUniform4f-like call of five arguments.  This is done
+ * both with the inline encoding functions the tracers use, and with the
+ * out-of-line ones they replaced, from bench_encode_old.cpp.
+ *
+ * The arguments of a batch of calls are encoded into a single event and timed
+ * together, so that reading the time stamp counter doesn't dominate.  The
+ * rest of the call, i.e., queueing the event for the writer thread, is left
+ * out.
+ *
+ * The writer is configured through the usual environment variables, e.g.,
+ * TRACE_FILE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "os.hpp"
+#include "trace_writer.hpp"
+#include "bench_encode.hpp"
+
+
+static void usage(void) {
+    std::cout <<
+        "Usage: bench_encode [OPTION]...\n"
+        "Encode the arguments of calls in batches, and report the median cost\n"
+        "per call, with inline and with out-of-line encoding functions.\n"
+        "\n"
+        "  -n BATCHES   number of batches (default 1000)\n"
+        "  -b CALLS     calls per batch (default 100)\n";
+}
+
+
+static const char *uniform_args[] = {"location", "v0", "v1", "v2", "v3"};
+static const Trace::FunctionSig uniform_sig = {0, "glUniform4f", 5, uniform_args, NULL, 0};
+
+
+struct InlineEncoding {
+    static inline void BeginArg(unsigned index) { Trace::BeginArg(index); }
+    static inline void EndArg(void) { Trace::EndArg(); }
+    static inline void LiteralSInt(signed long long value) { Trace::LiteralSInt(value); }
+    static inline void LiteralFloat(float value) { Trace::LiteralFloat(value); }
+};
+
+struct OutOfLineEncoding {
+    static inline void BeginArg(unsigned index) { OutOfLine::BeginArg(index); }
+    static inline void EndArg(void) { OutOfLine::EndArg(); }
+    static inline void LiteralSInt(signed long long value) { OutOfLine::LiteralSInt(value); }
+    static inline void LiteralFloat(float value) { OutOfLine::LiteralFloat(value); }
+};
+
+
+template <class Encoding>
+static inline void
+encodeArgs(unsigned i) {
+    Encoding::BeginArg(0);
+    Encoding::LiteralSInt(i % 16);
+    Encoding::EndArg();
+    for (unsigned j = 1; j <= 4; ++j) {
+        Encoding::BeginArg(j);
+        Encoding::LiteralFloat((float)(i + j) * 0.25f);
+        Encoding::EndArg();
+    }
+}
+
+
+/*
+ * Median ticks per call.
+ */
+template <class Encoding>
+static double
+measure(unsigned num_batches, unsigned batch_calls) {
+    std::vector<unsigned long long> ticks(num_batches);
+    for (unsigned batch = 0; batch < num_batches; ++batch) {
+        unsigned call = Trace::BeginEnter(uniform_sig);
+        unsigned long long begin = OS::GetTimestamp();
+        for (unsigned i = 0; i < batch_calls; ++i) {
+            encodeArgs<Encoding>(i);
+        }
+        ticks[batch] = OS::GetTimestamp() - begin;
+        Trace::EndEnter();
+        Trace::BeginLeave(call);
+        Trace::EndLeave();
+    }
+
+    std::sort(ticks.begin(), ticks.end());
+    return (double)ticks[num_batches / 2] / batch_calls;
+}
+
+
+static void
+report(const char *name, double median, double ns_per_tick) {
+    std::cout << name << ": median " << median << " ticks per call";
+    if (ns_per_tick) {
+        std::cout << " (" << median * ns_per_tick << " ns)";
+    }
+    std::cout << "\n";
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned num_batches = 1000;
+    unsigned batch_calls = 100;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if (!strcmp(arg, "-n") && i + 1 < argc) {
+            num_batches = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-b") && i + 1 < argc) {
+            batch_calls = atoi(argv[++i]);
+        } else if (!strcmp(arg, "--help")) {
+            usage();
+            return 0;
+        } else {
+            std::cerr << "error: unknown option " << arg << "\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (num_batches < 1 || batch_calls < 1) {
+        usage();
+        return 1;
+    }
+
+    Trace::Open();
+
+    /* Define the signature, and grow the event buffers */
+    measure<InlineEncoding>(16, batch_calls);
+    measure<OutOfLineEncoding>(16, batch_calls);
+
+    long long start_time = OS::GetTime();
+    unsigned long long start = OS::GetTimestamp();
+
+    double inline_median = measure<InlineEncoding>(num_batches, batch_calls);
+    double out_of_line_median = measure<OutOfLineEncoding>(num_batches, batch_calls);
+
+    long long end_time = OS::GetTime();
+    unsigned long long end = OS::GetTimestamp();
+
+    Trace::Close();
+
+    double ns_per_tick = 0;
+    if (end != start) {
+        ns_per_tick = (end_time - start_time) * 1000.0 / (double)(end - start);
+    }
+
+    report("inline", inline_median, ns_per_tick);
+    report("out of line", out_of_line_median, ns_per_tick);
+
+    return 0;
+}
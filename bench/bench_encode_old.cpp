@@ -0,0 +1,111 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * The value encoding functions as they were before they were made inline:
+ * out of line, in a translation unit of their own, and looking the current
+ * event up and checking its size on every write.  They write into the same
+ * buffer as the inline ones.
+ */
+
+
+#include <assert.h>
+#include <string.h>
+
+#include "trace_writer.hpp"
+#include "bench_encode.hpp"
+
+
+namespace OutOfLine {
+
+
+static inline unsigned
+EncodeUInt(char *buf, unsigned long long value) {
+    unsigned len;
+
+    len = 0;
+    do {
+        buf[len] = 0x80 | (value & 0x7f);
+        value >>= 7;
+        ++len;
+    } while (value);
+
+    assert(len);
+    buf[len - 1] &= 0x7f;
+
+    return len;
+}
+
+static inline void Write(const void *sBuffer, size_t dwBytesToWrite) {
+    Trace::Encoder *encoder = Trace::t_encoder;
+    if (!encoder)
+        return;
+
+    if (encoder->size + dwBytesToWrite > encoder->capacity &&
+        !Trace::GrowEncoder(encoder, dwBytesToWrite))
+        return;
+    memcpy(encoder->buf + encoder->size, sBuffer, dwBytesToWrite);
+    encoder->size += dwBytesToWrite;
+}
+
+static inline void
+WriteByte(char c) {
+    Write(&c, 1);
+}
+
+static inline void
+WriteUInt(unsigned long long value) {
+    char buf[2 * sizeof value];
+    Write(buf, EncodeUInt(buf, value));
+}
+
+static inline void
+WriteFloat(float value) {
+    assert(sizeof value == 4);
+    Write((const char *)&value, sizeof value);
+}
+
+void BeginArg(unsigned index) {
+    WriteByte(Trace::CALL_ARG);
+    WriteUInt(index);
+}
+
+void LiteralSInt(signed long long value) {
+    if (value < 0) {
+        WriteByte(Trace::TYPE_SINT);
+        WriteUInt(-value);
+    } else {
+        WriteByte(Trace::TYPE_UINT);
+        WriteUInt(value);
+    }
+}
+
+void LiteralFloat(float value) {
+    WriteByte(Trace::TYPE_FLOAT);
+    WriteFloat(value);
+}
+
+
+} /* namespace OutOfLine */
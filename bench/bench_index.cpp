@@ -0,0 +1,156 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Measure how fast the range of an index array is found, in GB/s of indices
+ * scanned, with the kernel chosen at runtime and with the scalar loop alone.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <vector>
+
+#include "os.hpp"
+#include "glindex.hpp"
+
+
+static void usage(void) {
+    std::cout <<
+        "Usage: bench_index [OPTION]...\n"
+        "Scan index arrays of each type, and report the best throughput of\n"
+        "the dispatched and scalar scans.\n"
+        "\n"
+        "  -c COUNT     indices per array (default 16384)\n"
+        "  -n RUNS      scans of each array, the best is kept (default 10000)\n";
+}
+
+
+static GLuint scan_min;
+static GLuint scan_max;
+
+
+template <class T>
+static inline void
+scanDispatched(const T *indices, size_t count, GLenum type) {
+    __gl_index_range(count, type, indices, false, 0, &scan_min, &scan_max);
+}
+
+
+template <class T>
+static inline void
+scanScalar(const T *indices, size_t count, GLenum type) {
+    scan_min = ~0U;
+    scan_max = 0;
+    __gl_index_range_scalar<T, false>(indices, count, 0, &scan_min, &scan_max);
+}
+
+
+/*
+ * Best time of many scans, in microseconds.  Single scans are too short to
+ * time, so they are timed in batches.
+ */
+template <class T>
+static double
+timeScan(void (*scan)(const T *, size_t, GLenum), const T *indices, size_t count, GLenum type, unsigned runs) {
+    const unsigned batch = 100;
+    double best = 0;
+    for (unsigned run = 0; run < runs; run += batch) {
+        long long start = OS::GetTime();
+        for (unsigned i = 0; i < batch; ++i) {
+            scan(indices, count, type);
+        }
+        double elapsed = (double)(OS::GetTime() - start) / batch;
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+
+template <class T>
+static void
+benchType(const char *name, GLenum type, size_t count, unsigned runs) {
+    std::vector<T> indices(count);
+    unsigned seed = 1;
+    for (size_t i = 0; i < count; ++i) {
+        seed = seed * 1103515245 + 12345;
+        indices[i] = (T)(seed >> 8);
+    }
+
+    double bytes = (double)(count * sizeof(T));
+
+    double dispatched = timeScan<T>(&scanDispatched<T>, &indices[0], count, type, runs);
+    GLuint min = scan_min;
+    GLuint max = scan_max;
+
+    double scalar = timeScan<T>(&scanScalar<T>, &indices[0], count, type, runs);
+    if (scan_min != min || scan_max != max) {
+        std::cerr << "error: " << name << ": dispatched and scalar scans disagree\n";
+        exit(1);
+    }
+
+    std::cout << name << ": "
+              << "dispatched " << (dispatched > 0 ? bytes / dispatched / 1e3 : 0) << " GB/s, "
+              << "scalar " << (scalar > 0 ? bytes / scalar / 1e3 : 0) << " GB/s\n";
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned count = 16384;
+    unsigned runs = 10000;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if (!strcmp(arg, "-c") && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-n") && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (!strcmp(arg, "--help")) {
+            usage();
+            return 0;
+        } else {
+            std::cerr << "error: unknown option " << arg << "\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (count < 1 || runs < 1) {
+        usage();
+        return 1;
+    }
+
+    benchType<GLubyte>("ubyte", GL_UNSIGNED_BYTE, count, runs);
+    benchType<GLushort>("ushort", GL_UNSIGNED_SHORT, count, runs);
+    benchType<GLuint>("uint", GL_UNSIGNED_INT, count, runs);
+
+    return 0;
+}
@@ -0,0 +1,320 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Measure how fast traces are parsed, in calls and bytes per second of CPU
+ * time, over a synthetic trace mixing the kinds of values real traces have.
+ *
+ * The trace is compressed as TRACE_CODEC says.  Parsing is repeated and the
+ * fastest run reported, as the first run also pays for reading the file into
+ * the page cache.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fstream>
+#include <iostream>
+
+#include "os.hpp"
+#include "trace_writer.hpp"
+#include "trace_parser.hpp"
+
+
+static void usage(void) {
+    std::cout <<
+        "Usage: bench_parse [OPTION]... TRACE\n"
+        "Write a synthetic trace of mixed calls to TRACE, parse it back, and\n"
+        "report how many calls and bytes were parsed per second of CPU time.\n"
+        "\n"
+        "  -n CALLS     calls in the synthetic trace (default 12000000)\n"
+        "  -p           only parse TRACE, which must already exist\n"
+        "  -r RUNS      parse RUNS times and report the fastest (default 5)\n";
+}
+
+
+static const char *uniform_args[] = {"location", "v0", "v1", "v2", "v3"};
+static const Trace::FunctionSig uniform_sig = {0, "glUniform4f", 5, uniform_args, NULL, 0};
+
+static const char *label_args[] = {"identifier", "name", "label"};
+static const Trace::FunctionSig label_sig = {1, "glObjectLabel", 3, label_args, NULL, 0};
+
+static const char *depth_args[] = {"near", "far"};
+static const Trace::FunctionSig depth_sig = {2, "glDepthRange", 2, depth_args, NULL, 0};
+
+static const char *uniformv_args[] = {"location", "count", "transpose", "value"};
+static const Trace::FunctionSig uniformv_sig = {3, "glUniformMatrix4fv", 4, uniformv_args, NULL, 0};
+
+static const char *viewport_args[] = {"first", "count", "v"};
+static const Trace::FunctionSig viewport_sig = {4, "glViewportArrayv", 3, viewport_args, NULL, 0};
+
+static const char *buffer_args[] = {"target", "offset", "size", "data"};
+static const Trace::FunctionSig buffer_sig = {5, "glBufferSubData", 4, buffer_args, NULL, 0};
+
+static const Trace::FunctionSig swap_sig = {6, "glXSwapBuffers", 0, NULL, NULL, 0};
+
+static const Trace::EnumSig array_buffer_sig = {0, "GL_ARRAY_BUFFER", 0x8892, NULL, 0};
+
+
+static void
+traceCall(unsigned i) {
+    static const char *labels[] = {"vertices", "shadow map", "scene constants"};
+    static char data[256];
+
+    switch (i % 6) {
+    case 0: {
+        unsigned call = Trace::BeginEnter(uniform_sig);
+        Trace::BeginArg(0);
+        Trace::LiteralSInt(i % 16);
+        Trace::EndArg();
+        for (unsigned j = 1; j <= 4; ++j) {
+            Trace::BeginArg(j);
+            Trace::LiteralFloat((float)(i + j) * 0.25f);
+            Trace::EndArg();
+        }
+        Trace::EndEnter();
+        Trace::BeginLeave(call);
+        Trace::EndLeave();
+        break;
+    }
+    case 1: {
+        unsigned call = Trace::BeginEnter(label_sig);
+        Trace::BeginArg(0);
+        Trace::LiteralUInt(0x82E0);
+        Trace::EndArg();
+        Trace::BeginArg(1);
+        Trace::LiteralUInt(i % 64);
+        Trace::EndArg();
+        Trace::BeginArg(2);
+        Trace::LiteralString(labels[i % 3]);
+        Trace::EndArg();
+        Trace::EndEnter();
+        Trace::BeginLeave(call);
+        Trace::EndLeave();
+        break;
+    }
+    case 2: {
+        unsigned call = Trace::BeginEnter(depth_sig);
+        Trace::BeginArg(0);
+        Trace::LiteralDouble(0.0);
+        Trace::EndArg();
+        Trace::BeginArg(1);
+        Trace::LiteralDouble(1.0 / (1 + i % 8));
+        Trace::EndArg();
+        Trace::EndEnter();
+        Trace::BeginLeave(call);
+        Trace::EndLeave();
+        break;
+    }
+    case 3: {
+        float matrix[16];
+        for (unsigned j = 0; j < 16; ++j) {
+            matrix[j] = (float)(i + j);
+        }
+        unsigned call = Trace::BeginEnter(uniformv_sig);
+        Trace::BeginArg(0);
+        Trace::LiteralSInt(i % 16);
+        Trace::EndArg();
+        Trace::BeginArg(1);
+        Trace::LiteralSInt(1);
+        Trace::EndArg();
+        Trace::BeginArg(2);
+        Trace::LiteralBool(false);
+        Trace::EndArg();
+        Trace::BeginArg(3);
+        Trace::LiteralArray(Trace::TYPE_FLOAT, sizeof matrix[0], matrix, 16);
+        Trace::EndArg();
+        Trace::EndEnter();
+        Trace::BeginLeave(call);
+        Trace::EndLeave();
+        break;
+    }
+    case 4: {
+        /* An array of values encoded one by one */
+        unsigned call = Trace::BeginEnter(viewport_sig);
+        Trace::BeginArg(0);
+        Trace::LiteralUInt(0);
+        Trace::EndArg();
+        Trace::BeginArg(1);
+        Trace::LiteralUInt(2);
+        Trace::EndArg();
+        Trace::BeginArg(2);
+        Trace::BeginArray(8);
+        for (unsigned j = 0; j < 8; ++j) {
+            Trace::BeginElement();
+            Trace::LiteralFloat((float)(j * 64));
+            Trace::EndElement();
+        }
+        Trace::EndArray();
+        Trace::EndArg();
+        Trace::EndEnter();
+        Trace::BeginLeave(call);
+        Trace::EndLeave();
+        break;
+    }
+    case 5: {
+        data[i % sizeof data] = (char)i;
+        unsigned call = Trace::BeginEnter(buffer_sig);
+        Trace::BeginArg(0);
+        Trace::LiteralEnum(&array_buffer_sig);
+        Trace::EndArg();
+        Trace::BeginArg(1);
+        Trace::LiteralUInt((i % 64) * sizeof data);
+        Trace::EndArg();
+        Trace::BeginArg(2);
+        Trace::LiteralUInt(sizeof data);
+        Trace::EndArg();
+        Trace::BeginArg(3);
+        Trace::LiteralBlob(data, sizeof data);
+        Trace::EndArg();
+        Trace::EndEnter();
+        Trace::BeginLeave(call);
+        Trace::EndLeave();
+        break;
+    }
+    }
+}
+
+
+static void
+traceFrame(void) {
+    unsigned call = Trace::BeginEnter(swap_sig);
+    Trace::EndEnter();
+    Trace::BeginLeave(call);
+    Trace::EndLeave();
+    Trace::EndFrame();
+}
+
+
+static void
+writeTrace(const char *filename, unsigned num_calls) {
+#ifdef _WIN32
+    _putenv_s("TRACE_FILE", filename);
+#else
+    setenv("TRACE_FILE", filename, 1);
+#endif
+
+    Trace::Open();
+    for (unsigned i = 0; i < num_calls; ++i) {
+        traceCall(i);
+        if (i % 1000 == 999) {
+            traceFrame();
+        }
+    }
+    Trace::Close();
+}
+
+
+/*
+ * Parse and delete every call of the trace, and return the CPU time taken.
+ */
+static double
+parseTrace(const char *filename, unsigned long long &parsed) {
+    Trace::Parser p;
+    if (!p.open(filename)) {
+        std::cerr << "error: failed to open " << filename << "\n";
+        exit(1);
+    }
+
+    parsed = 0;
+    clock_t start = clock();
+    Trace::Call *call;
+    while ((call = p.parse_call())) {
+        delete call;
+        ++parsed;
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    p.close();
+
+    return seconds;
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned num_calls = 12000000;
+    bool parse_only = false;
+    unsigned num_runs = 5;
+
+    int i;
+    for (i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if (arg[0] != '-') {
+            break;
+        }
+
+        if (!strcmp(arg, "-n") && i + 1 < argc) {
+            num_calls = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-p")) {
+            parse_only = true;
+        } else if (!strcmp(arg, "-r") && i + 1 < argc) {
+            num_runs = atoi(argv[++i]);
+        } else if (!strcmp(arg, "--help")) {
+            usage();
+            return 0;
+        } else {
+            std::cerr << "error: unknown option " << arg << "\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (i + 1 != argc || num_runs < 1) {
+        usage();
+        return 1;
+    }
+    const char *filename = argv[i];
+
+    if (!parse_only) {
+        writeTrace(filename, num_calls);
+    }
+
+    unsigned long long parsed = 0;
+    double seconds = 0;
+    for (unsigned run = 0; run < num_runs; ++run) {
+        double run_seconds = parseTrace(filename, parsed);
+        if (run == 0 || run_seconds < seconds) {
+            seconds = run_seconds;
+        }
+    }
+
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    double megabytes = (double)file.tellg() / (1024.0 * 1024.0);
+
+    std::cout << parsed << " calls, " << megabytes << " MB, parsed in " << seconds << " s of CPU time";
+    if (num_runs > 1) {
+        std::cout << " (best of " << num_runs << " runs)";
+    }
+    std::cout << "\n";
+    if (seconds > 0) {
+        std::cout << parsed / seconds / 1e6 << " Mcalls/s, " << megabytes / seconds << " MB/s\n";
+    }
+
+    return 0;
+}
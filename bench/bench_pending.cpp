@@ -0,0 +1,208 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Measure how fast leave events are matched with their calls when many calls
+ * are in flight at once.
+ *
+ * For each nesting depth K, a trace is written in which calls are entered K at
+ * a time and then left in reverse order, and is then parsed.  Matching should
+ * take constant time, so the rate should barely depend on K.
+ *
+ * Holding K calls at once also costs memory, and cache misses, whatever the
+ * matching does, so the same calls are also built and freed K at a time
+ * without parsing.  The difference between both is what the lookups cost.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "os.hpp"
+#include "trace_writer.hpp"
+#include "trace_parser.hpp"
+
+
+static void usage(void) {
+    std::cout <<
+        "Usage: bench_pending [OPTION]... TRACE\n"
+        "Write traces with increasingly many calls in flight to TRACE, parse them\n"
+        "back, and report how many calls were parsed per second of CPU time.\n"
+        "\n"
+        "  -n CALLS     calls in each trace (default 2000000)\n"
+        "  -k DEPTH     only measure this many calls in flight (default 1, 10, 100,\n"
+        "               1000 and 10000)\n";
+}
+
+
+static const char *uniform_args[] = {"location", "v0"};
+static const Trace::FunctionSig uniform_sig = {0, "glUniform1i", 2, uniform_args, NULL, 0};
+
+
+static void
+writeTrace(const char *filename, unsigned num_calls, unsigned depth) {
+#ifdef _WIN32
+    _putenv_s("TRACE_FILE", filename);
+#else
+    setenv("TRACE_FILE", filename, 1);
+#endif
+
+    Trace::Open();
+
+    std::vector<unsigned> calls(depth);
+    for (unsigned i = 0; i < num_calls; i += depth) {
+        unsigned n = std::min(depth, num_calls - i);
+        for (unsigned j = 0; j < n; ++j) {
+            calls[j] = Trace::BeginEnter(uniform_sig);
+            Trace::BeginArg(0);
+            Trace::LiteralSInt(j);
+            Trace::EndArg();
+            Trace::BeginArg(1);
+            Trace::LiteralSInt(i);
+            Trace::EndArg();
+            Trace::EndEnter();
+        }
+        while (n--) {
+            Trace::BeginLeave(calls[n]);
+            Trace::EndLeave();
+        }
+    }
+
+    Trace::Close();
+}
+
+
+/*
+ * Seconds of CPU time taken to build and free the calls of the trace, K at a
+ * time, as the parser does.
+ */
+static double
+allocate(unsigned num_calls, unsigned depth) {
+    Trace::Call::Signature sig;
+    sig.name = uniform_sig.name;
+    sig.arg_names.assign(uniform_sig.args, uniform_sig.args + uniform_sig.num_args);
+
+    std::vector<Trace::Call *> calls(depth);
+    clock_t start = clock();
+    for (unsigned i = 0; i < num_calls; i += depth) {
+        unsigned n = std::min(depth, num_calls - i);
+        for (unsigned j = 0; j < n; ++j) {
+            Trace::Call *call = new Trace::Call(&sig);
+            call->no = i + j;
+            call->args[0] = new (&call->arena) Trace::SInt(j);
+            call->args[1] = new (&call->arena) Trace::SInt(i);
+            calls[j] = call;
+        }
+        while (n--) {
+            delete calls[n];
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+static void
+measure(const char *filename, unsigned num_calls, unsigned depth) {
+    writeTrace(filename, num_calls, depth);
+
+    Trace::Parser p;
+    if (!p.open(filename)) {
+        std::cerr << "error: failed to open " << filename << "\n";
+        exit(1);
+    }
+
+    unsigned long long parsed = 0;
+    clock_t start = clock();
+    Trace::Call *call;
+    while ((call = p.parse_call())) {
+        delete call;
+        ++parsed;
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    p.close();
+
+    double allocation = allocate(parsed, depth);
+
+    std::cout << "K = " << depth << ": " << parsed << " calls parsed in " << seconds << " s of CPU time";
+    if (seconds > 0) {
+        std::cout << ", " << parsed / seconds / 1e6 << " Mcalls/s";
+    }
+    std::cout << "; building and freeing them alone takes " << allocation << " s\n";
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned num_calls = 2000000;
+    unsigned depth = 0;
+
+    int i;
+    for (i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if (arg[0] != '-') {
+            break;
+        }
+
+        if (!strcmp(arg, "-n") && i + 1 < argc) {
+            num_calls = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-k") && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+            if (depth < 1) {
+                usage();
+                return 1;
+            }
+        } else if (!strcmp(arg, "--help")) {
+            usage();
+            return 0;
+        } else {
+            std::cerr << "error: unknown option " << arg << "\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (i + 1 != argc) {
+        usage();
+        return 1;
+    }
+    const char *filename = argv[i];
+
+    if (depth) {
+        measure(filename, num_calls, depth);
+    } else {
+        for (depth = 1; depth <= 10000; depth *= 10) {
+            measure(filename, num_calls, depth);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,207 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Measure how many calls per second the trace writer takes, from several
+ * threads at once, as a traced application would make them.
+ *
+ * The writer is configured through the usual environment variables, e.g.,
+ * TRACE_FILE, TRACE_FLUSH, TRACE_CODEC or TRACE_DEFER, which the calls honour
+ * as generated wrappers do.  Besides the overall rate, the CPU time the
+ * calling threads spend in the tracer is reported, as that is what deferring
+ * arguments to the writer thread saves.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <iostream>
+
+#include "os.hpp"
+#include "trace_writer.hpp"
+
+
+static void usage(void) {
+    std::cout <<
+        "Usage: bench_writer [OPTION]...\n"
+        "Trace calls from several threads, and report how many were written\n"
+        "per second, including the time to write out the whole trace.\n"
+        "\n"
+        "  -t THREADS   number of threads making calls (default 1)\n"
+        "  -n CALLS     calls made by each thread (default 50000)\n"
+        "  -f CALLS     calls per frame (default 1000)\n";
+}
+
+
+static unsigned num_calls = 50000;
+static unsigned frame_calls = 1000;
+
+
+static const char *uniform_args[] = {"location", "v0", "v1", "v2", "v3"};
+static const Trace::FunctionSig uniform_sig = {0, "glUniform4f", 5, uniform_args, NULL, 0};
+
+static const Trace::FunctionSig swap_sig = {1, "glXSwapBuffers", 0, NULL, NULL, 0};
+
+
+/* What a generated wrapper does for a call with flat arguments */
+struct uniform_in_args {
+    int location;
+    float v[4];
+};
+
+static void
+dumpUniformArgs(const void *raw) {
+    const uniform_in_args *args = (const uniform_in_args *)raw;
+    Trace::BeginArg(0);
+    Trace::LiteralSInt(args->location);
+    Trace::EndArg();
+    for (unsigned j = 1; j <= 4; ++j) {
+        Trace::BeginArg(j);
+        Trace::LiteralFloat(args->v[j - 1]);
+        Trace::EndArg();
+    }
+}
+
+
+static void
+traceCall(unsigned i) {
+    unsigned call = Trace::BeginEnter(uniform_sig);
+    uniform_in_args args;
+    args.location = i % 16;
+    for (unsigned j = 1; j <= 4; ++j) {
+        args.v[j - 1] = (float)(i + j) * 0.25f;
+    }
+    if (Trace::defer_args) {
+        Trace::DeferArgs(&dumpUniformArgs, &args, sizeof args);
+    } else {
+        dumpUniformArgs(&args);
+    }
+    Trace::EndEnter();
+    Trace::BeginLeave(call);
+    Trace::EndLeave();
+}
+
+
+static void
+traceFrame(void) {
+    unsigned call = Trace::BeginEnter(swap_sig);
+    Trace::EndEnter();
+    Trace::BeginLeave(call);
+    Trace::EndLeave();
+    Trace::EndFrame();
+}
+
+
+/* CPU time taken by the calling threads, in microseconds */
+static volatile long thread_time = 0;
+
+
+/**
+ * CPU time of the calling thread in microseconds, or zero where it can't be
+ * told apart from the process's.
+ */
+static long long
+threadTime(void) {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+#endif
+    return 0;
+}
+
+
+static void
+threadFunction(void *) {
+    long long start = threadTime();
+    for (unsigned i = 0; i < num_calls; ++i) {
+        traceCall(i);
+        if (frame_calls && i % frame_calls == frame_calls - 1) {
+            traceFrame();
+        }
+    }
+    OS::AtomicAdd(&thread_time, (long)(threadTime() - start));
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned num_threads = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if (!strcmp(arg, "-t") && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-n") && i + 1 < argc) {
+            num_calls = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-f") && i + 1 < argc) {
+            frame_calls = atoi(argv[++i]);
+        } else if (!strcmp(arg, "--help")) {
+            usage();
+            return 0;
+        } else {
+            std::cerr << "error: unknown option " << arg << "\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    Trace::Open();
+
+    long long start = OS::GetTime();
+
+    OS::Thread **threads = new OS::Thread *[num_threads];
+    for (unsigned i = 0; i < num_threads; ++i) {
+        threads[i] = OS::StartThread(threadFunction, NULL);
+    }
+    for (unsigned i = 0; i < num_threads; ++i) {
+        OS::JoinThread(threads[i]);
+    }
+    delete [] threads;
+
+    /* Wait for everything to reach the file */
+    Trace::Close();
+
+    long long end = OS::GetTime();
+
+    double seconds = (end - start) * 1e-6;
+    double calls = (double)num_threads * num_calls;
+    std::cout << num_threads << " threads, " << calls << " calls in " << seconds << " s: "
+              << (unsigned long long)(calls / seconds) << " calls/s\n";
+    if (thread_time) {
+        std::cout << "calling threads: " << thread_time * 1e3 / calls << " ns of CPU time per call"
+                  << (Trace::defer_args ? ", deferring arguments" : "") << "\n";
+    }
+
+    return 0;
+}
@@ -57,6 +57,7 @@ if __name__ == '__main__':
     print
     print '#include "glproc.hpp"'
     print '#include "glsize.hpp"'
+    print '#include "gltrace.hpp"'
     print
 
     api = API()
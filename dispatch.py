@@ -39,6 +39,10 @@ def function_pointer_value(function):
     return '__' + function.name + '_ptr'
 
 
+def function_resolver_name(function):
+    return '__' + function.name + '_resolve'
+
+
 class Dispatcher:
 
     def header(self):
@@ -76,17 +80,23 @@ class Dispatcher:
         ptype = function_pointer_type(function)
         pvalue = function_pointer_value(function)
         print 'typedef ' + function.prototype('* %s' % ptype) + ';'
-        print 'static %s %s = NULL;' % (ptype, pvalue)
+        print 'static ' + function.prototype(function_resolver_name(function)) + ';'
+        print 'static %s %s = &%s;' % (ptype, pvalue, function_resolver_name(function))
         print
         print 'static inline ' + function.prototype('__' + function.name) + ' {'
         if function.type is stdapi.Void:
             ret = ''
         else:
             ret = 'return '
-        self.get_true_pointer(function)
         print '    %s%s(%s);' % (ret, pvalue, ', '.join([str(arg.name) for arg in function.args]))
         print '}'
         print
+        print 'static ' + function.prototype(function_resolver_name(function)) + ' {'
+        self.get_true_pointer(function)
+        print '    %s = ptr;' % (pvalue,)
+        print '    %sptr(%s);' % (ret, ', '.join([str(arg.name) for arg in function.args]))
+        print '}'
+        print
         if self.is_public_function(function):
             print '#endif /* !RETRACE */'
             print
@@ -94,30 +104,38 @@ class Dispatcher:
     def is_public_function(self, function):
         return True
 
-    def get_true_pointer(self, function):
-        ptype = function_pointer_type(function)
-        pvalue = function_pointer_value(function)
+    def get_proc_address(self, function):
         if self.is_public_function(function):
-            get_proc_address = '__getPublicProcAddress'
+            return '__getPublicProcAddress'
         else:
-            get_proc_address = '__getPrivateProcAddress'
-        print '    if (!%s) {' % (pvalue,)
-        print '        %s = (%s)%s("%s");' % (pvalue, ptype, get_proc_address, function.name)
-        print '        if (!%s) {' % (pvalue,)
+            return '__getPrivateProcAddress'
+
+    def get_true_pointer(self, function):
+        ptype = function_pointer_type(function)
+        print '    %s ptr = (%s)%s("%s");' % (ptype, ptype, self.get_proc_address(function), function.name)
+        print '    if (!ptr) {'
         self.fail_function(function)
-        print '        }'
+        print '    }'
+
+    def resolve_function(self, function):
+        '''Resolve the true pointer ahead of the first call, keeping the
+        lazy resolver when the function is unavailable.'''
+        ptype = function_pointer_type(function)
+        pvalue = function_pointer_value(function)
+        print '    if (%s ptr = (%s)%s("%s")) {' % (ptype, ptype, self.get_proc_address(function), function.name)
+        print '        %s = ptr;' % (pvalue,)
         print '    }'
 
     def fail_function(self, function):
-        print '            OS::DebugMessage("error: unavailable function \\"%s\\"\\n");' % function.name
+        print '        OS::DebugMessage("error: unavailable function \\"%s\\"\\n");' % function.name
         if function.fail is not None:
             if function.type is stdapi.Void:
                 assert function.fail == ''
-                print '            return;' 
+                print '        return;' 
             else:
                 assert function.fail != ''
-                print '            return %s;' % function.fail
+                print '        return %s;' % function.fail
         else:
-            print '            __abort();'
+            print '        __abort();'
 
 
@@ -0,0 +1,392 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Find the range of vertex indices referred by index arrays.
+ *
+ * This is done for every draw call with user arrays, over possibly large
+ * index arrays, so there are SSE2 and AVX2 versions of the scan, the latter
+ * chosen at runtime.  Indices equal to the primitive restart index are
+ * skipped when primitive restart is enabled.
+ */
+
+#ifndef _GL_INDEX_HPP_
+#define _GL_INDEX_HPP_
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include "os.hpp"
+#include "glimports.hpp"
+
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define __GL_INDEX_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && \
+    (defined(__i386__) || defined(__x86_64__))
+#define __GL_INDEX_AVX2 1
+#include <immintrin.h>
+#endif
+
+
+template <class T, bool restart>
+static inline void
+__gl_index_range_scalar(const T *p, size_t count, T restart_index, GLuint *minindex, GLuint *maxindex)
+{
+    GLuint min = *minindex;
+    GLuint max = *maxindex;
+    for (size_t i = 0; i < count; ++i) {
+        GLuint index = p[i];
+        if (restart && p[i] == restart_index) {
+            continue;
+        }
+        if (index < min) {
+            min = index;
+        }
+        if (index > max) {
+            max = index;
+        }
+    }
+    *minindex = min;
+    *maxindex = max;
+}
+
+
+/*
+ * Reduce the lanes of the vector minimum and maximum.
+ */
+template <class T, class V>
+static inline void
+__gl_index_range_reduce(const V &vmin, const V &vmax, T bias, GLuint *minindex, GLuint *maxindex)
+{
+    T mins[sizeof(V) / sizeof(T)];
+    T maxs[sizeof(V) / sizeof(T)];
+    memcpy(mins, &vmin, sizeof(V));
+    memcpy(maxs, &vmax, sizeof(V));
+    for (size_t i = 0; i < sizeof(V) / sizeof(T); ++i) {
+        GLuint min = (T)(mins[i] ^ bias);
+        GLuint max = (T)(maxs[i] ^ bias);
+        if (min < *minindex) {
+            *minindex = min;
+        }
+        if (max > *maxindex) {
+            *maxindex = max;
+        }
+    }
+}
+
+
+#ifdef __GL_INDEX_SSE2
+
+/*
+ * SSE2 only has unsigned minimum/maximum for bytes, so shorts are biased to
+ * use the signed ones, and ints are compared by hand.
+ */
+
+static inline __m128i
+__gl_index_min_epu32_sse2(__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+static inline __m128i
+__gl_index_max_epu32_sse2(__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+template <bool restart>
+static inline size_t
+__gl_index_range_ubyte_sse2(const GLubyte *p, size_t count, GLubyte restart_index, GLuint *minindex, GLuint *maxindex)
+{
+    size_t n = count & ~(size_t)15;
+    if (!n) {
+        return 0;
+    }
+    __m128i vmin = _mm_set1_epi8((char)0xff);
+    __m128i vmax = _mm_setzero_si128();
+    __m128i vrestart = _mm_set1_epi8((char)restart_index);
+    for (size_t i = 0; i < n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        if (restart) {
+            // Restart indices become neutral for both the minimum and maximum
+            __m128i eq = _mm_cmpeq_epi8(v, vrestart);
+            vmin = _mm_min_epu8(vmin, _mm_or_si128(v, eq));
+            vmax = _mm_max_epu8(vmax, _mm_andnot_si128(eq, v));
+        } else {
+            vmin = _mm_min_epu8(vmin, v);
+            vmax = _mm_max_epu8(vmax, v);
+        }
+    }
+    __gl_index_range_reduce<GLubyte>(vmin, vmax, 0, minindex, maxindex);
+    return n;
+}
+
+template <bool restart>
+static inline size_t
+__gl_index_range_ushort_sse2(const GLushort *p, size_t count, GLushort restart_index, GLuint *minindex, GLuint *maxindex)
+{
+    size_t n = count & ~(size_t)7;
+    if (!n) {
+        return 0;
+    }
+    __m128i vbias = _mm_set1_epi16((short)0x8000);
+    __m128i vmin = _mm_set1_epi16(0x7fff);
+    __m128i vmax = _mm_set1_epi16((short)0x8000);
+    __m128i vrestart = _mm_set1_epi16((short)restart_index);
+    for (size_t i = 0; i < n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        if (restart) {
+            __m128i eq = _mm_cmpeq_epi16(v, vrestart);
+            vmin = _mm_min_epi16(vmin, _mm_xor_si128(_mm_or_si128(v, eq), vbias));
+            vmax = _mm_max_epi16(vmax, _mm_xor_si128(_mm_andnot_si128(eq, v), vbias));
+        } else {
+            v = _mm_xor_si128(v, vbias);
+            vmin = _mm_min_epi16(vmin, v);
+            vmax = _mm_max_epi16(vmax, v);
+        }
+    }
+    __gl_index_range_reduce<GLushort>(vmin, vmax, 0x8000, minindex, maxindex);
+    return n;
+}
+
+template <bool restart>
+static inline size_t
+__gl_index_range_uint_sse2(const GLuint *p, size_t count, GLuint restart_index, GLuint *minindex, GLuint *maxindex)
+{
+    size_t n = count & ~(size_t)3;
+    if (!n) {
+        return 0;
+    }
+    __m128i vbias = _mm_set1_epi32((int)0x80000000);
+    __m128i vmin = _mm_set1_epi32(0x7fffffff);
+    __m128i vmax = _mm_set1_epi32((int)0x80000000);
+    __m128i vrestart = _mm_set1_epi32((int)restart_index);
+    for (size_t i = 0; i < n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i vlo = v;
+        __m128i vhi = v;
+        if (restart) {
+            __m128i eq = _mm_cmpeq_epi32(v, vrestart);
+            vlo = _mm_or_si128(v, eq);
+            vhi = _mm_andnot_si128(eq, v);
+        }
+        vmin = __gl_index_min_epu32_sse2(vmin, _mm_xor_si128(vlo, vbias));
+        vmax = __gl_index_max_epu32_sse2(vmax, _mm_xor_si128(vhi, vbias));
+    }
+    __gl_index_range_reduce<GLuint>(vmin, vmax, 0x80000000, minindex, maxindex);
+    return n;
+}
+
+#endif /* __GL_INDEX_SSE2 */
+
+
+#ifdef __GL_INDEX_AVX2
+
+template <bool restart>
+__attribute__((target("avx2"))) static inline size_t
+__gl_index_range_ubyte_avx2(const GLubyte *p, size_t count, GLubyte restart_index, GLuint *minindex, GLuint *maxindex)
+{
+    size_t n = count & ~(size_t)31;
+    if (!n) {
+        return 0;
+    }
+    __m256i vmin = _mm256_set1_epi8((char)0xff);
+    __m256i vmax = _mm256_setzero_si256();
+    __m256i vrestart = _mm256_set1_epi8((char)restart_index);
+    for (size_t i = 0; i < n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        if (restart) {
+            __m256i eq = _mm256_cmpeq_epi8(v, vrestart);
+            vmin = _mm256_min_epu8(vmin, _mm256_or_si256(v, eq));
+            vmax = _mm256_max_epu8(vmax, _mm256_andnot_si256(eq, v));
+        } else {
+            vmin = _mm256_min_epu8(vmin, v);
+            vmax = _mm256_max_epu8(vmax, v);
+        }
+    }
+    __gl_index_range_reduce<GLubyte>(vmin, vmax, 0, minindex, maxindex);
+    return n;
+}
+
+template <bool restart>
+__attribute__((target("avx2"))) static inline size_t
+__gl_index_range_ushort_avx2(const GLushort *p, size_t count, GLushort restart_index, GLuint *minindex, GLuint *maxindex)
+{
+    size_t n = count & ~(size_t)15;
+    if (!n) {
+        return 0;
+    }
+    __m256i vmin = _mm256_set1_epi16((short)0xffff);
+    __m256i vmax = _mm256_setzero_si256();
+    __m256i vrestart = _mm256_set1_epi16((short)restart_index);
+    for (size_t i = 0; i < n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        if (restart) {
+            __m256i eq = _mm256_cmpeq_epi16(v, vrestart);
+            vmin = _mm256_min_epu16(vmin, _mm256_or_si256(v, eq));
+            vmax = _mm256_max_epu16(vmax, _mm256_andnot_si256(eq, v));
+        } else {
+            vmin = _mm256_min_epu16(vmin, v);
+            vmax = _mm256_max_epu16(vmax, v);
+        }
+    }
+    __gl_index_range_reduce<GLushort>(vmin, vmax, 0, minindex, maxindex);
+    return n;
+}
+
+template <bool restart>
+__attribute__((target("avx2"))) static inline size_t
+__gl_index_range_uint_avx2(const GLuint *p, size_t count, GLuint restart_index, GLuint *minindex, GLuint *maxindex)
+{
+    size_t n = count & ~(size_t)7;
+    if (!n) {
+        return 0;
+    }
+    __m256i vmin = _mm256_set1_epi32((int)0xffffffff);
+    __m256i vmax = _mm256_setzero_si256();
+    __m256i vrestart = _mm256_set1_epi32((int)restart_index);
+    for (size_t i = 0; i < n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        if (restart) {
+            __m256i eq = _mm256_cmpeq_epi32(v, vrestart);
+            vmin = _mm256_min_epu32(vmin, _mm256_or_si256(v, eq));
+            vmax = _mm256_max_epu32(vmax, _mm256_andnot_si256(eq, v));
+        } else {
+            vmin = _mm256_min_epu32(vmin, v);
+            vmax = _mm256_max_epu32(vmax, v);
+        }
+    }
+    __gl_index_range_reduce<GLuint>(vmin, vmax, 0, minindex, maxindex);
+    return n;
+}
+
+static inline bool
+__gl_index_have_avx2(void)
+{
+    static int avx2 = -1;
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return avx2;
+}
+
+#endif /* __GL_INDEX_AVX2 */
+
+
+#if defined(__GL_INDEX_AVX2) && defined(__GL_INDEX_SSE2)
+#define __GL_INDEX_KERNEL(name, restart) \
+    (__gl_index_have_avx2() ? &name##_avx2<restart> : &name##_sse2<restart>)
+#elif defined(__GL_INDEX_AVX2)
+#define __GL_INDEX_KERNEL(name, restart) \
+    (__gl_index_have_avx2() ? &name##_avx2<restart> : NULL)
+#elif defined(__GL_INDEX_SSE2)
+#define __GL_INDEX_KERNEL(name, restart) \
+    &name##_sse2<restart>
+#else
+#define __GL_INDEX_KERNEL(name, restart) \
+    NULL
+#endif
+
+
+template <class T, bool restart>
+static inline void
+__gl_index_range_type(const T *p, size_t count, T restart_index, GLuint *minindex, GLuint *maxindex,
+                      size_t (*kernel)(const T *, size_t, T, GLuint *, GLuint *))
+{
+    size_t done = 0;
+    if (kernel) {
+        done = kernel(p, count, restart_index, minindex, maxindex);
+    }
+    __gl_index_range_scalar<T, restart>(p + done, count - done, restart_index, minindex, maxindex);
+}
+
+template <class T>
+static inline void
+__gl_index_range_type(const T *p, size_t count, bool restart, GLuint restart_index, GLuint *minindex, GLuint *maxindex,
+                      size_t (*kernel)(const T *, size_t, T, GLuint *, GLuint *),
+                      size_t (*restart_kernel)(const T *, size_t, T, GLuint *, GLuint *))
+{
+    // Restart indices that don't fit in the index type never match
+    if (restart && restart_index == (T)restart_index) {
+        __gl_index_range_type<T, true>(p, count, (T)restart_index, minindex, maxindex, restart_kernel);
+    } else {
+        __gl_index_range_type<T, false>(p, count, 0, minindex, maxindex, kernel);
+    }
+}
+
+
+/**
+ * Smallest and largest of count indices, ignoring the primitive restart
+ * index if enabled.  Both are zero when there are no indices.
+ */
+static inline void
+__gl_index_range(GLsizei count, GLenum type, const GLvoid *indices, bool restart, GLuint restart_index, GLuint *minindex, GLuint *maxindex)
+{
+    GLuint min = ~0U;
+    GLuint max = 0;
+
+    if (count > 0) {
+        switch (type) {
+        case GL_UNSIGNED_BYTE:
+            __gl_index_range_type<GLubyte>((const GLubyte *)indices, count, restart, restart_index, &min, &max,
+                                  __GL_INDEX_KERNEL(__gl_index_range_ubyte, false),
+                                  __GL_INDEX_KERNEL(__gl_index_range_ubyte, true));
+            break;
+        case GL_UNSIGNED_SHORT:
+            __gl_index_range_type<GLushort>((const GLushort *)indices, count, restart, restart_index, &min, &max,
+                                  __GL_INDEX_KERNEL(__gl_index_range_ushort, false),
+                                  __GL_INDEX_KERNEL(__gl_index_range_ushort, true));
+            break;
+        case GL_UNSIGNED_INT:
+            __gl_index_range_type<GLuint>((const GLuint *)indices, count, restart, restart_index, &min, &max,
+                                  __GL_INDEX_KERNEL(__gl_index_range_uint, false),
+                                  __GL_INDEX_KERNEL(__gl_index_range_uint, true));
+            break;
+        default:
+            OS::DebugMessage("warning: %s: unknown GLenum 0x%04X\n", __FUNCTION__, type);
+            break;
+        }
+    }
+
+    if (min > max) {
+        min = 0;
+        max = 0;
+    }
+
+    *minindex = min;
+    *maxindex = max;
+}
+
+
+#endif /* _GL_INDEX_HPP_ */
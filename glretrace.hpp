@@ -26,6 +26,7 @@
 #ifndef _GLRETRACE_HPP_
 #define _GLRETRACE_HPP_
 
+#include "glimports.hpp"
 #include "trace_parser.hpp"
 #include "glws.hpp"
 
@@ -61,6 +62,19 @@ void retrace_call_wgl(Trace::Call &call);
 void snapshot(unsigned call_no);
 void frame_complete(unsigned call_no);
 
+/*
+ * Client array bookkeeping, so that the blobs arrays point into outlive the
+ * calls that specified them, for as long as draws may read them.
+ */
+void holdClientArray(GLenum array, GLuint index, Trace::Value &value);
+void holdInterleavedArrays(GLenum format, Trace::Value &value);
+void clientActiveTexture(GLenum texture);
+void bindVertexArray(GLuint array);
+void deleteVertexArrays(GLsizei n, const GLuint *arrays);
+void pushClientAttrib(GLbitfield mask);
+void popClientAttrib(void);
+void destroyContext(glws::Context *context);
+
 
 } /* namespace glretrace */
 
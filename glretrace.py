@@ -69,6 +69,39 @@ class GlRetracer(Retracer):
         #"glMatrixIndexPointerARB",
     ))
 
+    # Array each pointer function specifies, so that aliases share the blob
+    # they hold, and its index
+    client_arrays = {
+        "glVertexPointer": ("GL_VERTEX_ARRAY", "0"),
+        "glNormalPointer": ("GL_NORMAL_ARRAY", "0"),
+        "glColorPointer": ("GL_COLOR_ARRAY", "0"),
+        "glIndexPointer": ("GL_INDEX_ARRAY", "0"),
+        "glTexCoordPointer": ("GL_TEXTURE_COORD_ARRAY", "0"),
+        "glEdgeFlagPointer": ("GL_EDGE_FLAG_ARRAY", "0"),
+        "glFogCoordPointer": ("GL_FOG_COORD_ARRAY", "0"),
+        "glSecondaryColorPointer": ("GL_SECONDARY_COLOR_ARRAY", "0"),
+
+        "glVertexPointerEXT": ("GL_VERTEX_ARRAY", "0"),
+        "glNormalPointerEXT": ("GL_NORMAL_ARRAY", "0"),
+        "glColorPointerEXT": ("GL_COLOR_ARRAY", "0"),
+        "glIndexPointerEXT": ("GL_INDEX_ARRAY", "0"),
+        "glTexCoordPointerEXT": ("GL_TEXTURE_COORD_ARRAY", "0"),
+        "glEdgeFlagPointerEXT": ("GL_EDGE_FLAG_ARRAY", "0"),
+        "glFogCoordPointerEXT": ("GL_FOG_COORD_ARRAY", "0"),
+        "glSecondaryColorPointerEXT": ("GL_SECONDARY_COLOR_ARRAY", "0"),
+
+        "glVertexAttribPointer": ("GL_VERTEX_ATTRIB_ARRAY_POINTER", "index"),
+        "glVertexAttribPointerARB": ("GL_VERTEX_ATTRIB_ARRAY_POINTER", "index"),
+        "glVertexAttribIPointer": ("GL_VERTEX_ATTRIB_ARRAY_POINTER", "index"),
+        "glVertexAttribIPointerEXT": ("GL_VERTEX_ATTRIB_ARRAY_POINTER", "index"),
+        "glVertexAttribLPointer": ("GL_VERTEX_ATTRIB_ARRAY_POINTER", "index"),
+        "glVertexAttribLPointerEXT": ("GL_VERTEX_ATTRIB_ARRAY_POINTER", "index"),
+
+        # NV attributes alias the conventional arrays; keeping them apart
+        # only means holding on to more blobs
+        "glVertexAttribPointerNV": ("GL_VERTEX_ATTRIB_ARRAY0_NV", "index"),
+    }
+
     draw_array_function_names = set([
         "glDrawArrays",
         "glDrawArraysEXT",
@@ -157,6 +190,66 @@ class GlRetracer(Retracer):
         
         Retracer.call_function(self, function)
 
+        # Remember where buffers got mapped, as the memcpy calls emitted by the
+        # tracer may write anywhere inside them
+        if function.name in self.map_function_names:
+            arg_names = [arg.name for arg in function.args]
+            if function.name.endswith('ATI'):
+                # No way to tell the size, so only the start address resolves
+                print '    GLint __length = 0;'
+                mapped, buffer = '__mapped_object_buffers', 'buffer'
+            else:
+                if 'length' in arg_names:
+                    print '    GLint __length = length;'
+                else:
+                    print '    GLint __length = 0;'
+                    if 'buffer' in arg_names:
+                        print '    glGetNamedBufferParameterivEXT(buffer, GL_BUFFER_SIZE, &__length);'
+                    else:
+                        print '    glGetBufferParameteriv(target, GL_BUFFER_SIZE, &__length);'
+                if 'buffer' in arg_names:
+                    mapped, buffer = '__mapped_buffers', 'buffer'
+                else:
+                    mapped, buffer = '__mapped_buffers', '__get_buffer_binding(target)'
+            print '    if (__result) {'
+            print '        __map(%s, %s, call.ret->toUIntPtr(), __result, __length);' % (mapped, buffer)
+            print '    }'
+
+        # Forget mappings as they go away, so that their addresses can't
+        # resolve to stale storage
+        if function.name in ('glUnmapBuffer', 'glUnmapBufferARB'):
+            print '    __unmap(__mapped_buffers, __get_buffer_binding(target));'
+        if function.name == 'glUnmapNamedBufferEXT':
+            print '    __unmap(__mapped_buffers, buffer);'
+        if function.name == 'glUnmapObjectBufferATI':
+            print '    __unmap(__mapped_object_buffers, buffer);'
+        if function.name in ('glDeleteBuffers', 'glDeleteBuffersARB'):
+            buffers = function.args[1].name
+            print '    if (%s) {' % buffers
+            print '        for (GLsizei __i = 0; __i < n; ++__i) {'
+            print '            __unmap(__mapped_buffers, %s[__i]);' % buffers
+            print '        }'
+            print '    }'
+
+        # Follow what the client arrays being specified belong to
+        if function.name in ('glClientActiveTexture', 'glClientActiveTextureARB'):
+            print '    glretrace::clientActiveTexture(texture);'
+        if function.name in ('glBindVertexArray', 'glBindVertexArrayAPPLE'):
+            print '    glretrace::bindVertexArray(array);'
+        if function.name in ('glDeleteVertexArrays', 'glDeleteVertexArraysAPPLE'):
+            print '    if (arrays) {'
+            print '        glretrace::deleteVertexArrays(n, arrays);'
+            print '    }'
+        if function.name in ('glPushClientAttrib', 'glPushClientAttribDefaultEXT'):
+            print '    glretrace::pushClientAttrib(mask);'
+        if function.name == 'glPopClientAttrib':
+            print '    glretrace::popClientAttrib();'
+        if function.name in ('glClientAttribDefaultEXT', 'glPushClientAttribDefaultEXT'):
+            print '    if (mask & GL_CLIENT_VERTEX_ARRAY_BIT) {'
+            print '        glretrace::clientActiveTexture(GL_TEXTURE0);'
+            print '        glretrace::bindVertexArray(0);'
+            print '    }'
+
         # Error checking
         if function.name == "glBegin":
             print '    glretrace::insideGlBeginEnd = true;'
@@ -215,7 +308,7 @@ class GlRetracer(Retracer):
                 print r'             std::cerr << call.no << ": warning: " << infoLog << "\n";'
                 print r'             delete [] infoLog;'
                 print r'        }'
-            if function.name in ('glMapBuffer', 'glMapBufferARB', 'glMapBufferRange', 'glMapNamedBufferEXT', 'glMapNamedBufferRangeEXT'):
+            if function.name in self.map_function_names:
                 print r'        if (!__result) {'
                 print r'             std::cerr << call.no << ": warning: failed to map buffer\n";'
                 print r'        }'
@@ -226,9 +319,23 @@ class GlRetracer(Retracer):
                 print r'    }'
             print '    }'
 
+    map_function_names = set([
+        function.name for function in glapi.glapi.functions
+        if function.type is glapi.GLmap
+    ])
+
     def extract_arg(self, function, arg, arg_type, lvalue, rvalue):
+        if function.name == 'memcpy' and arg.name == 'dest':
+            print '    %s = static_cast<%s>(retrace::lookupAddress(%s.toUIntPtr()));' % (lvalue, arg_type, rvalue)
+            return
+
         if function.name in self.array_pointer_function_names and arg.name == 'pointer':
             print '    %s = static_cast<%s>(%s.toPointer());' % (lvalue, arg_type, rvalue)
+            if function.name == 'glInterleavedArrays':
+                print '    glretrace::holdInterleavedArrays(format, %s);' % rvalue
+            else:
+                array, index = self.client_arrays[function.name]
+                print '    glretrace::holdClientArray(%s, %s, %s);' % (array, index, rvalue)
             return
 
         if function.name in self.draw_elements_function_names and arg.name == 'indices':
@@ -260,10 +367,50 @@ if __name__ == '__main__':
     print r'''
 #include <string.h>
 
+#include <map>
+
 #include "glproc.hpp"
+#include "glsize.hpp"
+#include "retrace.hpp"
 #include "glretrace.hpp"
 
 
+static GLuint
+__get_buffer_binding(GLenum target) {
+    GLenum pname = __gl_buffer_binding_pname(target);
+    if (pname == GL_NONE) {
+        return 0;
+    }
+    GLint buffer = 0;
+    glGetIntegerv(pname, &buffer);
+    return buffer;
+}
+
+
+/*
+ * Recorded address each mapped buffer got mapped at, by buffer name.  ATI
+ * object buffers have names of their own.
+ */
+typedef std::map<GLuint, unsigned long long> MappedBufferMap;
+static MappedBufferMap __mapped_buffers;
+static MappedBufferMap __mapped_object_buffers;
+
+static void
+__map(MappedBufferMap &mapped, GLuint buffer, unsigned long long address, void *map, GLint length) {
+    retrace::addRegion(address, map, length);
+    mapped[buffer] = address;
+}
+
+static void
+__unmap(MappedBufferMap &mapped, GLuint buffer) {
+    MappedBufferMap::iterator it = mapped.find(buffer);
+    if (it != mapped.end()) {
+        retrace::delRegion(it->second);
+        mapped.erase(it);
+    }
+}
+
+
 '''
     api = glapi.glapi
     api.add_function(glapi.memcpy)
@@ -0,0 +1,285 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Keep the blobs holding client arrays alive for as long as GL may read them,
+ * that is, until the same array of the same vertex array object of the same
+ * context is specified again.
+ */
+
+
+#include <list>
+#include <map>
+
+#include "glproc.hpp"
+#include "retrace.hpp"
+#include "glretrace.hpp"
+
+
+namespace glretrace {
+
+
+struct ArrayKey {
+    GLuint vertex_array;
+    GLenum array;
+    GLuint index;
+
+    ArrayKey(GLuint _vertex_array, GLenum _array, GLuint _index) :
+        vertex_array(_vertex_array), array(_array), index(_index) {}
+
+    bool operator < (const ArrayKey &other) const {
+        if (vertex_array != other.vertex_array) {
+            return vertex_array < other.vertex_array;
+        }
+        if (array != other.array) {
+            return array < other.array;
+        }
+        return index < other.index;
+    }
+};
+
+typedef std::map<ArrayKey, Trace::Buffer *> BufferMap;
+
+
+/*
+ * Client vertex array state saved by glPushClientAttrib, with references to
+ * the buffers of the vertex array object bound then.
+ */
+struct PushedArrays {
+    bool arrays;
+    GLuint vertex_array;
+    GLenum client_active_texture;
+    BufferMap buffers;
+};
+
+
+struct ArrayState {
+    GLuint vertex_array;
+    GLenum client_active_texture;
+    BufferMap buffers;
+    std::list<PushedArrays> pushed;
+
+    ArrayState() : vertex_array(0), client_active_texture(GL_TEXTURE0) {}
+};
+
+typedef std::map<glws::Context *, ArrayState> ArrayStateMap;
+static ArrayStateMap array_states;
+
+
+static inline ArrayState &
+currentState(void) {
+    return array_states[context];
+}
+
+
+static void
+hold(BufferMap &buffers, const ArrayKey &key, Trace::Buffer *buffer) {
+    BufferMap::iterator it = buffers.find(key);
+    if (it != buffers.end()) {
+        it->second->unref();
+        if (buffer) {
+            it->second = buffer;
+        } else {
+            buffers.erase(it);
+        }
+    } else if (buffer) {
+        buffers[key] = buffer;
+    }
+}
+
+
+static void
+release(BufferMap &buffers, GLuint vertex_array) {
+    BufferMap::iterator it = buffers.lower_bound(ArrayKey(vertex_array, 0, 0));
+    while (it != buffers.end() && it->first.vertex_array == vertex_array) {
+        it->second->unref();
+        buffers.erase(it++);
+    }
+}
+
+
+static void
+releaseAll(BufferMap &buffers) {
+    for (BufferMap::iterator it = buffers.begin(); it != buffers.end(); ++it) {
+        it->second->unref();
+    }
+    buffers.clear();
+}
+
+
+void
+holdClientArray(GLenum array, GLuint index, Trace::Value &value) {
+    ArrayState &state = currentState();
+    if (array == GL_TEXTURE_COORD_ARRAY) {
+        index = state.client_active_texture - GL_TEXTURE0;
+    }
+
+    Trace::Blob *blob = dynamic_cast<Trace::Blob *>(&value);
+    Trace::Buffer *buffer = blob ? blob->buffer->ref() : NULL;
+    hold(state.buffers, ArrayKey(state.vertex_array, array, index), buffer);
+}
+
+
+void
+holdInterleavedArrays(GLenum format, Trace::Value &value) {
+    bool texcoord = false;
+    bool color = false;
+    bool normal = false;
+    switch (format) {
+    case GL_V2F:
+    case GL_V3F:
+        break;
+    case GL_C4UB_V2F:
+    case GL_C4UB_V3F:
+    case GL_C3F_V3F:
+        color = true;
+        break;
+    case GL_N3F_V3F:
+        normal = true;
+        break;
+    case GL_C4F_N3F_V3F:
+        color = true;
+        normal = true;
+        break;
+    case GL_T2F_V3F:
+    case GL_T4F_V4F:
+        texcoord = true;
+        break;
+    case GL_T2F_C4UB_V3F:
+    case GL_T2F_C3F_V3F:
+        texcoord = true;
+        color = true;
+        break;
+    case GL_T2F_N3F_V3F:
+        texcoord = true;
+        normal = true;
+        break;
+    case GL_T2F_C4F_N3F_V3F:
+    case GL_T4F_C4F_N3F_V4F:
+        texcoord = true;
+        color = true;
+        normal = true;
+        break;
+    default:
+        /* Invalid, so nothing is specified */
+        return;
+    }
+
+    /* Only the arrays the format has get their pointer set */
+    holdClientArray(GL_VERTEX_ARRAY, 0, value);
+    if (texcoord) {
+        holdClientArray(GL_TEXTURE_COORD_ARRAY, 0, value);
+    }
+    if (color) {
+        holdClientArray(GL_COLOR_ARRAY, 0, value);
+    }
+    if (normal) {
+        holdClientArray(GL_NORMAL_ARRAY, 0, value);
+    }
+}
+
+
+void
+clientActiveTexture(GLenum texture) {
+    currentState().client_active_texture = texture;
+}
+
+
+void
+bindVertexArray(GLuint array) {
+    currentState().vertex_array = array;
+}
+
+
+void
+deleteVertexArrays(GLsizei n, const GLuint *arrays) {
+    ArrayState &state = currentState();
+    for (GLsizei i = 0; i < n; ++i) {
+        if (!arrays[i]) {
+            continue;
+        }
+        release(state.buffers, arrays[i]);
+        if (arrays[i] == state.vertex_array) {
+            state.vertex_array = 0;
+        }
+    }
+}
+
+
+void
+pushClientAttrib(GLbitfield mask) {
+    ArrayState &state = currentState();
+
+    PushedArrays pushed;
+    pushed.arrays = (mask & GL_CLIENT_VERTEX_ARRAY_BIT) != 0;
+    pushed.vertex_array = state.vertex_array;
+    pushed.client_active_texture = state.client_active_texture;
+    if (pushed.arrays) {
+        BufferMap::iterator it = state.buffers.lower_bound(ArrayKey(state.vertex_array, 0, 0));
+        for ( ; it != state.buffers.end() && it->first.vertex_array == state.vertex_array; ++it) {
+            pushed.buffers[it->first] = it->second->ref();
+        }
+    }
+    state.pushed.push_back(pushed);
+}
+
+
+void
+popClientAttrib(void) {
+    ArrayState &state = currentState();
+    if (state.pushed.empty()) {
+        return;
+    }
+
+    PushedArrays &pushed = state.pushed.back();
+    if (pushed.arrays) {
+        /* The arrays get their pushed pointers back */
+        release(state.buffers, pushed.vertex_array);
+        state.buffers.insert(pushed.buffers.begin(), pushed.buffers.end());
+        state.vertex_array = pushed.vertex_array;
+        state.client_active_texture = pushed.client_active_texture;
+    }
+    state.pushed.pop_back();
+}
+
+
+void
+destroyContext(glws::Context *ctx) {
+    ArrayStateMap::iterator it = array_states.find(ctx);
+    if (it == array_states.end()) {
+        return;
+    }
+
+    ArrayState &state = it->second;
+    releaseAll(state.buffers);
+    for (std::list<PushedArrays>::iterator pushed = state.pushed.begin(); pushed != state.pushed.end(); ++pushed) {
+        releaseAll(pushed->buffers);
+    }
+    array_states.erase(it);
+}
+
+
+} /* namespace glretrace */
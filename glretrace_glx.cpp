@@ -69,6 +69,11 @@ static void retrace_glXCreateContext(Trace::Call &call) {
 }
 
 static void retrace_glXDestroyContext(Trace::Call &call) {
+    glws::Context *old_context = context_map[call.arg(1).toPointer()];
+    /* GLX only destroys current contexts once they are released */
+    if (old_context && old_context != context) {
+        glretrace::destroyContext(old_context);
+    }
 }
 
 static void retrace_glXMakeCurrent(Trace::Call &call) {
@@ -44,6 +44,7 @@ glws::Drawable *drawable = NULL;
 glws::Context *context = NULL;
 
 unsigned frame = 0;
+unsigned start_frame = 0;
 long long startTime = 0;
 bool wait = false;
 
@@ -190,12 +191,13 @@ static void display(void) {
 
     long long endTime = OS::GetTime();
     float timeInterval = (endTime - startTime) * 1.0E-6;
+    unsigned frames = frame - start_frame;
 
     if (retrace::verbosity >= -1) { 
         std::cout << 
-            "Rendered " << frame << " frames"
+            "Rendered " << frames << " frames"
             " in " <<  timeInterval << " secs,"
-            " average of " << (frame/timeInterval) << " fps\n";
+            " average of " << (frames/timeInterval) << " fps\n";
     }
 
     if (wait) {
@@ -217,6 +219,7 @@ static void usage(void) {
         "  -s PREFIX    take snapshots\n"
         "  -v           verbose output\n"
         "  -D CALLNO    dump state at specific call no\n"
+        "  -f FRAME     start at frame FRAME, skipping the state set up before\n"
         "  -w           wait on final frame\n";
 }
 
@@ -244,6 +247,8 @@ int main(int argc, char **argv)
             retrace::verbosity = -2;
         } else if (!strcmp(arg, "-db")) {
             double_buffer = true;
+        } else if (!strcmp(arg, "-f")) {
+            start_frame = atoi(argv[++i]);
         } else if (!strcmp(arg, "--help")) {
             usage();
             return 0;
@@ -265,6 +270,13 @@ int main(int argc, char **argv)
 
     for ( ; i < argc; ++i) {
         if (parser.open(argv[i])) {
+            if (start_frame) {
+                if (!parser.seek_frame(start_frame)) {
+                    std::cerr << "error: cannot seek to frame " << start_frame << "\n";
+                    return 1;
+                }
+                frame = start_frame;
+            }
             startTime = OS::GetTime();
             display();
             parser.close();
@@ -61,6 +61,10 @@ static void retrace_wglCreateContext(Trace::Call &call) {
 }
 
 static void retrace_wglDeleteContext(Trace::Call &call) {
+    glws::Context *old_context = context_map[call.arg(0).toUIntPtr()];
+    if (old_context) {
+        glretrace::destroyContext(old_context);
+    }
 }
 
 static void retrace_wglMakeCurrent(Trace::Call &call) {
@@ -116,6 +120,7 @@ static void retrace_wglShareLists(Trace::Call &call) {
     glws::Context *new_context =
         ws->createContext(old_context->visual, share_context);
     if (new_context) {
+        glretrace::destroyContext(old_context);
         delete old_context;
         context_map[hglrc2] = new_context;
     }
@@ -36,6 +36,7 @@
 
 #include "os.hpp"
 #include "glimports.hpp"
+#include "glindex.hpp"
 
 
 static inline size_t
@@ -111,7 +112,7 @@ __glDrawElementsBaseVertex_maxindex(GLsizei count, GLenum type, const GLvoid *in
         // Read indices from index buffer object
         GLintptr offset = (GLintptr)indices;
         GLsizeiptr size = count*__gl_type_size(type);
-        GLvoid *temp = malloc(size);
+        temp = malloc(size);
         if (!temp) {
             return 0;
         }
@@ -124,36 +125,11 @@ __glDrawElementsBaseVertex_maxindex(GLsizei count, GLenum type, const GLvoid *in
         }
     }
 
-    GLuint maxindex = 0;
-    GLsizei i;
-    if (type == GL_UNSIGNED_BYTE) {
-        const GLubyte *p = (const GLubyte *)indices;
-        for (i = 0; i < count; ++i) {
-            if (p[i] > maxindex) {
-                maxindex = p[i];
-            }
-        }
-    } else if (type == GL_UNSIGNED_SHORT) {
-        const GLushort *p = (const GLushort *)indices;
-        for (i = 0; i < count; ++i) {
-            if (p[i] > maxindex) {
-                maxindex = p[i];
-            }
-        }
-    } else if (type == GL_UNSIGNED_INT) {
-        const GLuint *p = (const GLuint *)indices;
-        for (i = 0; i < count; ++i) {
-            if (p[i] > maxindex) {
-                maxindex = p[i];
-            }
-        }
-    } else {
-        OS::DebugMessage("warning: %s: unknown GLenum 0x%04X\n", __FUNCTION__, type);
-    }
+    GLuint minindex;
+    GLuint maxindex;
+    __gl_index_range(count, type, indices, false, 0, &minindex, &maxindex);
 
-    if (__element_array_buffer) {
-        free(temp);
-    }
+    free(temp);
 
     maxindex += basevertex;
 
@@ -177,34 +153,149 @@ __glDrawElementsBaseVertex_maxindex(GLsizei count, GLenum type, const GLvoid *in
 #define __glDrawArraysInstancedEXT_maxindex __glDrawArraysInstanced_maxindex
 #define __glDrawElementsInstancedEXT_maxindex __glDrawElementsInstanced_maxindex
 
+/**
+ * Parameter to query the buffer bound to target with, or GL_NONE for targets
+ * that have none.  Shared by the tracers and the retracer.
+ */
+static inline GLenum
+__gl_buffer_binding_pname(GLenum target)
+{
+    switch (target) {
+    case GL_ARRAY_BUFFER:
+        return GL_ARRAY_BUFFER_BINDING;
+    case GL_ELEMENT_ARRAY_BUFFER:
+        return GL_ELEMENT_ARRAY_BUFFER_BINDING;
+    case GL_PIXEL_PACK_BUFFER:
+        return GL_PIXEL_PACK_BUFFER_BINDING;
+    case GL_PIXEL_UNPACK_BUFFER:
+        return GL_PIXEL_UNPACK_BUFFER_BINDING;
+    case GL_UNIFORM_BUFFER:
+        return GL_UNIFORM_BUFFER_BINDING;
+    case GL_TRANSFORM_FEEDBACK_BUFFER:
+        return GL_TRANSFORM_FEEDBACK_BUFFER_BINDING;
+    case GL_DRAW_INDIRECT_BUFFER:
+        return GL_DRAW_INDIRECT_BUFFER_BINDING;
+    case GL_COPY_READ_BUFFER:
+    case GL_COPY_WRITE_BUFFER:
+    case GL_TEXTURE_BUFFER:
+        /* These are queried by the target itself */
+        return target;
+    default:
+        return GL_NONE;
+    }
+}
+
+/**
+ * Read the command of an indirect draw, from the draw indirect buffer if one
+ * is bound.
+ */
+static inline bool
+__gl_indirect_command(const GLvoid *indirect, GLuint *command, size_t size)
+{
+    GLint __draw_indirect_buffer = 0;
+    __glGetIntegerv(GL_DRAW_INDIRECT_BUFFER_BINDING, &__draw_indirect_buffer);
+    if (__draw_indirect_buffer) {
+        memset(command, 0, size);
+        __glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, (GLintptr)indirect, size, command);
+    } else {
+        if (!indirect) {
+            return false;
+        }
+        memcpy(command, indirect, size);
+    }
+    return true;
+}
+
+/**
+ * Read the command of an indirect arrays draw.  The helpers below are the
+ * only ones that know the layout of indirect commands.
+ */
+static inline bool
+__gl_draw_arrays_indirect_command(const GLvoid *indirect, GLint *first, GLsizei *count)
+{
+    // count, primCount, first, reservedMustBeZero
+    GLuint command[4];
+    if (!__gl_indirect_command(indirect, command, sizeof command)) {
+        return false;
+    }
+    *count = command[0];
+    *first = command[2];
+    return true;
+}
+
+/**
+ * Read the command of an indirect elements draw, with its first index turned
+ * into an offset in the element array buffer.  Indirect indices always come
+ * from a buffer, never client memory, so callers must check one is bound.
+ */
+static inline bool
+__gl_draw_elements_indirect_command(GLenum type, const GLvoid *indirect, GLsizei *count, const GLvoid **indices, GLint *basevertex)
+{
+    // count, primCount, firstIndex, baseVertex, reservedMustBeZero
+    GLuint command[5];
+    if (!__gl_indirect_command(indirect, command, sizeof command)) {
+        return false;
+    }
+    *count = command[0];
+    *indices = (const GLvoid *)(command[2] * __gl_type_size(type));
+    *basevertex = command[3];
+    return true;
+}
+
 static inline GLuint
 __glDrawArraysIndirect_maxindex(const GLvoid *indirect) {
-    OS::DebugMessage("warning: %s: unsupported\n", __FUNCTION__);
-    return 0;
+    GLint first;
+    GLsizei count;
+    if (!__gl_draw_arrays_indirect_command(indirect, &first, &count)) {
+        return 0;
+    }
+    return __glDrawArrays_maxindex(first, count);
 }
 
 static inline GLuint
 __glDrawElementsIndirect_maxindex(GLenum type, const GLvoid *indirect) {
-    OS::DebugMessage("warning: %s: unsupported\n", __FUNCTION__);
-    return 0;
+    GLint __element_array_buffer = 0;
+    __glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &__element_array_buffer);
+    if (!__element_array_buffer) {
+        return 0;
+    }
+
+    GLsizei count;
+    const GLvoid *indices;
+    GLint basevertex;
+    if (!__gl_draw_elements_indirect_command(type, indirect, &count, &indices, &basevertex)) {
+        return 0;
+    }
+    return __glDrawElementsBaseVertex_maxindex(count, type, indices, basevertex);
 }
 
 static inline GLuint
 __glMultiDrawArrays_maxindex(const GLint *first, const GLsizei *count, GLsizei primcount) {
-    OS::DebugMessage("warning: %s: unsupported\n", __FUNCTION__);
-    return 0;
+    GLuint maxindex = 0;
+    for (GLsizei prim = 0; prim < primcount; ++prim) {
+        GLuint primmaxindex = __glDrawArrays_maxindex(first[prim], count[prim]);
+        if (primmaxindex > maxindex) {
+            maxindex = primmaxindex;
+        }
+    }
+    return maxindex;
 }
 
 static inline GLuint
-__glMultiDrawElements_maxindex(const GLsizei *count, GLenum type, const GLvoid* *indices, GLsizei primcount) {
-    OS::DebugMessage("warning: %s: unsupported\n", __FUNCTION__);
-    return 0;
+__glMultiDrawElementsBaseVertex_maxindex(const GLsizei *count, GLenum type, const GLvoid* *indices, GLsizei primcount, const GLint * basevertex) {
+    GLuint maxindex = 0;
+    for (GLsizei prim = 0; prim < primcount; ++prim) {
+        GLuint primmaxindex = __glDrawElementsBaseVertex_maxindex(count[prim], type, indices[prim], basevertex ? basevertex[prim] : 0);
+        if (primmaxindex > maxindex) {
+            maxindex = primmaxindex;
+        }
+    }
+    return maxindex;
 }
 
 static inline GLuint
-__glMultiDrawElementsBaseVertex_maxindex(const GLsizei *count, GLenum type, const GLvoid* *indices, GLsizei primcount, const GLint * basevertex) {
-    OS::DebugMessage("warning: %s: unsupported\n", __FUNCTION__);
-    return 0;
+__glMultiDrawElements_maxindex(const GLsizei *count, GLenum type, const GLvoid* *indices, GLsizei primcount) {
+    return __glMultiDrawElementsBaseVertex_maxindex(count, type, indices, primcount, NULL);
 }
 
 #define __glMultiDrawArraysEXT_maxindex __glMultiDrawArrays_maxindex
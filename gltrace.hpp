@@ -0,0 +1,1214 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Auxiliary functions for the GL tracers.
+ */
+
+#ifndef _GLTRACE_HPP_
+#define _GLTRACE_HPP_
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <set>
+
+#include "os.hpp"
+#include "glimports.hpp"
+
+
+/*
+ * Mapped buffers are compared against a copy of their contents taken when
+ * they were mapped, so that only what the application changed needs to be
+ * recorded.  The comparison is done in aligned blocks, which keeps it fast,
+ * and avoids splitting changes into lots of tiny records.
+ *
+ * Only mappings the application may read from are compared.  Reading from
+ * write-only mappings is undefined, and they are often write-combined memory,
+ * which is very slow to read, so those are recorded whole as they are unmapped
+ * or flushed.
+ */
+
+#define __GL_SHADOW_BLOCK_SIZE 64
+
+
+/*
+ * Buffer objects are shared between contexts, and so between threads, so what
+ * is known about their contents is guarded by this.
+ */
+static OS::Mutex *__gl_buffer_mutex = OS::NewMutex();
+
+
+static inline char *
+__gl_shadow_create(const void *map, size_t length)
+{
+    char *shadow = (char *)malloc(length);
+    if (shadow) {
+        memcpy(shadow, map, length);
+    }
+    return shadow;
+}
+
+static inline size_t
+__gl_shadow_block_end(size_t pos, size_t end)
+{
+    size_t block_end = (pos / __GL_SHADOW_BLOCK_SIZE + 1) * __GL_SHADOW_BLOCK_SIZE;
+    return block_end < end ? block_end : end;
+}
+
+/**
+ * Find the next range at or after *start, and before end, where the mapped
+ * data differs from the shadow copy, and bring the shadow copy up to date.
+ * Returns false when everything is clean.
+ */
+static inline bool
+__gl_shadow_next_dirty(const char *map, char *shadow, size_t end, size_t *start, size_t *length)
+{
+    size_t pos = *start;
+
+    while (pos < end) {
+        size_t next = __gl_shadow_block_end(pos, end);
+        if (memcmp(map + pos, shadow + pos, next - pos) != 0) {
+            break;
+        }
+        pos = next;
+    }
+    if (pos >= end) {
+        return false;
+    }
+
+    size_t first = pos;
+    do {
+        pos = __gl_shadow_block_end(pos, end);
+    } while (pos < end &&
+             memcmp(map + pos, shadow + pos, __gl_shadow_block_end(pos, end) - pos) != 0);
+
+    memcpy(shadow + first, map + first, pos - first);
+
+    *start = first;
+    *length = pos - first;
+    return true;
+}
+
+
+/*
+ * Shadow of the client array state of the current context, kept up to date
+ * from the calls the tracer intercepts, so that draw calls don't have to
+ * query it.  Whatever is unknown, e.g., after switching contexts, is queried
+ * once and remembered.
+ *
+ * Client state belongs to the context current in each thread, so the shadow
+ * is per thread, and forgotten whenever the thread changes contexts.
+ */
+
+#define __GL_MAX_SHADOW_ARRAYS 32
+
+/*
+ * What the last fake call for a user array recorded, so that draw calls
+ * which use the same vertices of an unchanged array don't record them again.
+ */
+struct __gl_array_record {
+    bool valid;
+
+    GLint size;
+    GLint type;
+    GLint normalized;
+    GLint stride;
+    const GLvoid *pointer;
+
+    /* Copy of the recorded bytes, relative to the pointer */
+    size_t offset;
+    size_t length;
+    char *data;
+    size_t capacity;
+};
+
+struct __gl_array {
+    /* Whether the array is enabled, or -1 when unknown */
+    signed char enabled;
+
+    /* Whether the array is in user memory rather than a buffer, or -1 when
+     * unknown */
+    signed char user;
+
+    /* Whether the pointer parameters below are known */
+    bool known;
+
+    GLint size;
+    GLint type;
+    GLint normalized;
+    GLint stride;
+    GLvoid *pointer;
+
+    __gl_array_record record;
+};
+
+struct __gl_client_state {
+    /* Current GL_ARRAY_BUFFER binding, or -1 when unknown */
+    GLint array_buffer;
+
+    /* Current GL_ELEMENT_ARRAY_BUFFER binding, or -1 when unknown */
+    GLint element_array_buffer;
+
+    /* Whether GL_PRIMITIVE_RESTART is enabled, and its index, or -1 when
+     * unknown */
+    signed char primitive_restart;
+    signed char primitive_restart_index_known;
+    GLuint primitive_restart_index;
+
+    /* Zero when unknown */
+    GLint client_active_texture;
+    GLint max_texture_coords;
+    GLint max_vertex_attribs;
+
+    /* Fixed function arrays, in the order of GlTracer.arrays */
+    __gl_array arrays[8];
+
+    __gl_array texcoords[__GL_MAX_SHADOW_ARRAYS];
+    __gl_array attribs[__GL_MAX_SHADOW_ARRAYS];
+};
+
+static THREAD_LOCAL __gl_client_state *__gl_client = NULL;
+
+static inline void
+__gl_forget_arrays(__gl_array *arrays, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        arrays[i].enabled = -1;
+        arrays[i].user = -1;
+        arrays[i].known = false;
+        arrays[i].record.valid = false;
+    }
+}
+
+/**
+ * Forget everything about the client state, to be queried again as needed.
+ */
+static inline void
+__gl_forget_client_state(void)
+{
+    __gl_client_state *state = __gl_client;
+    if (state) {
+        state->array_buffer = -1;
+        state->element_array_buffer = -1;
+        state->primitive_restart = -1;
+        state->primitive_restart_index_known = 0;
+        state->client_active_texture = 0;
+        state->max_texture_coords = 0;
+        state->max_vertex_attribs = 0;
+        __gl_forget_arrays(state->arrays, sizeof state->arrays / sizeof state->arrays[0]);
+        __gl_forget_arrays(state->texcoords, __GL_MAX_SHADOW_ARRAYS);
+        __gl_forget_arrays(state->attribs, __GL_MAX_SHADOW_ARRAYS);
+    }
+}
+
+static inline __gl_client_state *
+__gl_get_client_state(void)
+{
+    if (!__gl_client) {
+        __gl_client = new __gl_client_state();
+        __gl_forget_client_state();
+    }
+    return __gl_client;
+}
+
+static inline GLint
+__gl_array_buffer_binding(__gl_client_state *state)
+{
+    if (state->array_buffer < 0) {
+        GLint binding = 0;
+        __glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &binding);
+        state->array_buffer = binding;
+    }
+    return state->array_buffer;
+}
+
+static inline GLint
+__gl_element_array_buffer_binding(__gl_client_state *state)
+{
+    if (state->element_array_buffer < 0) {
+        GLint binding = 0;
+        __glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &binding);
+        state->element_array_buffer = binding;
+    }
+    return state->element_array_buffer;
+}
+
+/*
+ * Primitive restart is only queried if the application was ever seen using
+ * it, as older contexts don't know about it.
+ */
+static bool __gl_primitive_restart_used = false;
+
+static inline bool
+__gl_primitive_restart(__gl_client_state *state, GLuint *index)
+{
+    if (!__gl_primitive_restart_used) {
+        return false;
+    }
+    if (state->primitive_restart < 0) {
+        state->primitive_restart = __glIsEnabled(GL_PRIMITIVE_RESTART) ? 1 : 0;
+    }
+    if (!state->primitive_restart) {
+        return false;
+    }
+    if (!state->primitive_restart_index_known) {
+        GLint restart_index = 0;
+        __glGetIntegerv(GL_PRIMITIVE_RESTART_INDEX, &restart_index);
+        state->primitive_restart_index = restart_index;
+        state->primitive_restart_index_known = 1;
+    }
+    *index = state->primitive_restart_index;
+    return true;
+}
+
+static inline GLint
+__gl_client_active_texture(__gl_client_state *state)
+{
+    if (!state->client_active_texture) {
+        GLint texture = GL_TEXTURE0;
+        __glGetIntegerv(GL_CLIENT_ACTIVE_TEXTURE, &texture);
+        state->client_active_texture = texture;
+    }
+    return state->client_active_texture;
+}
+
+/*
+ * Arrays beyond what the shadow holds are ignored.
+ */
+
+static inline GLint
+__gl_max_texture_coords(__gl_client_state *state)
+{
+    if (!state->max_texture_coords) {
+        GLint max_texture_coords = 0;
+        __glGetIntegerv(GL_MAX_TEXTURE_COORDS, &max_texture_coords);
+        if (max_texture_coords > __GL_MAX_SHADOW_ARRAYS) {
+            max_texture_coords = __GL_MAX_SHADOW_ARRAYS;
+        }
+        state->max_texture_coords = max_texture_coords;
+    }
+    return state->max_texture_coords;
+}
+
+static inline GLint
+__gl_max_vertex_attribs(__gl_client_state *state)
+{
+    if (!state->max_vertex_attribs) {
+        GLint max_vertex_attribs = 0;
+        __glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_vertex_attribs);
+        if (max_vertex_attribs > __GL_MAX_SHADOW_ARRAYS) {
+            max_vertex_attribs = __GL_MAX_SHADOW_ARRAYS;
+        }
+        state->max_vertex_attribs = max_vertex_attribs;
+    }
+    return state->max_vertex_attribs;
+}
+
+static inline __gl_array *
+__gl_texcoord_array(__gl_client_state *state)
+{
+    GLint unit = __gl_client_active_texture(state) - GL_TEXTURE0;
+    if (unit < 0 || unit >= __GL_MAX_SHADOW_ARRAYS) {
+        return NULL;
+    }
+    return &state->texcoords[unit];
+}
+
+static inline __gl_array *
+__gl_attrib_array(__gl_client_state *state, GLuint index)
+{
+    if (index >= __GL_MAX_SHADOW_ARRAYS) {
+        return NULL;
+    }
+    return &state->attribs[index];
+}
+
+/**
+ * Whether a fixed function array, or the texture coordinate array of the
+ * client active texture, is enabled and in user memory.
+ */
+static inline bool
+__gl_array_in_user_memory(__gl_array *array, GLenum enable, GLenum binding)
+{
+    if (array->enabled < 0) {
+        array->enabled = __glIsEnabled(enable) ? 1 : 0;
+    }
+    if (!array->enabled) {
+        return false;
+    }
+    if (array->user < 0) {
+        GLint buffer = 0;
+        __glGetIntegerv(binding, &buffer);
+        array->user = buffer ? 0 : 1;
+    }
+    return array->user;
+}
+
+static inline bool
+__gl_texcoord_array_in_user_memory(__gl_client_state *state, GLint unit)
+{
+    __gl_array *array = &state->texcoords[unit];
+    if (array->enabled == 0) {
+        return false;
+    }
+    if (array->enabled < 0 || array->user < 0) {
+        GLint client_active_texture = __gl_client_active_texture(state);
+        if (client_active_texture != GL_TEXTURE0 + unit) {
+            __glClientActiveTexture(GL_TEXTURE0 + unit);
+        }
+        __gl_array_in_user_memory(array, GL_TEXTURE_COORD_ARRAY, GL_TEXTURE_COORD_ARRAY_BUFFER_BINDING);
+        if (client_active_texture != GL_TEXTURE0 + unit) {
+            __glClientActiveTexture(client_active_texture);
+        }
+    }
+    return array->enabled && array->user;
+}
+
+static inline bool
+__gl_attrib_array_in_user_memory(__gl_client_state *state, GLint index)
+{
+    __gl_array *array = &state->attribs[index];
+    if (array->enabled < 0) {
+        GLint enabled = 0;
+        __glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &enabled);
+        array->enabled = enabled ? 1 : 0;
+    }
+    if (!array->enabled) {
+        return false;
+    }
+    if (array->user < 0) {
+        GLint buffer = 0;
+        __glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &buffer);
+        array->user = buffer ? 0 : 1;
+    }
+    return array->user;
+}
+
+/**
+ * Whether the bytes from offset to offset + length of the array are already
+ * what the last fake call for it recorded, so that there is no need to
+ * record them again.
+ */
+static inline bool
+__gl_array_recorded(const __gl_array *array, size_t offset, size_t length)
+{
+    const __gl_array_record *record = &array->record;
+    return record->valid &&
+           record->size == array->size &&
+           record->type == array->type &&
+           record->normalized == array->normalized &&
+           record->stride == array->stride &&
+           record->pointer == array->pointer &&
+           offset >= record->offset &&
+           offset + length <= record->offset + record->length &&
+           memcmp((const char *)array->pointer + offset,
+                  record->data + (offset - record->offset), length) == 0;
+}
+
+/**
+ * Remember what a fake call for the array is about to record.
+ */
+static inline void
+__gl_array_record_data(__gl_array *array, size_t offset, size_t length)
+{
+    __gl_array_record *record = &array->record;
+    record->valid = false;
+    if (length > record->capacity) {
+        free(record->data);
+        record->data = (char *)malloc(length);
+        record->capacity = record->data ? length : 0;
+        if (!record->data) {
+            return;
+        }
+    }
+    memcpy(record->data, (const char *)array->pointer + offset, length);
+    record->valid = true;
+    record->size = array->size;
+    record->type = array->type;
+    record->normalized = array->normalized;
+    record->stride = array->stride;
+    record->pointer = array->pointer;
+    record->offset = offset;
+    record->length = length;
+}
+
+/**
+ * Make the user arrays be recorded again on the next draw, e.g., at the start
+ * of each frame, so that frames don't depend on arrays recorded in earlier
+ * ones.
+ */
+static inline void
+__gl_forget_array_records(void)
+{
+    __gl_client_state *state = __gl_client;
+    if (state) {
+        for (size_t i = 0; i < sizeof state->arrays / sizeof state->arrays[0]; ++i) {
+            state->arrays[i].record.valid = false;
+        }
+        for (size_t i = 0; i < __GL_MAX_SHADOW_ARRAYS; ++i) {
+            state->texcoords[i].record.valid = false;
+            state->attribs[i].record.valid = false;
+        }
+    }
+}
+
+
+/*
+ * CPU copies of the index buffers, fed by the uploads the tracer intercepts,
+ * so that the range of indices of a draw call can be found without reading
+ * anything back from the GPU.  Only buffers filled while bound to
+ * GL_ELEMENT_ARRAY_BUFFER, or used by an indexed draw call, are shadowed; the
+ * latter are read back once, by the first draw call using them.  The index
+ * ranges found are cached until the buffer is written to.
+ *
+ * Buffers written in ways that can't be followed, e.g. by the GPU, or given
+ * undefined contents by glBufferData(NULL), lose their shadow until the next
+ * draw call reads them back.  Draw calls fall back to reading their indices
+ * back alone when the whole buffer can't be.
+ *
+ * Shadows are kept per context, keyed by the handle the window system
+ * passed to the make current call.  Buffers can be shared between contexts,
+ * so a write through any context drops the shadows other contexts hold of
+ * the buffer with that name.  Share groups aren't tracked, so this may
+ * needlessly drop the shadow of an unrelated buffer of the same name.  All
+ * shadows are guarded by __gl_buffer_mutex.
+ */
+
+struct __gl_index_key {
+    GLintptr offset;
+    GLsizei count;
+    GLenum type;
+    bool restart;
+    GLuint restart_index;
+
+    bool operator < (const __gl_index_key &other) const {
+        if (offset != other.offset) {
+            return offset < other.offset;
+        }
+        if (count != other.count) {
+            return count < other.count;
+        }
+        if (type != other.type) {
+            return type < other.type;
+        }
+        if (restart != other.restart) {
+            return restart < other.restart;
+        }
+        return restart_index < other.restart_index;
+    }
+};
+
+struct __gl_index_bounds {
+    GLuint min;
+    GLuint max;
+};
+
+struct __gl_element_buffer {
+    char *data;
+    GLsizeiptr size;
+
+    std::map<__gl_index_key, __gl_index_bounds> ranges;
+
+    __gl_element_buffer() : data(NULL), size(0) {}
+    ~__gl_element_buffer() { free(data); }
+};
+
+typedef std::map<GLuint, __gl_element_buffer *> __gl_element_buffer_map;
+
+/* The shadows of every context, and how many buffers they hold in total */
+static std::map<const void *, __gl_element_buffer_map *> __gl_context_element_buffers;
+static size_t __gl_element_buffer_count = 0;
+
+/* Context current in the calling thread */
+static THREAD_LOCAL const void *__gl_current_context = NULL;
+
+/*
+ * The helpers below expect __gl_buffer_mutex to be held.
+ */
+
+/**
+ * Shadows of the context current in the calling thread, or NULL if it has
+ * none and create is false.
+ */
+static inline __gl_element_buffer_map *
+__gl_get_element_buffers(bool create)
+{
+    std::map<const void *, __gl_element_buffer_map *>::iterator it;
+    it = __gl_context_element_buffers.find(__gl_current_context);
+    if (it != __gl_context_element_buffers.end()) {
+        return it->second;
+    }
+    if (!create) {
+        return NULL;
+    }
+    __gl_element_buffer_map *buffers = new __gl_element_buffer_map;
+    __gl_context_element_buffers[__gl_current_context] = buffers;
+    return buffers;
+}
+
+static inline void
+__gl_add_element_buffer(GLuint buffer, __gl_element_buffer *shadow)
+{
+    __gl_element_buffer *&entry = (*__gl_get_element_buffers(true))[buffer];
+    if (entry) {
+        delete entry;
+    } else {
+        ++__gl_element_buffer_count;
+    }
+    entry = shadow;
+}
+
+static inline void
+__gl_drop_element_buffer(__gl_element_buffer_map *buffers, GLuint buffer)
+{
+    if (!buffers) {
+        return;
+    }
+    __gl_element_buffer_map::iterator it = buffers->find(buffer);
+    if (it != buffers->end()) {
+        delete it->second;
+        buffers->erase(it);
+        --__gl_element_buffer_count;
+    }
+}
+
+static inline void
+__gl_drop_element_buffers(__gl_element_buffer_map *buffers)
+{
+    for (__gl_element_buffer_map::iterator it = buffers->begin(); it != buffers->end(); ++it) {
+        delete it->second;
+    }
+    __gl_element_buffer_count -= buffers->size();
+    buffers->clear();
+}
+
+/**
+ * Drop the shadows of buffer held by the other contexts, or by all of them.
+ */
+static inline void
+__gl_drop_shared_element_buffer(GLuint buffer, bool others)
+{
+    if (!__gl_element_buffer_count) {
+        return;
+    }
+    std::map<const void *, __gl_element_buffer_map *>::iterator it;
+    for (it = __gl_context_element_buffers.begin(); it != __gl_context_element_buffers.end(); ++it) {
+        if (!others || it->first != __gl_current_context) {
+            __gl_drop_element_buffer(it->second, buffer);
+        }
+    }
+}
+
+static inline void
+__gl_drop_all_element_buffers(void)
+{
+    std::map<const void *, __gl_element_buffer_map *>::iterator it;
+    for (it = __gl_context_element_buffers.begin(); it != __gl_context_element_buffers.end(); ++it) {
+        __gl_drop_element_buffers(it->second);
+    }
+}
+
+static inline __gl_element_buffer *
+__gl_find_element_buffer(GLuint buffer)
+{
+    __gl_element_buffer_map *buffers = __gl_get_element_buffers(false);
+    if (buffers) {
+        __gl_element_buffer_map::iterator it = buffers->find(buffer);
+        if (it != buffers->end()) {
+            return it->second;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Drop every context's shadow of buffer, after it got written in ways that
+ * can't be followed.
+ */
+static inline void
+__gl_forget_element_buffer(GLuint buffer)
+{
+    OS::LockMutex(__gl_buffer_mutex);
+    __gl_drop_shared_element_buffer(buffer, false);
+    OS::UnlockMutex(__gl_buffer_mutex);
+}
+
+/**
+ * Switch to the shadows of the context being made current in the calling
+ * thread, or none when it is released.
+ */
+static inline void
+__gl_make_current_element_buffers(const void *context)
+{
+    __gl_current_context = context;
+}
+
+/**
+ * Drop the shadows of a context being destroyed.
+ */
+static inline void
+__gl_destroy_element_buffers(const void *context)
+{
+    OS::LockMutex(__gl_buffer_mutex);
+    std::map<const void *, __gl_element_buffer_map *>::iterator it;
+    it = __gl_context_element_buffers.find(context);
+    if (it != __gl_context_element_buffers.end()) {
+        __gl_drop_element_buffers(it->second);
+        delete it->second;
+        __gl_context_element_buffers.erase(it);
+    }
+    OS::UnlockMutex(__gl_buffer_mutex);
+}
+
+/**
+ * Find which buffer is bound to target, returning false for targets whose
+ * binding can't be queried.
+ */
+static inline bool
+__gl_buffer_binding(GLenum target, GLuint *buffer)
+{
+    /* The client state shadows the most common ones */
+    switch (target) {
+    case GL_ARRAY_BUFFER:
+        *buffer = __gl_array_buffer_binding(__gl_get_client_state());
+        return true;
+    case GL_ELEMENT_ARRAY_BUFFER:
+        *buffer = __gl_element_array_buffer_binding(__gl_get_client_state());
+        return true;
+    }
+
+    GLenum pname = __gl_buffer_binding_pname(target);
+    if (pname == GL_NONE) {
+        return false;
+    }
+    GLint binding = 0;
+    __glGetIntegerv(pname, &binding);
+    *buffer = binding;
+    return true;
+}
+
+/*
+ * Buffers whose contents were left undefined by glBufferData(NULL).  These
+ * can't be compared against, as they may well hold something else when
+ * retracing.
+ */
+static std::set<GLuint> __gl_orphaned_buffers;
+
+static inline void
+__gl_set_buffer_orphaned(GLuint buffer, bool orphaned)
+{
+    if (!buffer) {
+        return;
+    }
+    OS::LockMutex(__gl_buffer_mutex);
+    if (orphaned) {
+        __gl_orphaned_buffers.insert(buffer);
+    } else {
+        __gl_orphaned_buffers.erase(buffer);
+    }
+    OS::UnlockMutex(__gl_buffer_mutex);
+}
+
+static inline bool
+__gl_any_buffer_orphaned(void)
+{
+    OS::LockMutex(__gl_buffer_mutex);
+    bool any = !__gl_orphaned_buffers.empty();
+    OS::UnlockMutex(__gl_buffer_mutex);
+    return any;
+}
+
+/**
+ * Follow glBufferData, which gives the buffer bound to target defined
+ * contents, unless data is NULL.
+ */
+static inline void
+__gl_buffer_data_orphaned(GLenum target, const GLvoid *data)
+{
+    if (data && !__gl_any_buffer_orphaned()) {
+        return;
+    }
+    GLuint buffer;
+    if (__gl_buffer_binding(target, &buffer)) {
+        __gl_set_buffer_orphaned(buffer, !data);
+    }
+}
+
+/**
+ * Whether the buffer bound to target was orphaned since it was last mapped,
+ * clearing that.  Buffers bound where the binding can't be found are assumed
+ * to be.
+ */
+static inline bool
+__gl_take_buffer_orphaned(GLenum target)
+{
+    if (!__gl_any_buffer_orphaned()) {
+        return false;
+    }
+    GLuint buffer;
+    if (!__gl_buffer_binding(target, &buffer)) {
+        return true;
+    }
+    OS::LockMutex(__gl_buffer_mutex);
+    bool orphaned = __gl_orphaned_buffers.erase(buffer) != 0;
+    OS::UnlockMutex(__gl_buffer_mutex);
+    return orphaned;
+}
+
+/**
+ * Find the shadow the current context holds of buffer, and drop the ones
+ * held by other contexts, as it is about to change.  Expects
+ * __gl_buffer_mutex to be held.
+ */
+static inline __gl_element_buffer *
+__gl_written_element_buffer(GLuint buffer)
+{
+    if (!buffer) {
+        return NULL;
+    }
+    __gl_drop_shared_element_buffer(buffer, true);
+    return __gl_find_element_buffer(buffer);
+}
+
+/**
+ * Like __gl_written_element_buffer(), for the buffer bound to target.  When
+ * the binding is unknown all shadows are dropped, as any of them could be
+ * written.  Expects __gl_buffer_mutex to be held.
+ */
+static inline bool
+__gl_bound_element_buffer(GLenum target, GLuint *buffer, __gl_element_buffer **shadow)
+{
+    *buffer = 0;
+    *shadow = NULL;
+    if (!__gl_buffer_binding(target, buffer)) {
+        __gl_drop_all_element_buffers();
+        return false;
+    }
+    *shadow = __gl_written_element_buffer(*buffer);
+    return *buffer != 0;
+}
+
+static inline void
+__gl_invalidate_index_ranges(__gl_element_buffer *shadow, GLintptr offset, GLsizeiptr size)
+{
+    std::map<__gl_index_key, __gl_index_bounds>::iterator it = shadow->ranges.begin();
+    while (it != shadow->ranges.end()) {
+        const __gl_index_key &key = it->first;
+        GLsizeiptr length = key.count * __gl_type_size(key.type);
+        if (key.offset < offset + size && offset < key.offset + length) {
+            shadow->ranges.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * Replace the contents of buffer, as glBufferData does, shadowing it if it
+ * had no shadow and create is true.  Expects __gl_buffer_mutex to be held.
+ */
+static inline void
+__gl_store_element_buffer(GLuint buffer, __gl_element_buffer *shadow, GLsizeiptr size, const GLvoid *data, bool create)
+{
+    if (!shadow && !create) {
+        return;
+    }
+
+    /* Undefined contents are read back by the next draw call instead */
+    if (!data || size <= 0) {
+        __gl_drop_element_buffer(__gl_get_element_buffers(false), buffer);
+        return;
+    }
+
+    if (!shadow) {
+        shadow = new __gl_element_buffer;
+        __gl_add_element_buffer(buffer, shadow);
+    }
+
+    shadow->ranges.clear();
+    free(shadow->data);
+    shadow->data = (char *)malloc(size);
+    if (!shadow->data) {
+        __gl_drop_element_buffer(__gl_get_element_buffers(false), buffer);
+        return;
+    }
+    shadow->size = size;
+    memcpy(shadow->data, data, size);
+}
+
+/**
+ * Write part of buffer, as glBufferSubData does.  Expects __gl_buffer_mutex
+ * to be held.
+ */
+static inline void
+__gl_update_element_buffer(GLuint buffer, __gl_element_buffer *shadow, GLintptr offset, GLsizeiptr size, const GLvoid *data)
+{
+    if (!shadow) {
+        return;
+    }
+    if (offset < 0 || size < 0 || offset + size > shadow->size || !data) {
+        __gl_drop_element_buffer(__gl_get_element_buffers(false), buffer);
+        return;
+    }
+    memcpy(shadow->data + offset, data, size);
+    __gl_invalidate_index_ranges(shadow, offset, size);
+}
+
+/**
+ * Copy between buffers, as glCopyBufferSubData does.  The destination loses
+ * its shadow if the source has none.  Expects __gl_buffer_mutex to be held.
+ */
+static inline void
+__gl_copy_element_buffer(GLuint readBuffer, GLuint writeBuffer, __gl_element_buffer *shadow, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size)
+{
+    if (!shadow) {
+        return;
+    }
+    __gl_element_buffer *source = __gl_find_element_buffer(readBuffer);
+    if (!source || readOffset < 0 || size < 0 || readOffset + size > source->size) {
+        __gl_drop_element_buffer(__gl_get_element_buffers(false), writeBuffer);
+        return;
+    }
+    /* Source and destination may be the same buffer */
+    memmove(shadow->data + writeOffset, source->data + readOffset, size);
+    __gl_invalidate_index_ranges(shadow, writeOffset, size);
+}
+
+static inline void
+__gl_shadow_buffer_data(GLenum target, GLsizeiptr size, const GLvoid *data)
+{
+    bool create = target == GL_ELEMENT_ARRAY_BUFFER;
+    OS::LockMutex(__gl_buffer_mutex);
+    GLuint buffer;
+    __gl_element_buffer *shadow;
+    if ((create || __gl_element_buffer_count) &&
+        __gl_bound_element_buffer(target, &buffer, &shadow)) {
+        __gl_store_element_buffer(buffer, shadow, size, data, create);
+    }
+    OS::UnlockMutex(__gl_buffer_mutex);
+}
+
+static inline void
+__gl_shadow_named_buffer_data(GLuint buffer, GLsizeiptr size, const GLvoid *data)
+{
+    OS::LockMutex(__gl_buffer_mutex);
+    if (__gl_element_buffer_count && buffer) {
+        __gl_store_element_buffer(buffer, __gl_written_element_buffer(buffer), size, data, false);
+    }
+    OS::UnlockMutex(__gl_buffer_mutex);
+}
+
+static inline void
+__gl_shadow_buffer_sub_data(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data)
+{
+    OS::LockMutex(__gl_buffer_mutex);
+    GLuint buffer;
+    __gl_element_buffer *shadow;
+    if (__gl_element_buffer_count &&
+        __gl_bound_element_buffer(target, &buffer, &shadow)) {
+        __gl_update_element_buffer(buffer, shadow, offset, size, data);
+    }
+    OS::UnlockMutex(__gl_buffer_mutex);
+}
+
+static inline void
+__gl_shadow_named_buffer_sub_data(GLuint buffer, GLintptr offset, GLsizeiptr size, const GLvoid *data)
+{
+    OS::LockMutex(__gl_buffer_mutex);
+    if (__gl_element_buffer_count) {
+        __gl_update_element_buffer(buffer, __gl_written_element_buffer(buffer), offset, size, data);
+    }
+    OS::UnlockMutex(__gl_buffer_mutex);
+}
+
+static inline void
+__gl_shadow_copy_buffer_sub_data(GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size)
+{
+    OS::LockMutex(__gl_buffer_mutex);
+    GLuint readBuffer, writeBuffer;
+    __gl_element_buffer *shadow;
+    if (__gl_element_buffer_count &&
+        __gl_bound_element_buffer(writeTarget, &writeBuffer, &shadow)) {
+        if (!__gl_buffer_binding(readTarget, &readBuffer)) {
+            readBuffer = 0;
+        }
+        __gl_copy_element_buffer(readBuffer, writeBuffer, shadow, readOffset, writeOffset, size);
+    }
+    OS::UnlockMutex(__gl_buffer_mutex);
+}
+
+static inline void
+__gl_shadow_named_copy_buffer_sub_data(GLuint readBuffer, GLuint writeBuffer, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size)
+{
+    OS::LockMutex(__gl_buffer_mutex);
+    if (__gl_element_buffer_count) {
+        __gl_copy_element_buffer(readBuffer, writeBuffer, __gl_written_element_buffer(writeBuffer), readOffset, writeOffset, size);
+    }
+    OS::UnlockMutex(__gl_buffer_mutex);
+}
+
+/**
+ * Drop the shadows of the buffer bound to target, for writes that can't be
+ * followed, such as the ones done by the GPU.
+ */
+static inline void
+__gl_shadow_buffer_invalidate(GLenum target)
+{
+    OS::LockMutex(__gl_buffer_mutex);
+    GLuint buffer;
+    __gl_element_buffer *shadow;
+    if (__gl_element_buffer_count &&
+        __gl_bound_element_buffer(target, &buffer, &shadow) && shadow) {
+        __gl_drop_element_buffer(__gl_get_element_buffers(false), buffer);
+    }
+    OS::UnlockMutex(__gl_buffer_mutex);
+}
+
+static inline void
+__gl_shadow_delete_buffers(GLsizei n, const GLuint *buffers)
+{
+    if (!buffers) {
+        return;
+    }
+
+    OS::LockMutex(__gl_buffer_mutex);
+    for (GLsizei i = 0; i < n; ++i) {
+        __gl_drop_shared_element_buffer(buffers[i], false);
+    }
+    OS::UnlockMutex(__gl_buffer_mutex);
+
+    /* The names may get reused for new buffers */
+    if (__gl_any_buffer_orphaned()) {
+        for (GLsizei i = 0; i < n; ++i) {
+            __gl_set_buffer_orphaned(buffers[i], false);
+        }
+    }
+}
+
+/**
+ * Shadow the buffer bound to GL_ELEMENT_ARRAY_BUFFER by reading it back,
+ * returning NULL if it can't be, e.g., while it is mapped.  Expects
+ * __gl_buffer_mutex not to be held.
+ */
+static inline __gl_element_buffer *
+__gl_read_element_buffer(void)
+{
+    GLint size = 0;
+    GLint mapped = GL_FALSE;
+    __glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+    __glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_MAPPED, &mapped);
+    if (size <= 0 || mapped) {
+        return NULL;
+    }
+
+    char *data = (char *)malloc(size);
+    if (!data) {
+        return NULL;
+    }
+    __glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, size, data);
+
+    __gl_element_buffer *shadow = new __gl_element_buffer;
+    shadow->data = data;
+    shadow->size = size;
+    return shadow;
+}
+
+/**
+ * Smallest and largest vertex index referred by an indexed draw call, before
+ * adding the base vertex.  Returns false if there are no indices.
+ */
+static inline bool
+__gl_draw_elements_range(GLsizei count, GLenum type, const GLvoid *indices, GLuint *minindex, GLuint *maxindex)
+{
+    *minindex = 0;
+    *maxindex = 0;
+
+    if (count <= 0) {
+        return false;
+    }
+
+    __gl_client_state *state = __gl_get_client_state();
+    GLuint restart_index = 0;
+    bool restart = __gl_primitive_restart(state, &restart_index);
+
+    GLuint buffer = __gl_element_array_buffer_binding(state);
+    if (!buffer) {
+        if (!indices) {
+            return false;
+        }
+        __gl_index_range(count, type, indices, restart, restart_index, minindex, maxindex);
+        return true;
+    }
+
+    OS::LockMutex(__gl_buffer_mutex);
+
+    __gl_element_buffer *shadow = __gl_find_element_buffer(buffer);
+    if (!shadow) {
+        /* First used for indices, or written in ways that couldn't be
+         * followed since */
+        OS::UnlockMutex(__gl_buffer_mutex);
+        shadow = __gl_read_element_buffer();
+        if (!shadow) {
+            /* Read this call's indices back as a last resort */
+            *maxindex = __glDrawElementsBaseVertex_maxindex(count, type, indices, 0);
+            return true;
+        }
+        OS::LockMutex(__gl_buffer_mutex);
+        __gl_add_element_buffer(buffer, shadow);
+    }
+
+    bool found = true;
+
+    __gl_index_key key;
+    key.offset = (GLintptr)indices;
+    key.count = count;
+    key.type = type;
+    key.restart = restart;
+    key.restart_index = restart ? restart_index : 0;
+
+    std::map<__gl_index_key, __gl_index_bounds>::iterator it = shadow->ranges.find(key);
+    if (it != shadow->ranges.end()) {
+        *minindex = it->second.min;
+        *maxindex = it->second.max;
+    } else {
+        GLsizeiptr size = count * __gl_type_size(type);
+        if (key.offset < 0 || key.offset + size > shadow->size) {
+            OS::DebugMessage("warning: %s: indices out of bounds\n", __FUNCTION__);
+            found = false;
+        } else {
+            __gl_index_range(count, type, shadow->data + key.offset, restart, restart_index, minindex, maxindex);
+
+            __gl_index_bounds &range = shadow->ranges[key];
+            range.min = *minindex;
+            range.max = *maxindex;
+        }
+    }
+
+    OS::UnlockMutex(__gl_buffer_mutex);
+
+    return found;
+}
+
+/*
+ * Range of vertices referred by each kind of draw call.
+ */
+
+static inline void
+__gl_draw_arrays_range(GLint first, GLsizei count, GLuint *minindex, GLuint *maxindex)
+{
+    if (count <= 0 || first < 0) {
+        *minindex = 0;
+        *maxindex = 0;
+        return;
+    }
+    *minindex = first;
+    *maxindex = first + count - 1;
+}
+
+static inline void
+__gl_draw_elements_base_vertex_range(GLsizei count, GLenum type, const GLvoid *indices, GLint basevertex, GLuint *minindex, GLuint *maxindex)
+{
+    if (!__gl_draw_elements_range(count, type, indices, minindex, maxindex)) {
+        return;
+    }
+    if (basevertex < 0 && *minindex < (GLuint)-basevertex) {
+        *minindex = 0;
+    } else {
+        *minindex += basevertex;
+    }
+    *maxindex += basevertex;
+}
+
+/**
+ * Merge the range of one primitive of a multi-draw call into the range of
+ * the whole call.
+ */
+static inline void
+__gl_merge_range(GLsizei prim, GLuint primminindex, GLuint primmaxindex, GLuint *minindex, GLuint *maxindex)
+{
+    if (prim == 0 || primminindex < *minindex) {
+        *minindex = primminindex;
+    }
+    if (prim == 0 || primmaxindex > *maxindex) {
+        *maxindex = primmaxindex;
+    }
+}
+
+static inline void
+__gl_multi_draw_arrays_range(const GLint *first, const GLsizei *count, GLsizei primcount, GLuint *minindex, GLuint *maxindex)
+{
+    *minindex = 0;
+    *maxindex = 0;
+    for (GLsizei prim = 0; prim < primcount; ++prim) {
+        GLuint primminindex, primmaxindex;
+        __gl_draw_arrays_range(first[prim], count[prim], &primminindex, &primmaxindex);
+        __gl_merge_range(prim, primminindex, primmaxindex, minindex, maxindex);
+    }
+}
+
+static inline void
+__gl_multi_draw_elements_range(const GLsizei *count, GLenum type, const GLvoid * const *indices, GLsizei primcount, const GLint *basevertex, GLuint *minindex, GLuint *maxindex)
+{
+    *minindex = 0;
+    *maxindex = 0;
+    for (GLsizei prim = 0; prim < primcount; ++prim) {
+        GLuint primminindex, primmaxindex;
+        __gl_draw_elements_base_vertex_range(count[prim], type, indices[prim], basevertex ? basevertex[prim] : 0, &primminindex, &primmaxindex);
+        __gl_merge_range(prim, primminindex, primmaxindex, minindex, maxindex);
+    }
+}
+
+static inline void
+__gl_draw_arrays_indirect_range(const GLvoid *indirect, GLuint *minindex, GLuint *maxindex)
+{
+    GLint first;
+    GLsizei count;
+    if (!__gl_draw_arrays_indirect_command(indirect, &first, &count)) {
+        *minindex = 0;
+        *maxindex = 0;
+        return;
+    }
+    __gl_draw_arrays_range(first, count, minindex, maxindex);
+}
+
+static inline void
+__gl_draw_elements_indirect_range(GLenum type, const GLvoid *indirect, GLuint *minindex, GLuint *maxindex)
+{
+    GLsizei count;
+    const GLvoid *indices;
+    GLint basevertex;
+    if (!__gl_element_array_buffer_binding(__gl_get_client_state()) ||
+        !__gl_draw_elements_indirect_command(type, indirect, &count, &indices, &basevertex)) {
+        *minindex = 0;
+        *maxindex = 0;
+        return;
+    }
+    __gl_draw_elements_base_vertex_range(count, type, indices, basevertex, minindex, maxindex);
+}
+
+#endif /* _GLTRACE_HPP_ */
@@ -106,36 +106,30 @@ class GlTracer(Tracer):
         print '        return false;'
         print '    }'
         print
+        print '    __gl_client_state *__state = __gl_get_client_state();'
+        print
 
-        for camelcase_name, uppercase_name in self.arrays:
+        for index, (camelcase_name, uppercase_name) in enumerate(self.arrays):
             function_name = 'gl%sPointer' % camelcase_name
-            enable_name = 'GL_%s_ARRAY' % uppercase_name
-            binding_name = 'GL_%s_ARRAY_BUFFER_BINDING' % uppercase_name
             print '    // %s' % function_name
-            self.array_prolog(api, uppercase_name)
-            print '    if (__glIsEnabled(%s)) {' % enable_name
-            print '        GLint __binding = 0;'
-            print '        __glGetIntegerv(%s, &__binding);' % binding_name
-            print '        if (!__binding) {'
-            self.array_cleanup(api, uppercase_name)
-            print '            return true;'
-            print '        }'
-            print '    }'
-            self.array_epilog(api, uppercase_name)
+            if uppercase_name == 'TEXTURE_COORD':
+                print '    GLint __max_texture_coords = __gl_max_texture_coords(__state);'
+                print '    for (GLint unit = 0; unit < __max_texture_coords; ++unit) {'
+                print '        if (__gl_texcoord_array_in_user_memory(__state, unit)) {'
+                print '            return true;'
+                print '        }'
+                print '    }'
+            else:
+                print '    if (__gl_array_in_user_memory(&__state->arrays[%u], GL_%s_ARRAY, GL_%s_ARRAY_BUFFER_BINDING)) {' % (index, uppercase_name, uppercase_name)
+                print '        return true;'
+                print '    }'
             print
 
         print '    // glVertexAttribPointer'
-        print '    GLint __max_vertex_attribs = 0;'
-        print '    __glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &__max_vertex_attribs);'
+        print '    GLint __max_vertex_attribs = __gl_max_vertex_attribs(__state);'
         print '    for (GLint index = 0; index < __max_vertex_attribs; ++index) {'
-        print '        GLint __enabled = 0;'
-        print '        __glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &__enabled);'
-        print '        if (__enabled) {'
-        print '            GLint __binding = 0;'
-        print '            __glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &__binding);'
-        print '            if (!__binding) {'
-        print '                return true;'
-        print '            }'
+        print '        if (__gl_attrib_array_in_user_memory(__state, index)) {'
+        print '            return true;'
         print '        }'
         print '    }'
         print
@@ -144,14 +138,16 @@ class GlTracer(Tracer):
         print '}'
         print
 
-        print 'static void __trace_user_arrays(GLuint maxindex);'
+        print 'static void __trace_user_arrays(GLuint minindex, GLuint maxindex);'
         print
 
         print 'struct buffer_mapping {'
         print '    void *map;'
+        print '    GLintptr offset;'
         print '    GLint length;'
         print '    bool write;'
         print '    bool explicit_flush;'
+        print '    char *shadow;'
         print '};'
         print
         for target in self.buffer_targets:
@@ -169,7 +165,6 @@ class GlTracer(Tracer):
         print '    }'
         print '}'
         print
-
         # Generate memcpy's signature
         self.trace_function_decl(glapi.memcpy)
 
@@ -276,6 +271,13 @@ class GlTracer(Tracer):
         'glDrawElementsInstancedEXT',
     ))
 
+    # Functions which present a frame
+    frame_function_names = set((
+        'glXSwapBuffers',
+        'wglSwapBuffers',
+        'wglSwapLayerBuffers',
+    ))
+
     interleaved_formats = [
          'GL_V2F',
          'GL_V3F',
@@ -294,10 +296,12 @@ class GlTracer(Tracer):
     ]
 
     def trace_function_impl_body(self, function):
+        # Keep the client state shadow up to date
+        self.shadow_client_state(function)
+
         # Defer tracing of user array pointers...
         if function.name in self.array_pointer_function_names:
-            print '    GLint __array_buffer = 0;'
-            print '    __glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &__array_buffer);'
+            print '    GLint __array_buffer = __gl_array_buffer_binding(__gl_get_client_state());'
             print '    if (!__array_buffer) {'
             print '        __user_arrays = true;'
             self.dispatch_function(function)
@@ -349,26 +353,78 @@ class GlTracer(Tracer):
         # ... to the draw calls
         if function.name in self.draw_function_names:
             print '    if (__need_user_arrays()) {'
-            arg_names = ', '.join([arg.name for arg in function.args[1:]])
-            print '        GLuint maxindex = __%s_maxindex(%s);' % (function.name, arg_names)
-            print '        __trace_user_arrays(maxindex);'
+            print '        GLuint minindex = 0;'
+            print '        GLuint maxindex = 0;'
+            arg_names = [arg.name for arg in function.args]
+            if function.name == 'glDrawArraysIndirect':
+                print '        __gl_draw_arrays_indirect_range(indirect, &minindex, &maxindex);'
+            elif function.name == 'glDrawElementsIndirect':
+                print '        __gl_draw_elements_indirect_range(type, indirect, &minindex, &maxindex);'
+            elif 'indices' in arg_names and function.name.startswith('glMulti'):
+                basevertex = 'basevertex' in arg_names and 'basevertex' or 'NULL'
+                print '        __gl_multi_draw_elements_range(count, type, indices, primcount, %s, &minindex, &maxindex);' % basevertex
+            elif 'indices' in arg_names:
+                basevertex = 'basevertex' in arg_names and 'basevertex' or '0'
+                print '        __gl_draw_elements_base_vertex_range(count, type, indices, %s, &minindex, &maxindex);' % basevertex
+            elif function.name.startswith('glMulti'):
+                print '        __gl_multi_draw_arrays_range(first, count, primcount, &minindex, &maxindex);'
+            else:
+                print '        __gl_draw_arrays_range(%s, count, &minindex, &maxindex);' % function.args[1].name
+            print '        __trace_user_arrays(minindex, maxindex);'
             print '    }'
         
-        # Emit a fake memcpy on buffer uploads
+        # Remember buffers whose contents get undefined
+        if function.name in ('glBufferData', 'glBufferDataARB'):
+            print '    __gl_buffer_data_orphaned(target, data);'
+        if function.name == 'glNamedBufferDataEXT':
+            print '    __gl_set_buffer_orphaned(buffer, !data);'
+
+        # Keep the shadows of the index buffers up to date
+        if function.name in ('glBufferData', 'glBufferDataARB'):
+            print '    __gl_shadow_buffer_data(target, size, data);'
+        if function.name in ('glBufferSubData', 'glBufferSubDataARB'):
+            print '    __gl_shadow_buffer_sub_data(target, offset, size, data);'
+        if function.name == 'glCopyBufferSubData':
+            print '    __gl_shadow_copy_buffer_sub_data(readTarget, writeTarget, readOffset, writeOffset, size);'
+        if function.name == 'glNamedBufferDataEXT':
+            print '    __gl_shadow_named_buffer_data(buffer, size, data);'
+        if function.name == 'glNamedBufferSubDataEXT':
+            print '    __gl_shadow_named_buffer_sub_data(buffer, offset, size, data);'
+        if function.name == 'glNamedCopyBufferSubDataEXT':
+            print '    __gl_shadow_named_copy_buffer_sub_data(readBuffer, writeBuffer, readOffset, writeOffset, size);'
+        # Writes through named buffer mappings aren't followed yet
+        if function.name in ('glMapNamedBufferEXT', 'glMapNamedBufferRangeEXT'):
+            print '    __gl_forget_element_buffer(buffer);'
+
+        # Emit fake memcpys of what changed on buffer uploads
         if function.name in ('glUnmapBuffer', 'glUnmapBufferARB', ):
             print '    struct buffer_mapping *mapping = get_buffer_mapping(target);'
             print '    if (mapping && mapping->write && !mapping->explicit_flush) {'
+            print '        if (mapping->shadow) {'
+            self.emit_memcpy_dirty('0', 'mapping->length')
+            print '        } else {'
             self.emit_memcpy('mapping->map', 'mapping->map', 'mapping->length')
+            print '            __gl_shadow_buffer_sub_data(target, mapping->offset, mapping->length, mapping->map);'
+            print '        }'
+            print '    }'
+            print '    if (mapping) {'
+            print '        free(mapping->shadow);'
+            print '        mapping->shadow = NULL;'
             print '    }'
         if function.name in ('glFlushMappedBufferRange', 'glFlushMappedBufferRangeAPPLE'):
-            # TODO: avoid copying [0, offset] bytes
             print '    struct buffer_mapping *mapping = get_buffer_mapping(target);'
             print '    if (mapping) {'
             if function.name.endswith('APPLE'):
                  print '        GLsizeiptr length = size;'
                  print '        mapping->explicit_flush = true;'
             print '        //assert(offset + length <= mapping->length);'
-            self.emit_memcpy('mapping->map', 'mapping->map', 'offset + length')
+            print '        if (mapping->shadow) {'
+            self.emit_memcpy_dirty('offset', 'offset + length')
+            print '        } else {'
+            print '            const char *__flushed = (const char *)mapping->map + offset;'
+            self.emit_memcpy('__flushed', '__flushed', 'length')
+            print '            __gl_shadow_buffer_sub_data(target, mapping->offset + offset, length, __flushed);'
+            print '        }'
             print '    }'
         # FIXME: glFlushMappedNamedBufferRangeEXT
 
@@ -412,6 +468,191 @@ class GlTracer(Tracer):
 
         Tracer.trace_function_impl_body(self, function)
 
+        if function.name in self.frame_function_names:
+            print '    Trace::EndFrame();'
+            print '    __gl_forget_array_records();'
+
+    # Functions which change the client state in ways not worth following
+    client_state_forget_function_names = set((
+        'glPopClientAttrib',
+        'glPushClientAttribDefaultEXT',
+        'glClientAttribDefaultEXT',
+        'glEnableClientStateIndexedEXT',
+        'glDisableClientStateIndexedEXT',
+        'glEnableClientStateiEXT',
+        'glDisableClientStateiEXT',
+        'glMultiTexCoordPointerEXT',
+        'glVertexArrayVertexOffsetEXT',
+        'glVertexArrayColorOffsetEXT',
+        'glVertexArrayEdgeFlagOffsetEXT',
+        'glVertexArrayIndexOffsetEXT',
+        'glVertexArrayNormalOffsetEXT',
+        'glVertexArrayTexCoordOffsetEXT',
+        'glVertexArrayMultiTexCoordOffsetEXT',
+        'glVertexArrayFogCoordOffsetEXT',
+        'glVertexArraySecondaryColorOffsetEXT',
+        'glVertexArrayVertexAttribOffsetEXT',
+        'glVertexArrayVertexAttribIOffsetEXT',
+        'glEnableVertexArrayEXT',
+        'glDisableVertexArrayEXT',
+        'glEnableVertexArrayAttribEXT',
+        'glDisableVertexArrayAttribEXT',
+        'glInterleavedArrays',
+        'glVertexAttribPointerNV',
+        'glBindVertexArray',
+        'glBindVertexArrayAPPLE',
+        'glDeleteVertexArrays',
+        'glDeleteVertexArraysAPPLE',
+        'glDeleteBuffers',
+        'glDeleteBuffersARB',
+    ))
+
+    # Functions which change the current context
+    make_current_function_names = set((
+        'glXMakeCurrent',
+        'glXMakeContextCurrent',
+        'wglMakeCurrent',
+        'wglMakeContextCurrentARB',
+        'wglMakeContextCurrentEXT',
+        'CGLSetCurrentContext',
+    ))
+
+    # Functions which bind buffers for the GPU to write to
+    bind_buffer_index_function_names = set((
+        'glBindBufferBase',
+        'glBindBufferRange',
+        'glBindBufferBaseEXT',
+        'glBindBufferRangeEXT',
+        'glBindBufferOffsetEXT',
+        'glBindBufferBaseNV',
+        'glBindBufferRangeNV',
+        'glBindBufferOffsetNV',
+    ))
+
+    def shadow_client_state(self, function):
+        if function.name in self.make_current_function_names:
+            print '    __gl_forget_client_state();'
+            # The context is always the last argument
+            print '    __gl_make_current_element_buffers(%s);' % function.args[-1].name
+            return
+
+        if function.name in ('glXDestroyContext', 'wglDeleteContext'):
+            print '    __gl_destroy_element_buffers(%s);' % function.args[-1].name
+
+        if function.name in ('glDeleteBuffers', 'glDeleteBuffersARB'):
+            print '    __gl_shadow_delete_buffers(n, %s);' % function.args[1].name
+
+        if function.name in self.client_state_forget_function_names:
+            print '    __gl_forget_client_state();'
+            return
+
+        if function.name in ('glEnable', 'glDisable'):
+            print '    if (cap == GL_PRIMITIVE_RESTART) {'
+            print '        __gl_primitive_restart_used = true;'
+            print '        __gl_get_client_state()->primitive_restart = %u;' % int(function.name == 'glEnable')
+            print '    }'
+        elif function.name == 'glPrimitiveRestartIndex':
+            print '    {'
+            print '        __gl_client_state *__state = __gl_get_client_state();'
+            print '        __gl_primitive_restart_used = true;'
+            print '        __state->primitive_restart_index = index;'
+            print '        __state->primitive_restart_index_known = 1;'
+            print '    }'
+        elif function.name == 'glPopAttrib':
+            print '    __gl_get_client_state()->primitive_restart = -1;'
+            print '    __gl_get_client_state()->primitive_restart_index_known = 0;'
+
+        if function.name in self.bind_buffer_index_function_names:
+            print '    if (target == GL_TRANSFORM_FEEDBACK_BUFFER) {'
+            print '        __gl_forget_element_buffer(buffer);'
+            print '    }'
+
+        if function.name in ('glBindBuffer', 'glBindBufferARB'):
+            print '    switch (target) {'
+            print '    case GL_ARRAY_BUFFER:'
+            print '        __gl_get_client_state()->array_buffer = buffer;'
+            print '        break;'
+            print '    case GL_ELEMENT_ARRAY_BUFFER:'
+            print '        __gl_get_client_state()->element_array_buffer = buffer;'
+            print '        break;'
+            print '    case GL_PIXEL_PACK_BUFFER:'
+            print '    case GL_TRANSFORM_FEEDBACK_BUFFER:'
+            print '        __gl_forget_element_buffer(buffer);'
+            print '        break;'
+            print '    default:'
+            print '        break;'
+            print '    }'
+        elif function.name in ('glClientActiveTexture', 'glClientActiveTextureARB'):
+            print '    __gl_get_client_state()->client_active_texture = texture;'
+        elif function.name in ('glEnableClientState', 'glDisableClientState'):
+            enabled = int(function.name.startswith('glEnable'))
+            print '    {'
+            print '        __gl_client_state *__state = __gl_get_client_state();'
+            print '        switch (array) {'
+            for index, (camelcase_name, uppercase_name) in enumerate(self.arrays):
+                print '        case GL_%s_ARRAY:' % uppercase_name
+                if uppercase_name == 'TEXTURE_COORD':
+                    print '            {'
+                    print '                __gl_array *__array = __gl_texcoord_array(__state);'
+                    print '                if (__array) {'
+                    print '                    __array->enabled = %u;' % enabled
+                    print '                }'
+                    print '            }'
+                else:
+                    print '            __state->arrays[%u].enabled = %u;' % (index, enabled)
+                print '            break;'
+            print '        default:'
+            print '            /* NV attributes alias the arrays above */'
+            print '            if (array >= GL_VERTEX_ATTRIB_ARRAY0_NV && array <= GL_VERTEX_ATTRIB_ARRAY15_NV) {'
+            print '                __gl_forget_client_state();'
+            print '            }'
+            print '            break;'
+            print '        }'
+            print '    }'
+        elif function.name in ('glEnableVertexAttribArray', 'glEnableVertexAttribArrayARB',
+                               'glDisableVertexAttribArray', 'glDisableVertexAttribArrayARB'):
+            enabled = int(function.name.startswith('glEnable'))
+            print '    {'
+            print '        __gl_array *__array = __gl_attrib_array(__gl_get_client_state(), index);'
+            print '        if (__array) {'
+            print '            __array->enabled = %u;' % enabled
+            print '        }'
+            print '    }'
+        elif function.name in self.array_pointer_function_names:
+            print '    {'
+            print '        __gl_client_state *__state = __gl_get_client_state();'
+            if function.name.startswith('glVertexAttrib'):
+                print '        __gl_array *__array = __gl_attrib_array(__state, index);'
+            elif function.name.startswith('glTexCoord'):
+                print '        __gl_array *__array = __gl_texcoord_array(__state);'
+            else:
+                for index, (camelcase_name, uppercase_name) in enumerate(self.arrays):
+                    if function.name.startswith('gl%sPointer' % camelcase_name):
+                        print '        __gl_array *__array = &__state->arrays[%u];' % index
+                        break
+                else:
+                    assert False
+            # Only the texture coordinate and generic attribute lookups fail,
+            # for units or indices we don't track
+            indent = '        '
+            if function.name.startswith(('glVertexAttrib', 'glTexCoord')):
+                print '        if (__array) {'
+                indent += '    '
+            print indent + '__array->user = __gl_array_buffer_binding(__state) ? 0 : 1;'
+            print indent + 'if (!__array->user) {'
+            print indent + '    __array->record.valid = false;'
+            print indent + '}'
+            print indent + '__array->known = true;'
+            print indent + '__array->normalized = GL_FALSE;'
+            for arg in function.args:
+                if arg.name in ('size', 'type', 'normalized', 'stride'):
+                    print indent + '__array->%s = %s;' % (arg.name, arg.name)
+                elif arg.name == 'pointer':
+                    print indent + '__array->pointer = (GLvoid *)pointer;'
+            if function.name.startswith(('glVertexAttrib', 'glTexCoord')):
+                print '        }'
+            print '    }'
+
     def dispatch_function(self, function):
         if function.name in ('glLinkProgram', 'glLinkProgramARB'):
             # These functions have been dispatched already
@@ -434,6 +675,16 @@ class GlTracer(Tracer):
         print '        Trace::BeginLeave(__call);'
         print '        Trace::EndLeave();'
        
+    def emit_memcpy_dirty(self, begin, end):
+        print '        size_t __start = %s;' % begin
+        print '        size_t __length = 0;'
+        print '        while (__gl_shadow_next_dirty((const char *)mapping->map, mapping->shadow, %s, &__start, &__length)) {' % end
+        print '            const char *__dirty = (const char *)mapping->map + __start;'
+        self.emit_memcpy('__dirty', '__dirty', '__length')
+        print '            __gl_shadow_buffer_sub_data(target, mapping->offset + __start, __length, __dirty);'
+        print '            __start += __length;'
+        print '        }'
+
     buffer_targets = [
         'ARRAY_BUFFER',
         'ELEMENT_ARRAY_BUFFER',
@@ -448,21 +699,40 @@ class GlTracer(Tracer):
             print '    struct buffer_mapping *mapping = get_buffer_mapping(target);'
             print '    if (mapping) {'
             print '        mapping->map = %s;' % (instance)
+            print '        mapping->offset = 0;'
             print '        mapping->length = 0;'
             print '        __glGetBufferParameteriv(target, GL_BUFFER_SIZE, &mapping->length);'
             print '        mapping->write = (access != GL_READ_ONLY);'
             print '        mapping->explicit_flush = false;'
+            self.shadow_mapping('access == GL_READ_WRITE', 'false')
+            print '    } else if (access != GL_READ_ONLY) {'
+            print '        __gl_shadow_buffer_invalidate(target);'
             print '    }'
 
         if function.name == 'glMapBufferRange':
             print '    struct buffer_mapping *mapping = get_buffer_mapping(target);'
             print '    if (mapping) {'
             print '        mapping->map = %s;' % (instance)
+            print '        mapping->offset = offset;'
             print '        mapping->length = length;'
             print '        mapping->write = access & GL_MAP_WRITE_BIT;'
             print '        mapping->explicit_flush = access & GL_MAP_FLUSH_EXPLICIT_BIT;'
+            self.shadow_mapping('access & GL_MAP_READ_BIT', 'access & (GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT)')
+            print '    } else if (access & GL_MAP_WRITE_BIT) {'
+            print '        __gl_shadow_buffer_invalidate(target);'
             print '    }'
 
+    def shadow_mapping(self, readable, invalidate):
+        # Only diff against contents that are also defined when retracing, and
+        # that may be read at all, as reading write-only mappings is undefined,
+        # and very slow when they are write-combined
+        print '        free(mapping->shadow);'
+        print '        mapping->shadow = NULL;'
+        print '        bool __orphaned = __gl_take_buffer_orphaned(target);'
+        print '        if (mapping->map && mapping->write && mapping->length > 0 && (%s) && !__orphaned && !(%s)) {' % (readable, invalidate)
+        print '            mapping->shadow = __gl_shadow_create(mapping->map, mapping->length);'
+        print '        }'
+
     boolean_names = [
         'GL_FALSE',
         'GL_TRUE',
@@ -471,10 +741,15 @@ class GlTracer(Tracer):
     def gl_boolean(self, value):
         return self.boolean_names[int(bool(value))]
 
+    def defer_function(self, function):
+        # The indices of draw calls are looked at in the current context
+        if function.name in self.draw_function_names:
+            return False
+        return Tracer.defer_function(self, function)
+
     def dump_arg_instance(self, function, arg):
         if function.name in self.draw_function_names and arg.name == 'indices':
-            print '    GLint __element_array_buffer = 0;'
-            print '    __glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &__element_array_buffer);'
+            print '    GLint __element_array_buffer = __gl_element_array_buffer_binding(__gl_get_client_state());'
             print '    if (!__element_array_buffer) {'
             if isinstance(arg.type, stdapi.Array):
                 Tracer.dump_arg_instance(self, function, arg)
@@ -510,12 +785,14 @@ class GlTracer(Tracer):
     def footer(self, api):
         Tracer.footer(self, api)
 
-        # A simple state tracker to track the pointer values
-        # update the state
-        print 'static void __trace_user_arrays(GLuint maxindex)'
+        # Emit fake calls for the arrays in user memory, taking the
+        # parameters from the client state shadow whenever possible
+        print 'static void __trace_user_arrays(GLuint minindex, GLuint maxindex)'
         print '{'
+        print '    __gl_client_state *__state = __gl_get_client_state();'
+        print
 
-        for camelcase_name, uppercase_name in self.arrays:
+        for index, (camelcase_name, uppercase_name) in enumerate(self.arrays):
             function_name = 'gl%sPointer' % camelcase_name
             enable_name = 'GL_%s_ARRAY' % uppercase_name
             binding_name = 'GL_%s_ARRAY_BUFFER_BINDING' % uppercase_name
@@ -524,36 +801,48 @@ class GlTracer(Tracer):
             print '    // %s' % function.name
             self.array_trace_prolog(api, uppercase_name)
             self.array_prolog(api, uppercase_name)
-            print '    if (__glIsEnabled(%s)) {' % enable_name
-            print '        GLint __binding = 0;'
-            print '        __glGetIntegerv(%s, &__binding);' % binding_name
-            print '        if (!__binding) {'
-
-            # Get the arguments via glGet*
+            if uppercase_name == 'TEXTURE_COORD':
+                print '    if (__gl_texcoord_array_in_user_memory(__state, unit)) {'
+                print '        __gl_array *__array = &__state->texcoords[unit];'
+            else:
+                print '    if (__gl_array_in_user_memory(&__state->arrays[%u], %s, %s)) {' % (index, enable_name, binding_name)
+                print '        __gl_array *__array = &__state->arrays[%u];' % index
+            print '        if (!__array->known) {'
+            self.array_query_prolog(api, uppercase_name)
             for arg in function.args:
                 arg_get_enum = 'GL_%s_ARRAY_%s' % (uppercase_name, arg.name.upper())
                 arg_get_function, arg_type = TypeGetter().visit(arg.type)
-                print '            %s %s = 0;' % (arg_type, arg.name)
-                print '            __%s(%s, &%s);' % (arg_get_function, arg_get_enum, arg.name)
-            
+                print '            __%s(%s, &__array->%s);' % (arg_get_function, arg_get_enum, arg.name)
+            self.array_query_epilog(api, uppercase_name)
+            print '            __array->known = true;'
+            print '        }'
+
+            # Get the arguments from the shadow
+            for arg in function.args:
+                print '        %s %s = (%s)__array->%s;' % (arg.type, arg.name, arg.type, arg.name)
+
+            # Only the vertices from minindex to maxindex are recorded
             arg_names = ', '.join([arg.name for arg in function.args[:-1]])
-            print '            size_t __size = __%s_size(%s, maxindex);' % (function.name, arg_names)
+            print '        size_t __size = __%s_size(%s, maxindex);' % (function.name, arg_names)
+            print '        size_t __offset = __size - __%s_size(%s, maxindex - minindex);' % (function.name, arg_names)
+            print '        if (!__gl_array_recorded(__array, __offset, __size - __offset)) {'
+            print '            __gl_array_record_data(__array, __offset, __size - __offset);'
 
             # Emit a fake function
             self.array_trace_intermezzo(api, uppercase_name)
-            print '            unsigned __call = Trace::BeginEnter(__%s_sig);' % (function.name,)
+            print '        unsigned __call = Trace::BeginEnter(__%s_sig);' % (function.name,)
             for arg in function.args:
                 assert not arg.output
-                print '            Trace::BeginArg(%u);' % (arg.index,)
+                print '        Trace::BeginArg(%u);' % (arg.index,)
                 if arg.name != 'pointer':
                     dump_instance(arg.type, arg.name)
                 else:
-                    print '            Trace::LiteralBlob((const void *)%s, __size);' % (arg.name)
-                print '            Trace::EndArg();'
+                    print '        Trace::LiteralBlobOffset((const void *)%s, __offset, __size - __offset);' % (arg.name)
+                print '        Trace::EndArg();'
             
-            print '            Trace::EndEnter();'
-            print '            Trace::BeginLeave(__call);'
-            print '            Trace::EndLeave();'
+            print '        Trace::EndEnter();'
+            print '        Trace::BeginLeave(__call);'
+            print '        Trace::EndLeave();'
             print '        }'
             print '    }'
             self.array_epilog(api, uppercase_name)
@@ -562,15 +851,11 @@ class GlTracer(Tracer):
 
         # Samething, but for glVertexAttribPointer
         print '    // glVertexAttribPointer'
-        print '    GLint __max_vertex_attribs = 0;'
-        print '    __glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &__max_vertex_attribs);'
+        print '    GLint __max_vertex_attribs = __gl_max_vertex_attribs(__state);'
         print '    for (GLint index = 0; index < __max_vertex_attribs; ++index) {'
-        print '        GLint __enabled = 0;'
-        print '        __glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &__enabled);'
-        print '        if (__enabled) {'
-        print '            GLint __binding = 0;'
-        print '            __glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &__binding);'
-        print '            if (!__binding) {'
+        print '        if (__gl_attrib_array_in_user_memory(__state, index)) {'
+        print '            __gl_array *__array = &__state->attribs[index];'
+        print '            if (!__array->known) {'
 
         function = api.get_function_by_name('glVertexAttribPointer')
 
@@ -578,27 +863,35 @@ class GlTracer(Tracer):
         for arg in function.args[1:]:
             arg_get_enum = 'GL_VERTEX_ATTRIB_ARRAY_%s' % (arg.name.upper(),)
             arg_get_function, arg_type = TypeGetter('glGetVertexAttrib', False).visit(arg.type)
-            print '                %s %s = 0;' % (arg_type, arg.name)
-            print '                __%s(index, %s, &%s);' % (arg_get_function, arg_get_enum, arg.name)
+            print '                __%s(index, %s, &__array->%s);' % (arg_get_function, arg_get_enum, arg.name)
+        print '                __array->known = true;'
+        print '            }'
+
+        for arg in function.args[1:]:
+            print '            %s %s = (%s)__array->%s;' % (arg.type, arg.name, arg.type, arg.name)
         
         arg_names = ', '.join([arg.name for arg in function.args[1:-1]])
-        print '                size_t __size = __%s_size(%s, maxindex);' % (function.name, arg_names)
+        print '            size_t __size = __%s_size(%s, maxindex);' % (function.name, arg_names)
+        print '            size_t __offset = __size - __%s_size(%s, maxindex - minindex);' % (function.name, arg_names)
+        print '            if (__gl_array_recorded(__array, __offset, __size - __offset)) {'
+        print '                continue;'
+        print '            }'
+        print '            __gl_array_record_data(__array, __offset, __size - __offset);'
 
         # Emit a fake function
-        print '                unsigned __call = Trace::BeginEnter(__%s_sig);' % (function.name,)
+        print '            unsigned __call = Trace::BeginEnter(__%s_sig);' % (function.name,)
         for arg in function.args:
             assert not arg.output
-            print '                Trace::BeginArg(%u);' % (arg.index,)
+            print '            Trace::BeginArg(%u);' % (arg.index,)
             if arg.name != 'pointer':
                 dump_instance(arg.type, arg.name)
             else:
-                print '                Trace::LiteralBlob((const void *)%s, __size);' % (arg.name)
-            print '                Trace::EndArg();'
+                print '            Trace::LiteralBlobOffset((const void *)%s, __offset, __size - __offset);' % (arg.name)
+            print '            Trace::EndArg();'
         
-        print '                Trace::EndEnter();'
-        print '                Trace::BeginLeave(__call);'
-        print '                Trace::EndLeave();'
-        print '            }'
+        print '            Trace::EndEnter();'
+        print '            Trace::BeginLeave(__call);'
+        print '            Trace::EndLeave();'
         print '        }'
         print '    }'
         print
@@ -613,13 +906,10 @@ class GlTracer(Tracer):
 
     def array_prolog(self, api, uppercase_name):
         if uppercase_name == 'TEXTURE_COORD':
-            print '    GLint client_active_texture = 0;'
-            print '    __glGetIntegerv(GL_CLIENT_ACTIVE_TEXTURE, &client_active_texture);'
-            print '    GLint max_texture_coords = 0;'
-            print '    __glGetIntegerv(GL_MAX_TEXTURE_COORDS, &max_texture_coords);'
+            print '    GLint client_active_texture = __gl_client_active_texture(__state);'
+            print '    GLint max_texture_coords = __gl_max_texture_coords(__state);'
             print '    for (GLint unit = 0; unit < max_texture_coords; ++unit) {'
             print '        GLenum texture = GL_TEXTURE0 + unit;'
-            print '        __glClientActiveTexture(texture);'
 
     def array_trace_prolog(self, api, uppercase_name):
         if uppercase_name == 'TEXTURE_COORD':
@@ -628,15 +918,22 @@ class GlTracer(Tracer):
     def array_epilog(self, api, uppercase_name):
         if uppercase_name == 'TEXTURE_COORD':
             print '    }'
-        self.array_cleanup(api, uppercase_name)
 
-    def array_cleanup(self, api, uppercase_name):
+    def array_query_prolog(self, api, uppercase_name):
+        if uppercase_name == 'TEXTURE_COORD':
+            print '            if (texture != (GLenum)client_active_texture) {'
+            print '                __glClientActiveTexture(texture);'
+            print '            }'
+
+    def array_query_epilog(self, api, uppercase_name):
         if uppercase_name == 'TEXTURE_COORD':
-            print '    __glClientActiveTexture(client_active_texture);'
+            print '            if (texture != (GLenum)client_active_texture) {'
+            print '                __glClientActiveTexture(client_active_texture);'
+            print '            }'
         
     def array_trace_intermezzo(self, api, uppercase_name):
         if uppercase_name == 'TEXTURE_COORD':
-            print '    if (texture != client_active_texture || client_active_texture_dirty) {'
+            print '    if (texture != (GLenum)client_active_texture || client_active_texture_dirty) {'
             print '        client_active_texture_dirty = true;'
             self.fake_glClientActiveTexture_call(api, "texture");
             print '    }'
@@ -32,7 +32,9 @@ from stdapi import API
 from glapi import glapi
 from glxapi import glxapi
 from gltrace import GlTracer
+from glproc import GlDispatcher
 from dispatch import function_pointer_type, function_pointer_value
+from codegen import string_switch
 
 
 class GlxTracer(GlTracer):
@@ -66,6 +68,7 @@ if __name__ == '__main__':
     print
     print '#include "glproc.hpp"'
     print '#include "glsize.hpp"'
+    print '#include "gltrace.hpp"'
     print
     print 'static __GLXextFuncPtr __unwrap_proc_addr(const GLubyte * procName, __GLXextFuncPtr procPtr);'
     print
@@ -80,16 +83,37 @@ if __name__ == '__main__':
     print '    if (!procPtr) {'
     print '        return procPtr;'
     print '    }'
-    for f in api.functions:
+    func_dict = dict([(f.name, f) for f in api.functions])
+    def handle_case(function_name):
+        f = func_dict[function_name]
         ptype = function_pointer_type(f)
         pvalue = function_pointer_value(f)
-        print '    if (!strcmp("%s", (const char *)procName)) {' % f.name
-        print '        %s = (%s)procPtr;' % (pvalue, ptype)
-        print '        return (__GLXextFuncPtr)&%s;' % (f.name,)
-        print '    }'
+        print '    %s = (%s)procPtr;' % (pvalue, ptype)
+        print '    return (__GLXextFuncPtr)&%s;' % (f.name,)
+    string_switch('procName', func_dict.keys(), handle_case)
     print '    return procPtr;'
     print '}'
     print
+
+    # Resolve every entry point at load time when TRACE_BIND_NOW=1, so that
+    # the first call of each function does not pay for the lookup.
+    dispatcher = GlDispatcher()
+    print 'static void __resolve_all_procs(void) {'
+    for f in api.functions:
+        dispatcher.resolve_function(f)
+    print '}'
+    print
+    print 'static struct __bind_now {'
+    print '    __bind_now() {'
+    print '        const char *bind_now = getenv("TRACE_BIND_NOW");'
+    print '        if (bind_now && strcmp(bind_now, "0") != 0) {'
+    print '            long long start = OS::GetTime();'
+    print '            __resolve_all_procs();'
+    print '            OS::DebugMessage("apitrace: resolved all functions in %lli us\\n", OS::GetTime() - start);'
+    print '        }'
+    print '    }'
+    print '} __bind_now;'
+    print
     print r'''
 
 
@@ -7,6 +7,7 @@
 
 ApiTrace::ApiTrace()
     : m_frameMarker(ApiTrace::FrameMarker_SwapBuffers),
+      m_startFrame(0),
       m_needsSaving(false)
 {
     m_loader = new LoaderThread(this);
@@ -26,6 +27,7 @@ ApiTrace::ApiTrace()
 
 ApiTrace::~ApiTrace()
 {
+    m_loader->stop();
     qDeleteAll(m_calls);
     qDeleteAll(m_frames);
     delete m_loader;
@@ -38,15 +40,21 @@ bool ApiTrace::isCallAFrameMarker(const ApiTraceCall *call,
     if (!call)
         return false;
 
+    return isFunctionAFrameMarker(call->name(), marker);
+}
+
+bool ApiTrace::isFunctionAFrameMarker(const QString &name,
+                                      ApiTrace::FrameMarker marker)
+{
     switch (marker) {
     case FrameMarker_SwapBuffers:
-        return call->name().contains(QLatin1String("SwapBuffers"));
+        return name.contains(QLatin1String("SwapBuffers"));
     case FrameMarker_Flush:
-        return call->name() == QLatin1String("glFlush");
+        return name == QLatin1String("glFlush");
     case FrameMarker_Finish:
-        return call->name() == QLatin1String("glFinish");
+        return name == QLatin1String("glFinish");
     case FrameMarker_Clear:
-        return call->name() == QLatin1String("glClear");
+        return name == QLatin1String("glClear");
     }
 
     Q_ASSERT(!"unknown frame marker");
@@ -111,15 +119,16 @@ int ApiTrace::numCallsInFrame(int idx) const
         return 0;
 }
 
+/*
+ * Loads the trace from the start frame given before, so the same file is
+ * loaded again when only the start frame changed.
+ */
 void ApiTrace::setFileName(const QString &name)
 {
-    if (m_fileName != name) {
+    if (m_fileName != name || m_loader->startFrame() != m_startFrame) {
         m_fileName = name;
 
-        if (m_loader->isRunning()) {
-            m_loader->terminate();
-            m_loader->wait();
-        }
+        m_loader->stop();
         m_frames.clear();
         m_calls.clear();
         m_errors.clear();
@@ -127,6 +136,7 @@ void ApiTrace::setFileName(const QString &name)
         m_needsSaving = false;
         emit invalidated();
 
+        m_loader->setStartFrame(m_startFrame);
         m_loader->loadFile(m_fileName);
     }
 }
@@ -142,6 +152,11 @@ void ApiTrace::setFrameMarker(FrameMarker marker)
     }
 }
 
+void ApiTrace::setStartFrame(int frame)
+{
+    m_startFrame = frame;
+}
+
 void ApiTrace::addFrames(const QList<ApiTraceFrame*> &frames)
 {
     int currentFrames = m_frames.count();
@@ -21,6 +21,8 @@ public:
     };
     static bool isCallAFrameMarker(const ApiTraceCall *call,
                                    FrameMarker marker);
+    static bool isFunctionAFrameMarker(const QString &name,
+                                       FrameMarker marker);
 public:
     ApiTrace();
     ~ApiTrace();
@@ -57,6 +59,7 @@ public:
 public slots:
     void setFileName(const QString &name);
     void setFrameMarker(FrameMarker marker);
+    void setStartFrame(int frame);
     void save();
 
 signals:
@@ -85,6 +88,7 @@ private:
     QList<ApiTraceCall*> m_calls;
 
     FrameMarker m_frameMarker;
+    int m_startFrame;
 
     LoaderThread *m_loader;
     SaverThread  *m_saver;
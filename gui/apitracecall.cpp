@@ -297,15 +297,8 @@ void VariantVisitor::visit(Trace::Array *array)
 
 void VariantVisitor::visit(Trace::Blob *blob)
 {
-    //XXX
-    //FIXME: this is a nasty hack. Trace::Blob's can't
-    //   delete the contents in the destructor because
-    //   the data is being used by other calls. We piggy back
-    //   on that assumption and don't deep copy the data. If
-    //   Blob's will start deleting the data we will need to
-    //   start deep copying it or switch to using something like
-    //   Boost's shared_ptr or Qt's QSharedPointer to handle it
-    QByteArray barray = QByteArray::fromRawData(blob->buf, blob->size);
+    // The data goes away with the call, so it must be copied
+    QByteArray barray(blob->buf, blob->size);
     m_variant = QVariant(barray);
 }
 
@@ -344,9 +337,9 @@ void ApiArray::init(const Trace::Array *arr)
     if (!arr)
         return;
 
-    for (int i = 0; i < arr->values.size(); ++i) {
+    for (size_t i = 0; i < arr->size(); ++i) {
         VariantVisitor vis;
-        arr->values[i]->visit(vis);
+        arr->value(i)->visit(vis);
 
         m_array.append(vis.variant());
     }
@@ -21,9 +21,44 @@ apiCallFromTraceCall(const Trace::Call *call,
     return apiCall;
 }
 
+/*
+ * The index only knows the frames that SwapBuffers ends, so for the other
+ * markers find the first call of the frame by scanning the trace, which
+ * doesn't decode arguments, and seek back to it.
+ */
+static bool
+seekFrame(Trace::Parser &p, int frame, ApiTrace::FrameMarker marker,
+          const volatile bool &stopped)
+{
+    if (marker == ApiTrace::FrameMarker_SwapBuffers) {
+        return p.seek_frame(frame);
+    }
+    if (!p.has_index()) {
+        return false;
+    }
+
+    Trace::CallLocation location;
+    int frameCount = 0;
+    while (!stopped && p.scan_call(location)) {
+        if (frameCount == frame) {
+            return p.seek(location);
+        }
+        if (ApiTrace::isFunctionAFrameMarker(
+                QString::fromStdString(location.sig->name), marker)) {
+            ++frameCount;
+        }
+    }
+
+    /* Load the whole trace instead */
+    p.seek_call(0);
+    return false;
+}
+
 LoaderThread::LoaderThread(QObject *parent)
     : QThread(parent),
-      m_frameMarker(ApiTrace::FrameMarker_SwapBuffers)
+      m_frameMarker(ApiTrace::FrameMarker_SwapBuffers),
+      m_startFrame(0),
+      m_stopped(false)
 {
 }
 
@@ -54,7 +89,14 @@ void LoaderThread::run()
 
     Trace::Parser p;
     if (p.open(m_fileName.toLatin1().constData())) {
-        Trace::Call *call = p.parse_call();
+        if (m_startFrame) {
+            if (seekFrame(p, m_startFrame, m_frameMarker, m_stopped)) {
+                frameCount = m_startFrame;
+            } else {
+                qWarning() << "Couldn't seek to frame " << m_startFrame;
+            }
+        }
+        Trace::Call *call = m_stopped ? 0 : p.parse_call();
         while (call) {
             //std::cout << *call;
             if (!currentFrame) {
@@ -76,8 +118,18 @@ void LoaderThread::run()
                 }
             }
             delete call;
-            call = p.parse_call();
+            call = m_stopped ? 0 : p.parse_call();
+        }
+    }
+    if (m_stopped) {
+        if (currentFrame) {
+            frames.append(currentFrame);
+        }
+        foreach(ApiTraceFrame *frame, frames) {
+            qDeleteAll(frame->calls());
         }
+        qDeleteAll(frames);
+        return;
     }
     //last frames won't have markers
     //  it's just a bunch of Delete calls for every object
@@ -93,10 +145,20 @@ void LoaderThread::run()
 
 void LoaderThread::loadFile(const QString &fileName)
 {
+    Q_ASSERT(!isRunning());
     m_fileName = fileName;
+    m_stopped = false;
     start();
 }
 
+void LoaderThread::stop()
+{
+    if (isRunning()) {
+        m_stopped = true;
+        wait();
+    }
+}
+
 ApiTrace::FrameMarker LoaderThread::frameMarker() const
 {
     return m_frameMarker;
@@ -108,4 +170,15 @@ void LoaderThread::setFrameMarker(ApiTrace::FrameMarker marker)
     m_frameMarker = marker;
 }
 
+int LoaderThread::startFrame() const
+{
+    return m_startFrame;
+}
+
+void LoaderThread::setStartFrame(int frame)
+{
+    Q_ASSERT(!isRunning());
+    m_startFrame = frame;
+}
+
 #include "loaderthread.moc"
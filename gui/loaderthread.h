@@ -16,6 +16,12 @@ public:
 
     ApiTrace::FrameMarker frameMarker() const;
     void setFrameMarker(ApiTrace::FrameMarker marker);
+
+    int startFrame() const;
+    void setStartFrame(int frame);
+
+    /* Stop loading, and wait for the thread to finish */
+    void stop();
 public slots:
     void loadFile(const QString &fileName);
 
@@ -28,6 +34,8 @@ protected:
 private:
     QString m_fileName;
     ApiTrace::FrameMarker m_frameMarker;
+    int m_startFrame;
+    volatile bool m_stopped;
 };
 
 #endif
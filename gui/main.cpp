@@ -4,6 +4,7 @@
 
 #include <QApplication>
 #include <QMetaType>
+#include <QStringList>
 #include <QVariant>
 
 Q_DECLARE_METATYPE(QList<ApiTraceFrame*>);
@@ -18,8 +19,11 @@ int main(int argc, char **argv)
 
     window.show();
 
-    if (app.arguments().count() == 2)
-        window.loadTrace(app.arguments()[1]);
+    QStringList args = app.arguments();
+    if (args.count() == 2)
+        window.loadTrace(args[1]);
+    else if (args.count() == 4 && args[1] == QLatin1String("-f"))
+        window.loadTrace(args[3], args[2].toInt());
 
     app.exec();
 }
@@ -80,7 +80,7 @@ void MainWindow::openTrace()
     }
 }
 
-void MainWindow::loadTrace(const QString &fileName)
+void MainWindow::loadTrace(const QString &fileName, int startFrame)
 {
     if (!QFile::exists(fileName)) {
         QMessageBox::warning(this, tr("File Missing"),
@@ -88,7 +88,7 @@ void MainWindow::loadTrace(const QString &fileName)
         return;
     }
 
-    newTraceFile(fileName);
+    newTraceFile(fileName, startFrame);
 }
 
 void MainWindow::callItemSelected(const QModelIndex &index)
@@ -174,11 +174,12 @@ void MainWindow::replayStop()
     m_ui.actionLookupState->setEnabled(true);
 }
 
-void MainWindow::newTraceFile(const QString &fileName)
+void MainWindow::newTraceFile(const QString &fileName, int startFrame)
 {
     qDebug()<< "Loading  : " <<fileName;
 
     m_progressBar->setValue(0);
+    m_trace->setStartFrame(startFrame);
     m_trace->setFileName(fileName);
 
     if (fileName.isEmpty()) {
@@ -34,7 +34,7 @@ public:
     ~MainWindow();
 
 public slots:
-    void loadTrace(const QString &fileName);
+    void loadTrace(const QString &fileName, int startFrame = 0);
 
 private slots:
     void callItemSelected(const QModelIndex &index);
@@ -73,7 +73,7 @@ private slots:
 private:
     void initObjects();
     void initConnections();
-    void newTraceFile(const QString &fileName);
+    void newTraceFile(const QString &fileName, int startFrame = 0);
     void replayTrace(bool dumpState);
     void fillStateForFrame();
     ApiTraceFrame *currentFrame() const;
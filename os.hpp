@@ -50,6 +50,13 @@
 #define PATH_MAX 1024
 #endif
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 namespace OS {
 
 void AcquireMutex(void);
@@ -84,8 +91,168 @@ void DebugMessage(const char *format, ...);
  */
 long long GetTime(void);
 
+/**
+ * Get a cheap, high resolution timestamp, in unspecified units.  This is the
+ * CPU time stamp counter where available, so it must be calibrated against
+ * GetTime() to mean anything.
+ */
+inline unsigned long long
+GetTimestamp(void)
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+    return __rdtsc();
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    unsigned lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long)hi << 32) | lo;
+#else
+    return GetTime();
+#endif
+}
+
 void Abort(void);
 
+/**
+ * Register a function to be called when the process crashes (e.g., with a
+ * segmentation fault, or abort()).  Previously installed handlers are still
+ * invoked afterwards.
+ */
+void SetExceptionCallback(void (*callback)(void));
+
+/**
+ * Register a function to be called when the user asks for it, by sending the
+ * SIGUSR1 signal.  It is called from a signal handler, so it should do little
+ * more than setting a flag.  Not supported on Windows.
+ */
+void SetUserCallback(void (*callback)(void));
+
+/**
+ * Minimal threading support, so that the trace writer can do its work outside
+ * the application threads.
+ */
+struct Thread;
+
+Thread *StartThread(void (*function)(void *), void *arg);
+void JoinThread(Thread *thread);
+
+/**
+ * Suspend the calling thread for (at least) the given number of microseconds.
+ */
+void Sleep(unsigned long usecs);
+
+unsigned GetProcessorCount(void);
+
+/**
+ * Fill frames with the return addresses of the calling thread's stack, the
+ * innermost first, and return how many were found (at most count).
+ */
+unsigned GetBacktrace(void **frames, unsigned count);
+
+/**
+ * Much cheaper variant of GetBacktrace() that follows the chain of frame
+ * pointers.  It only finds the frames of code built with frame pointers, and
+ * stops at the first one without, but it never reads outside of the thread's
+ * stack.  Falls back to GetBacktrace() where not supported.
+ */
+unsigned GetFrameBacktrace(void **frames, unsigned count);
+
+/**
+ * Find the module (executable or shared library) holding addr, and the
+ * address it corresponds to in the module's own symbol tables, so that it can
+ * be symbolized after the process is gone.
+ */
+bool GetModuleOffset(const void *addr, char *module, size_t size, unsigned long long *offset);
+
+struct Mutex;
+
+Mutex *NewMutex(void);
+void DeleteMutex(Mutex *mutex);
+void LockMutex(Mutex *mutex);
+void UnlockMutex(Mutex *mutex);
+
+/**
+ * Condition variable.  Signal and broadcast must be done with the associated
+ * mutex held.
+ */
+struct Condition;
+
+Condition *NewCondition(void);
+void DeleteCondition(Condition *cond);
+void WaitCondition(Condition *cond, Mutex *mutex);
+
+/**
+ * Like WaitCondition(), but give up after the given number of microseconds.
+ */
+void TimedWaitCondition(Condition *cond, Mutex *mutex, unsigned long long usecs);
+void SignalCondition(Condition *cond);
+void BroadcastCondition(Condition *cond);
+
+/*
+ * Atomic operations.  All of these imply a full memory barrier.
+ */
+
+inline long
+AtomicIncrement(volatile long *value)
+{
+#ifdef _MSC_VER
+    return _InterlockedIncrement(value);
+#else
+    return __sync_add_and_fetch(value, 1);
+#endif
+}
+
+inline long
+AtomicAdd(volatile long *value, long addend)
+{
+#ifdef _MSC_VER
+    return _InterlockedExchangeAdd(value, addend) + addend;
+#else
+    return __sync_add_and_fetch(value, addend);
+#endif
+}
+
+inline long
+AtomicExchange(volatile long *ptr, long value)
+{
+#ifdef _MSC_VER
+    return _InterlockedExchange(ptr, value);
+#else
+    /* __sync_lock_test_and_set is only an acquire barrier */
+    __sync_synchronize();
+    return __sync_lock_test_and_set(ptr, value);
+#endif
+}
+
+inline void *
+AtomicExchangePointer(void * volatile *ptr, void *value)
+{
+#ifdef _MSC_VER
+#ifdef _WIN64
+    return _InterlockedExchangePointer(ptr, value);
+#else
+    return (void *)_InterlockedExchange((volatile long *)ptr, (long)value);
+#endif
+#else
+    /* __sync_lock_test_and_set is only an acquire barrier */
+    __sync_synchronize();
+    return __sync_lock_test_and_set(ptr, value);
+#endif
+}
+
+inline bool
+AtomicCompareExchangePointer(void * volatile *ptr, void *oldValue, void *newValue)
+{
+#ifdef _MSC_VER
+#ifdef _WIN64
+    return _InterlockedCompareExchangePointer(ptr, newValue, oldValue) == oldValue;
+#else
+    return (void *)_InterlockedCompareExchange((volatile long *)ptr, (long)newValue, (long)oldValue) == oldValue;
+#endif
+#else
+    return __sync_bool_compare_and_swap(ptr, oldValue, newValue);
+#endif
+}
+
 } /* namespace OS */
 
 #endif /* _OS_HPP_ */
@@ -24,13 +24,25 @@
  **************************************************************************/
 
 
+#include <assert.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <unistd.h>
+#include <signal.h>
 #include <sys/time.h>
+#include <time.h>
 #include <pthread.h>
+#include <dlfcn.h>
+#ifdef __GLIBC__
+#include <link.h>
+#endif
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#define HAVE_BACKTRACE 1
+#endif
 
 #ifdef __APPLE__
 #include <mach-o/dyld.h>
@@ -114,9 +126,15 @@ DebugMessage(const char *format, ...)
 
 long long GetTime(void)
 {
+#if defined(CLOCK_MONOTONIC) && !defined(__APPLE__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_nsec/1000 + ts.tv_sec*1000000LL;
+#else
     struct timeval tv;
     gettimeofday(&tv, NULL);
     return tv.tv_usec + tv.tv_sec*1000000LL;
+#endif
 }
 
 void
@@ -126,5 +144,333 @@ Abort(void)
 }
 
 
+static void (*gCallback)(void) = NULL;
+
+static struct sigaction old_actions[NSIG];
+
+static void
+SignalHandler(int sig, siginfo_t *info, void *context)
+{
+    static int recursion_count = 0;
+
+    if (recursion_count) {
+        fprintf(stderr, "apitrace: warning: recursion handling signal %i\n", sig);
+    } else {
+        if (gCallback) {
+            ++recursion_count;
+            gCallback();
+            --recursion_count;
+        }
+    }
+
+    /* Chain to the previous handler */
+    struct sigaction *old_action = &old_actions[sig];
+    if (old_action->sa_flags & SA_SIGINFO) {
+        old_action->sa_sigaction(sig, info, context);
+    } else if (old_action->sa_handler == SIG_IGN) {
+        /* ignore */
+    } else if (old_action->sa_handler == SIG_DFL) {
+        /* Restore the default action and raise the signal again */
+        sigaction(sig, old_action, NULL);
+        raise(sig);
+    } else {
+        old_action->sa_handler(sig);
+    }
+}
+
+void
+SetExceptionCallback(void (*callback)(void))
+{
+    assert(!gCallback);
+    if (!gCallback) {
+        gCallback = callback;
+
+        struct sigaction new_action;
+        new_action.sa_sigaction = SignalHandler;
+        sigemptyset(&new_action.sa_mask);
+        new_action.sa_flags = SA_SIGINFO | SA_RESTART;
+
+        const int signals[] = {SIGILL, SIGTRAP, SIGABRT, SIGBUS, SIGFPE, SIGSEGV};
+        for (unsigned i = 0; i < sizeof signals / sizeof signals[0]; ++i) {
+            int sig = signals[i];
+            assert(sig < NSIG);
+            sigaction(sig, NULL, &old_actions[sig]);
+            sigaction(sig, &new_action, NULL);
+        }
+    }
+}
+
+
+static void (*gUserCallback)(void) = NULL;
+
+static void
+UserSignalHandler(int sig)
+{
+    if (gUserCallback) {
+        gUserCallback();
+    }
+}
+
+void
+SetUserCallback(void (*callback)(void))
+{
+    assert(!gUserCallback);
+    if (!gUserCallback) {
+        gUserCallback = callback;
+
+        struct sigaction new_action;
+        new_action.sa_handler = UserSignalHandler;
+        sigemptyset(&new_action.sa_mask);
+        new_action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &new_action, NULL);
+    }
+}
+
+
+struct Thread {
+    pthread_t handle;
+    void (*function)(void *);
+    void *arg;
+};
+
+static void *
+ThreadRoutine(void *arg)
+{
+    Thread *thread = (Thread *)arg;
+    thread->function(thread->arg);
+    return NULL;
+}
+
+Thread *
+StartThread(void (*function)(void *), void *arg)
+{
+    Thread *thread = new Thread;
+    thread->function = function;
+    thread->arg = arg;
+    if (pthread_create(&thread->handle, NULL, ThreadRoutine, thread) != 0) {
+        delete thread;
+        return NULL;
+    }
+    return thread;
+}
+
+void
+JoinThread(Thread *thread)
+{
+    pthread_join(thread->handle, NULL);
+    delete thread;
+}
+
+void
+Sleep(unsigned long usecs)
+{
+    usleep(usecs);
+}
+
+unsigned
+GetProcessorCount(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (unsigned)count : 1;
+}
+
+unsigned
+GetBacktrace(void **frames, unsigned count)
+{
+#ifdef HAVE_BACKTRACE
+    int n = backtrace(frames, (int)count);
+    return n > 0 ? (unsigned)n : 0;
+#else
+    (void)frames;
+    (void)count;
+    return 0;
+#endif
+}
+
+#if defined(__GLIBC__) && defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+
+/* Bounds of the calling thread's stack, looked up once */
+static __thread char *stack_low = NULL;
+static __thread char *stack_high = NULL;
+
+unsigned
+GetFrameBacktrace(void **frames, unsigned count)
+{
+    if (!stack_high) {
+        pthread_attr_t attr;
+        void *addr;
+        size_t size;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+            return 0;
+        }
+        pthread_attr_getstack(&attr, &addr, &size);
+        pthread_attr_destroy(&attr);
+        stack_low = (char *)addr;
+        stack_high = stack_low + size;
+    }
+
+    /* Each frame starts with the caller's frame pointer and return address */
+    void **fp = (void **)__builtin_frame_address(0);
+    unsigned n = 0;
+    while (n < count &&
+           (char *)fp >= stack_low &&
+           (char *)(fp + 2) <= stack_high &&
+           ((size_t)fp & (sizeof(void *) - 1)) == 0) {
+        void *ret = fp[1];
+        if (!ret) {
+            break;
+        }
+        frames[n++] = ret;
+
+        /* The stack grows down, so anything else is not a frame */
+        void **next = (void **)fp[0];
+        if (next <= fp) {
+            break;
+        }
+        fp = next;
+    }
+    return n;
+}
+
+#else
+
+unsigned
+GetFrameBacktrace(void **frames, unsigned count)
+{
+    return GetBacktrace(frames, count);
+}
+
+#endif
+
+bool
+GetModuleOffset(const void *addr, char *module, size_t size, unsigned long long *offset)
+{
+    Dl_info info;
+    const char *base;
+#ifdef __GLIBC__
+    /*
+     * Use the load bias rather than the load address, so that offsets are
+     * the addresses symbol tables refer to, for executables too.
+     */
+    struct link_map *map = NULL;
+    if (!dladdr1(addr, &info, (void **)&map, RTLD_DL_LINKMAP) || !map) {
+        return false;
+    }
+    base = (const char *)map->l_addr;
+#else
+    if (!dladdr(addr, &info) || !info.dli_fbase) {
+        return false;
+    }
+    base = (const char *)info.dli_fbase;
+#endif
+
+    char path[PATH_MAX + 1];
+    const char *name = info.dli_fname;
+#ifndef __APPLE__
+    if (!name || !name[0]) {
+        /* The executable itself has no name in the link map */
+        ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        if (len == -1) {
+            return false;
+        }
+        path[len] = 0;
+        name = path;
+    } else
+#endif
+    if (realpath(name, path)) {
+        name = path;
+    }
+
+    strncpy(module, name, size);
+    if (size)
+        module[size - 1] = 0;
+
+    *offset = (const char *)addr - base;
+    return true;
+}
+
+
+struct Mutex {
+    pthread_mutex_t mutex;
+};
+
+Mutex *
+NewMutex(void)
+{
+    Mutex *mutex = new Mutex;
+    pthread_mutex_init(&mutex->mutex, NULL);
+    return mutex;
+}
+
+void
+DeleteMutex(Mutex *mutex)
+{
+    pthread_mutex_destroy(&mutex->mutex);
+    delete mutex;
+}
+
+void
+LockMutex(Mutex *mutex)
+{
+    pthread_mutex_lock(&mutex->mutex);
+}
+
+void
+UnlockMutex(Mutex *mutex)
+{
+    pthread_mutex_unlock(&mutex->mutex);
+}
+
+
+struct Condition {
+    pthread_cond_t cond;
+};
+
+Condition *
+NewCondition(void)
+{
+    Condition *cond = new Condition;
+    pthread_cond_init(&cond->cond, NULL);
+    return cond;
+}
+
+void
+DeleteCondition(Condition *cond)
+{
+    pthread_cond_destroy(&cond->cond);
+    delete cond;
+}
+
+void
+WaitCondition(Condition *cond, Mutex *mutex)
+{
+    pthread_cond_wait(&cond->cond, &mutex->mutex);
+}
+
+void
+TimedWaitCondition(Condition *cond, Mutex *mutex, unsigned long long usecs)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    unsigned long long nsecs = (now.tv_usec + usecs % 1000000) * 1000;
+    struct timespec deadline;
+    deadline.tv_sec = now.tv_sec + usecs / 1000000 + nsecs / 1000000000;
+    deadline.tv_nsec = nsecs % 1000000000;
+    pthread_cond_timedwait(&cond->cond, &mutex->mutex, &deadline);
+}
+
+void
+SignalCondition(Condition *cond)
+{
+    pthread_cond_signal(&cond->cond);
+}
+
+void
+BroadcastCondition(Condition *cond)
+{
+    pthread_cond_broadcast(&cond->cond);
+}
+
+
 } /* namespace OS */
 
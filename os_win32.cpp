@@ -24,6 +24,8 @@
  **************************************************************************/
 
 #include <windows.h>
+#include <assert.h>
+#include <limits.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -133,4 +135,226 @@ Abort(void)
 #endif
 }
 
+
+static void (*gCallback)(void) = NULL;
+static LPTOP_LEVEL_EXCEPTION_FILTER gPrevExceptionFilter = NULL;
+
+static LONG WINAPI
+ExceptionFilter(PEXCEPTION_POINTERS pExceptionInfo)
+{
+    if (gCallback) {
+        gCallback();
+    }
+
+    /* Chain to the previous filter */
+    if (gPrevExceptionFilter) {
+        return gPrevExceptionFilter(pExceptionInfo);
+    }
+    return EXCEPTION_CONTINUE_SEARCH;
+}
+
+void
+SetExceptionCallback(void (*callback)(void))
+{
+    assert(!gCallback);
+    if (!gCallback) {
+        gCallback = callback;
+        gPrevExceptionFilter = SetUnhandledExceptionFilter(ExceptionFilter);
+    }
+}
+
+
+void
+SetUserCallback(void (*callback)(void))
+{
+    (void)callback;
+}
+
+
+struct Thread {
+    HANDLE handle;
+    void (*function)(void *);
+    void *arg;
+};
+
+static DWORD WINAPI
+ThreadRoutine(LPVOID lpParameter)
+{
+    Thread *thread = (Thread *)lpParameter;
+    thread->function(thread->arg);
+    return 0;
+}
+
+Thread *
+StartThread(void (*function)(void *), void *arg)
+{
+    Thread *thread = new Thread;
+    thread->function = function;
+    thread->arg = arg;
+    thread->handle = CreateThread(NULL, 0, ThreadRoutine, thread, 0, NULL);
+    if (!thread->handle) {
+        delete thread;
+        return NULL;
+    }
+    return thread;
+}
+
+void
+JoinThread(Thread *thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    delete thread;
+}
+
+void
+Sleep(unsigned long usecs)
+{
+    ::Sleep((usecs + 999) / 1000);
+}
+
+unsigned
+GetProcessorCount(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+}
+
+unsigned
+GetBacktrace(void **frames, unsigned count)
+{
+    return RtlCaptureStackBackTrace(0, count, frames, NULL);
+}
+
+unsigned
+GetFrameBacktrace(void **frames, unsigned count)
+{
+    return GetBacktrace(frames, count);
+}
+
+bool
+GetModuleOffset(const void *addr, char *module, size_t size, unsigned long long *offset)
+{
+    HMODULE hModule;
+    if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                            GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                            (LPCSTR)addr, &hModule)) {
+        return false;
+    }
+
+    if (!GetModuleFileNameA(hModule, module, (DWORD)size)) {
+        return false;
+    }
+    if (size)
+        module[size - 1] = 0;
+
+    *offset = (const char *)addr - (const char *)hModule;
+    return true;
+}
+
+
+struct Mutex {
+    CRITICAL_SECTION section;
+};
+
+Mutex *
+NewMutex(void)
+{
+    Mutex *mutex = new Mutex;
+    InitializeCriticalSection(&mutex->section);
+    return mutex;
+}
+
+void
+DeleteMutex(Mutex *mutex)
+{
+    DeleteCriticalSection(&mutex->section);
+    delete mutex;
+}
+
+void
+LockMutex(Mutex *mutex)
+{
+    EnterCriticalSection(&mutex->section);
+}
+
+void
+UnlockMutex(Mutex *mutex)
+{
+    LeaveCriticalSection(&mutex->section);
+}
+
+
+/*
+ * Condition variables are only available on Vista and later, so emulate
+ * them with a semaphore.  This relies on the associated mutex being held
+ * when signalling.
+ */
+struct Condition {
+    HANDLE semaphore;
+    LONG waiters;
+};
+
+Condition *
+NewCondition(void)
+{
+    Condition *cond = new Condition;
+    cond->semaphore = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    cond->waiters = 0;
+    return cond;
+}
+
+void
+DeleteCondition(Condition *cond)
+{
+    CloseHandle(cond->semaphore);
+    delete cond;
+}
+
+void
+WaitCondition(Condition *cond, Mutex *mutex)
+{
+    ++cond->waiters;
+    UnlockMutex(mutex);
+    WaitForSingleObject(cond->semaphore, INFINITE);
+    LockMutex(mutex);
+}
+
+void
+TimedWaitCondition(Condition *cond, Mutex *mutex, unsigned long long usecs)
+{
+    ++cond->waiters;
+    UnlockMutex(mutex);
+    DWORD result = WaitForSingleObject(cond->semaphore, (DWORD)((usecs + 999) / 1000));
+    LockMutex(mutex);
+    if (result != WAIT_OBJECT_0) {
+        /*
+         * Stop counting as a waiter, unless signalled meanwhile, in which
+         * case the signal is taken here instead.
+         */
+        if (WaitForSingleObject(cond->semaphore, 0) != WAIT_OBJECT_0) {
+            --cond->waiters;
+        }
+    }
+}
+
+void
+SignalCondition(Condition *cond)
+{
+    if (cond->waiters) {
+        --cond->waiters;
+        ReleaseSemaphore(cond->semaphore, 1, NULL);
+    }
+}
+
+void
+BroadcastCondition(Condition *cond)
+{
+    if (cond->waiters) {
+        ReleaseSemaphore(cond->semaphore, cond->waiters, NULL);
+        cond->waiters = 0;
+    }
+}
+
 } /* namespace OS */
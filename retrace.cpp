@@ -35,6 +35,59 @@ namespace retrace {
 int verbosity = 0;
 
 
+struct Region {
+    void *buffer;
+    unsigned long long size;
+};
+
+typedef std::map<unsigned long long, Region> RegionMap;
+static RegionMap regions;
+
+
+void addRegion(unsigned long long address, void *buffer, unsigned long long size) {
+    if (!size) {
+        /* Still keep the start address */
+        size = 1;
+    }
+
+    /* Drop overlapping regions */
+    RegionMap::iterator it = regions.lower_bound(address);
+    if (it != regions.begin()) {
+        RegionMap::iterator prev = it;
+        --prev;
+        if (prev->first + prev->second.size > address) {
+            it = prev;
+        }
+    }
+    while (it != regions.end() && it->first < address + size) {
+        regions.erase(it++);
+    }
+
+    Region region;
+    region.buffer = buffer;
+    region.size = size;
+    regions[address] = region;
+}
+
+
+void *lookupAddress(unsigned long long address) {
+    RegionMap::iterator it = regions.upper_bound(address);
+    if (it == regions.begin()) {
+        return NULL;
+    }
+    --it;
+    if (address - it->first >= it->second.size) {
+        return NULL;
+    }
+    return (char *)it->second.buffer + (address - it->first);
+}
+
+
+void delRegion(unsigned long long address) {
+    regions.erase(address);
+}
+
+
 void retrace_unknown(Trace::Call &call) {
     if (verbosity >= 0) {
         std::cerr << call.no << ": warning: unknown call " << call.name() << "\n";
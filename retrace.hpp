@@ -76,6 +76,23 @@ public:
 };
 
 
+/**
+ * Regions of memory, such as mapped buffers, that recorded addresses may
+ * point into.  A new region replaces any older one it overlaps.
+ */
+void addRegion(unsigned long long address, void *buffer, unsigned long long size);
+
+/**
+ * Translate a recorded address into the current process, or return NULL if it
+ * lies outside of every region.
+ */
+void *lookupAddress(unsigned long long address);
+
+/**
+ * Forget the region starting at the given address, once it is unmapped.
+ */
+void delRegion(unsigned long long address);
+
 /**
  * Output verbosity when retracing files.
  */
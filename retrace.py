@@ -69,12 +69,12 @@ class ValueExtractor(stdapi.Visitor):
     def visit_array(self, array, lvalue, rvalue):
         print '    const Trace::Array *__a%s = dynamic_cast<const Trace::Array *>(&%s);' % (array.id, rvalue)
         print '    if (__a%s) {' % (array.id)
-        length = '__a%s->values.size()' % array.id
+        length = '__a%s->size()' % array.id
         print '        %s = new %s[%s];' % (lvalue, array.type, length)
         index = '__j' + array.id
         print '        for (size_t {i} = 0; {i} < {length}; ++{i}) {{'.format(i = index, length = length)
         try:
-            self.visit(array.type, '%s[%s]' % (lvalue, index), '*__a%s->values[%s]' % (array.id, index))
+            self.visit(array.type, '%s[%s]' % (lvalue, index), '*__a%s->value(%s)' % (array.id, index))
         finally:
             print '        }'
             print '    } else {'
@@ -86,7 +86,7 @@ class ValueExtractor(stdapi.Visitor):
         print '    if (__a%s) {' % (pointer.id)
         print '        %s = new %s;' % (lvalue, pointer.type)
         try:
-            self.visit(pointer.type, '%s[0]' % (lvalue,), '*__a%s->values[0]' % (pointer.id,))
+            self.visit(pointer.type, '%s[0]' % (lvalue,), '*__a%s->value(0)' % (pointer.id,))
         finally:
             print '    } else {'
             print '        %s = NULL;' % lvalue
@@ -134,11 +134,11 @@ class ValueWrapper(stdapi.Visitor):
     def visit_array(self, array, lvalue, rvalue):
         print '    const Trace::Array *__a%s = dynamic_cast<const Trace::Array *>(&%s);' % (array.id, rvalue)
         print '    if (__a%s) {' % (array.id)
-        length = '__a%s->values.size()' % array.id
+        length = '__a%s->size()' % array.id
         index = '__j' + array.id
         print '        for (size_t {i} = 0; {i} < {length}; ++{i}) {{'.format(i = index, length = length)
         try:
-            self.visit(array.type, '%s[%s]' % (lvalue, index), '*__a%s->values[%s]' % (array.id, index))
+            self.visit(array.type, '%s[%s]' % (lvalue, index), '*__a%s->value(%s)' % (array.id, index))
         finally:
             print '        }'
             print '    }'
@@ -147,7 +147,7 @@ class ValueWrapper(stdapi.Visitor):
         print '    const Trace::Array *__a%s = dynamic_cast<const Trace::Array *>(&%s);' % (pointer.id, rvalue)
         print '    if (__a%s) {' % (pointer.id)
         try:
-            self.visit(pointer.type, '%s[0]' % (lvalue,), '*__a%s->values[0]' % (pointer.id,))
+            self.visit(pointer.type, '%s[0]' % (lvalue,), '*__a%s->value(0)' % (pointer.id,))
         finally:
             print '    }'
     
@@ -37,6 +37,11 @@ import shutil
 
 
 def repack(in_name):
+    # Only traces written with TRACE_CODEC=gzip are a single gzip stream
+    if open(in_name, 'rb').read(2) != '\x1f\x8b':
+        print '%s: not a gzip trace, skipping' % in_name
+        return
+
     mtime = os.path.getmtime(in_name)
     out_name = tempfile.mktemp()
 
@@ -34,6 +34,40 @@ def interface_wrap_name(interface):
     return "Wrap" + interface.expr
 
 
+def encode_uint(value):
+    '''Encode an unsigned integer as the trace writer does.'''
+    data = ''
+    while value >= 0x80:
+        data += chr(0x80 | (value & 0x7f))
+        value >>= 7
+    data += chr(value)
+    return data
+
+
+def encode_string(value):
+    return encode_uint(len(value)) + value
+
+
+def encoded_literal(data):
+    '''C string literal and length of pre-encoded trace data.'''
+    literal = ''
+    for c in data:
+        if c.isalnum() or c in '_:':
+            literal += c
+        else:
+            # Octal escapes are never longer than three digits
+            literal += '\\%03o' % ord(c)
+    return '"%s", %u' % (literal, len(data))
+
+
+def encode_call_sig(name, arg_names):
+    data = encode_string(name)
+    data += encode_uint(len(arg_names))
+    for arg_name in arg_names:
+        data += encode_string(arg_name)
+    return encoded_literal(data)
+
+
 class DumpDeclarator(stdapi.OnceVisitor):
     '''Declare helper functions to dump complex types.'''
 
@@ -58,7 +92,8 @@ class DumpDeclarator(stdapi.OnceVisitor):
             print '        "%s",' % (name,)
         print '    };'
         print '    static const Trace::StructSig sig = {'
-        print '       %u, "%s", %u, members' % (int(struct.id), struct.name, len(struct.members))
+        print '       %u, "%s", %u, members,' % (int(struct.id), struct.name, len(struct.members))
+        print '       %s' % encode_call_sig(struct.name, [name for type, name in struct.members])
         print '    };'
         print '    Trace::BeginStruct(&sig);'
         for type, name in struct.members:
@@ -80,7 +115,7 @@ class DumpDeclarator(stdapi.OnceVisitor):
         n = len(enum.values)
         for i in range(n):
             value = enum.values[i]
-            print '    static const Trace::EnumSig sig%u = {%u, "%s", %s};' % (i, DumpDeclarator.__enum_id, value, value)
+            print '    static const Trace::EnumSig sig%u = {%u, "%s", %s, %s};' % (i, DumpDeclarator.__enum_id, value, value, encoded_literal(encode_string(value)))
             DumpDeclarator.__enum_id += 1
         print '    const Trace::EnumSig *sig;'
         print '    switch(value) {'
@@ -136,6 +171,34 @@ class DumpDeclarator(stdapi.OnceVisitor):
         print
 
 
+def scalar_array_type(type):
+    '''Format type of arrays of this element type that can be written in one
+    go, if any.'''
+    while isinstance(type, (stdapi.Const, stdapi.Alias)):
+        type = type.type
+    if isinstance(type, stdapi.Literal):
+        try:
+            return {
+                'SInt': 'TYPE_SINT',
+                'UInt': 'TYPE_UINT',
+                'Float': 'TYPE_FLOAT',
+                'Double': 'TYPE_DOUBLE',
+            }[type.format]
+        except KeyError:
+            pass
+    return None
+
+
+def is_flat_type(type):
+    '''Whether values of this type can be dumped from a copy of the value
+    alone, without following any pointers.'''
+    while isinstance(type, (stdapi.Const, stdapi.Alias, stdapi.Handle)):
+        type = type.type
+    if isinstance(type, stdapi.Literal):
+        return type.format in ('Bool', 'SInt', 'UInt', 'Float', 'Double')
+    return isinstance(type, (stdapi.Enum, stdapi.Bitmask, stdapi.Opaque))
+
+
 class DumpImplementer(stdapi.Visitor):
     '''Dump an instance.'''
 
@@ -155,6 +218,16 @@ class DumpImplementer(stdapi.Visitor):
         print '    __traceStruct%s(%s);' % (struct.id, instance)
 
     def visit_array(self, array, instance):
+        scalar_type = scalar_array_type(array.type)
+        if scalar_type is not None:
+            # Lengths are often signed, and negative ones merely rejected by
+            # the API, so write those as empty arrays
+            print '    {'
+            print '        long long __length = (long long)(%s);' % array.length
+            print '        Trace::LiteralArray(Trace::%s, sizeof (%s)[0], %s, __length > 0 ? (size_t)__length : 0);' % (scalar_type, instance, instance)
+            print '    }'
+            return
+
         print '    if (%s) {' % instance
         index = '__i' + array.type.id
         print '        Trace::BeginArray(%s);' % (array.length,)
@@ -319,9 +392,36 @@ class Tracer:
             print 'static const char * __%s_args[%u] = {%s};' % (function.name, len(function.args), ', '.join(['"%s"' % arg.name for arg in function.args]))
         else:
             print 'static const char ** __%s_args = NULL;' % (function.name,)
-        print 'static const Trace::FunctionSig __%s_sig = {%u, "%s", %u, __%s_args};' % (function.name, int(function.id), function.name, len(function.args), function.name)
+        print 'static const Trace::FunctionSig __%s_sig = {%u, "%s", %u, __%s_args, %s};' % (function.name, int(function.id), function.name, len(function.args), function.name, encode_call_sig(function.name, [arg.name for arg in function.args]))
         print
 
+        if self.defer_function(function):
+            # Copy of the arguments, for the writer thread to dump
+            in_args = [arg for arg in function.args if not arg.output]
+            print 'struct __%s_in_args {' % (function.name,)
+            for arg in in_args:
+                print '    %s %s;' % (arg.type, arg.name)
+            print '};'
+            print
+            print 'static void __%s_dump_args(const void *__raw) {' % (function.name,)
+            print '    const __%s_in_args *__args = (const __%s_in_args *)__raw;' % (function.name, function.name)
+            for arg in in_args:
+                print '    %s %s = __args->%s;' % (arg.type, arg.name, arg.name)
+            for arg in in_args:
+                self.dump_arg(function, arg)
+            print '}'
+            print
+
+    def defer_function(self, function):
+        '''Whether the input arguments can be dumped by the writer thread.'''
+        in_args = [arg for arg in function.args if not arg.output]
+        if not in_args:
+            return False
+        for arg in in_args:
+            if not is_flat_type(arg.type):
+                return False
+        return True
+
     def get_dispatch_function(self, function):
         return '__' + function.name
 
@@ -344,11 +444,32 @@ class Tracer:
         print
 
     def trace_function_impl_body(self, function):
-        print '    unsigned __call = Trace::BeginEnter(__%s_sig);' % (function.name,)
+        print '    static signed char __filtered = -1;'
+        print '    if (__filtered < 0) {'
+        print '        __filtered = Trace::IsFiltered(__%s_sig, %s);' % (function.name, str(function.sideeffects).lower())
+        print '    }'
         for arg in function.args:
             if not arg.output:
                 self.unwrap_arg(function, arg)
-                self.dump_arg(function, arg)
+        print '    if (__filtered) {'
+        self.dispatch_function(function)
+        for arg in function.args:
+            if arg.output:
+                self.wrap_arg(function, arg)
+        print '    } else {'
+        print '    unsigned __call = Trace::BeginEnter(__%s_sig);' % (function.name,)
+        if self.defer_function(function):
+            in_args = [arg for arg in function.args if not arg.output]
+            print '    __%s_in_args __args = {%s};' % (function.name, ', '.join([arg.name for arg in in_args]))
+            print '    if (Trace::defer_args) {'
+            print '        Trace::DeferArgs(&__%s_dump_args, &__args, sizeof __args);' % (function.name,)
+            print '    } else {'
+            print '        __%s_dump_args(&__args);' % (function.name,)
+            print '    }'
+        else:
+            for arg in function.args:
+                if not arg.output:
+                    self.dump_arg(function, arg)
         print '    Trace::EndEnter();'
         self.dispatch_function(function)
         print '    Trace::BeginLeave(__call);'
@@ -359,6 +480,7 @@ class Tracer:
         if function.type is not stdapi.Void:
             self.dump_ret(function, "__result")
         print '    Trace::EndLeave();'
+        print '    }'
 
     def dispatch_function(self, function):
         if function.type is stdapi.Void:
@@ -408,7 +530,7 @@ class Tracer:
     def trace_method(self, interface, method):
         print method.prototype(interface_wrap_name(interface) + '::' + method.name) + ' {'
         print '    static const char * __args[%u] = {%s};' % (len(method.args) + 1, ', '.join(['"this"'] + ['"%s"' % arg.name for arg in method.args]))
-        print '    static const Trace::FunctionSig __sig = {%u, "%s", %u, __args};' % (int(method.id), interface.name + '::' + method.name, len(method.args) + 1)
+        print '    static const Trace::FunctionSig __sig = {%u, "%s", %u, __args, %s};' % (int(method.id), interface.name + '::' + method.name, len(method.args) + 1, encode_call_sig(interface.name + '::' + method.name, ['this'] + [arg.name for arg in method.args]))
         print '    unsigned __call = Trace::BeginEnter(__sig);'
         print '    Trace::BeginArg(0);'
         print '    Trace::LiteralOpaque((const void *)m_pInstance);'
@@ -435,6 +557,8 @@ class Tracer:
             print '    Trace::EndReturn();'
             wrap_instance(method.type, '__result')
         print '    Trace::EndLeave();'
+        if method.name in ('Present', 'PresentEx'):
+            print '    Trace::EndFrame();'
         if method.name == 'QueryInterface':
             print '    if (ppvObj && *ppvObj) {'
             print '        if (*ppvObj == m_pInstance) {'
@@ -0,0 +1,91 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Reference counted memory blocks.
+ */
+
+#ifndef _TRACE_BUFFER_HPP_
+#define _TRACE_BUFFER_HPP_
+
+
+#include <assert.h>
+#include <stddef.h>
+
+
+namespace Trace {
+
+
+/**
+ * Block of memory shared by whoever holds a reference to it, and freed along
+ * with the last one.
+ *
+ * Trace files decompress each chunk into one of these, so that blobs can
+ * refer to their data in place for as long as they need it.  Buffers start
+ * unreferenced.  Not thread safe.
+ */
+class Buffer
+{
+protected:
+    unsigned refs;
+
+    ~Buffer() {
+        delete [] data;
+    }
+
+private:
+    Buffer(const Buffer &);
+    Buffer & operator=(const Buffer &);
+
+public:
+    char *data;
+    size_t size;
+
+    Buffer(size_t _size) : refs(0), data(new char[_size]), size(_size) {}
+
+    inline Buffer *ref(void) {
+        ++refs;
+        return this;
+    }
+
+    inline void unref(void) {
+        assert(refs);
+        if (--refs == 0) {
+            delete this;
+        }
+    }
+
+    /**
+     * Whether anything besides the holder of one reference still uses it.
+     */
+    inline bool shared(void) const {
+        return refs > 1;
+    }
+};
+
+
+} /* namespace Trace */
+
+#endif /* _TRACE_BUFFER_HPP_ */
@@ -0,0 +1,527 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "trace_compressor.hpp"
+#include "trace_lz.hpp"
+
+
+namespace Trace {
+
+
+#define DICTIONARY_SIZE 32768
+
+
+struct CompressorJob {
+    Codec codec;
+    std::vector<char> input;
+    std::vector<char> dictionary;
+    std::vector<char> output;
+    unsigned long crc;
+    bool done;
+};
+
+
+static inline void
+write_uint32(char *buf, unsigned long value) {
+    buf[0] = value & 0xff;
+    buf[1] = (value >> 8) & 0xff;
+    buf[2] = (value >> 16) & 0xff;
+    buf[3] = (value >> 24) & 0xff;
+}
+
+
+/**
+ * Compress a job's input into a container chunk.
+ */
+static void
+compress_chunk(CompressorJob *job) {
+    const char *input = &job->input[0];
+    size_t input_size = job->input.size();
+    unsigned char codec = job->codec;
+    size_t size;
+
+    switch (codec) {
+    case CODEC_ZLIB:
+        {
+            uLongf dest_size = compressBound(input_size);
+            job->output.resize(TRACE_CHUNK_HEADER_SIZE + dest_size);
+            if (compress2((Bytef *)&job->output[TRACE_CHUNK_HEADER_SIZE], &dest_size,
+                          (const Bytef *)input, input_size, Z_DEFAULT_COMPRESSION) == Z_OK) {
+                size = dest_size;
+            } else {
+                size = input_size;
+            }
+        }
+        break;
+    case CODEC_LZ:
+        job->output.resize(TRACE_CHUNK_HEADER_SIZE + lz_compress_bound(input_size));
+        size = lz_compress(input, input_size, &job->output[TRACE_CHUNK_HEADER_SIZE]);
+        break;
+    default:
+        size = input_size;
+        break;
+    }
+
+    /* Store incompressible data as is */
+    if (size >= input_size) {
+        codec = CODEC_STORED;
+        size = input_size;
+        job->output.resize(TRACE_CHUNK_HEADER_SIZE + size);
+        memcpy(&job->output[TRACE_CHUNK_HEADER_SIZE], input, size);
+    }
+
+    job->output.resize(TRACE_CHUNK_HEADER_SIZE + size);
+    job->output[0] = codec;
+    write_uint32(&job->output[1], size);
+    write_uint32(&job->output[5], input_size);
+}
+
+
+/**
+ * Deflate a job's input into a raw deflate fragment ending on a byte
+ * boundary.
+ */
+static void
+compress_gzip(CompressorJob *job, z_stream *stream) {
+    size_t input_size = job->input.size();
+    job->crc = crc32(crc32(0, Z_NULL, 0), (const Bytef *)&job->input[0], input_size);
+
+    deflateReset(stream);
+    if (!job->dictionary.empty()) {
+        deflateSetDictionary(stream, (const Bytef *)&job->dictionary[0], job->dictionary.size());
+    }
+
+    /* Leave room for the sync flush marker */
+    job->output.resize(deflateBound(stream, input_size) + 16);
+    stream->next_in = (Bytef *)&job->input[0];
+    stream->avail_in = input_size;
+    stream->next_out = (Bytef *)&job->output[0];
+    stream->avail_out = job->output.size();
+    for (;;) {
+        deflate(stream, Z_SYNC_FLUSH);
+        if (stream->avail_out) {
+            break;
+        }
+        size_t used = job->output.size();
+        job->output.resize(used * 2);
+        stream->next_out = (Bytef *)&job->output[used];
+        stream->avail_out = job->output.size() - used;
+    }
+    job->output.resize(job->output.size() - stream->avail_out);
+}
+
+
+static void
+init_stream(z_stream *stream) {
+    memset(stream, 0, sizeof *stream);
+    deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+}
+
+
+static void
+compress(CompressorJob *job, z_stream *stream) {
+    if (job->codec == CODEC_GZIP) {
+        compress_gzip(job, stream);
+    } else {
+        compress_chunk(job);
+    }
+}
+
+
+Compressor::Compressor() :
+    file(NULL),
+    codec(CODEC_LZ),
+    mutex(NULL),
+    work_cond(NULL),
+    done_cond(NULL),
+    max_queued(0),
+    writing(false),
+    quit(false),
+    block_size(1024*1024),
+    crc(0),
+    total_size(0),
+    chunk_count(0),
+    file_offset(0),
+    ring(false),
+    ring_count(0)
+{}
+
+
+Compressor::~Compressor() {
+    close();
+}
+
+
+bool Compressor::open(const char *_filename, Codec _codec, bool _ring) {
+    close();
+
+    file = fopen(_filename, "wb");
+    if (!file) {
+        return false;
+    }
+
+    codec = _codec;
+    ring = _ring;
+    filename = _filename;
+    ring_chunks.clear();
+    ring_count = 0;
+    if (ring && codec == CODEC_GZIP) {
+        codec = CODEC_LZ;
+    }
+
+    if (codec == CODEC_GZIP) {
+        static const unsigned char header[10] = {
+            0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3
+        };
+        fwrite(header, sizeof header, 1, file);
+    } else {
+        fwrite(TRACE_FILE_MAGIC, TRACE_FILE_MAGIC_SIZE, 1, file);
+    }
+
+    crc = crc32(0, Z_NULL, 0);
+    total_size = 0;
+    chunk_count = 0;
+    offsets.clear();
+    file_offset = ftell(file);
+    buffer.reserve(block_size);
+    dictionary.clear();
+
+    unsigned num_threads;
+    const char *threads_env = getenv("TRACE_THREADS");
+    if (threads_env) {
+        num_threads = atoi(threads_env);
+    } else {
+        /* Leave some room for the application */
+        num_threads = OS::GetProcessorCount() - 1;
+        if (num_threads > 8) {
+            num_threads = 8;
+        }
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    /* Keep a couple of blocks in flight per thread */
+    max_queued = 2*num_threads + 2;
+
+    mutex = OS::NewMutex();
+    work_cond = OS::NewCondition();
+    done_cond = OS::NewCondition();
+    writing = false;
+    quit = false;
+
+    for (unsigned i = 0; i < num_threads; ++i) {
+        OS::Thread *thread = OS::StartThread(threadFunction, this);
+        if (thread) {
+            threads.push_back(thread);
+        }
+    }
+
+    return true;
+}
+
+
+void Compressor::write(const void *data, size_t size) {
+    const char *src = (const char *)data;
+    buffer.insert(buffer.end(), src, src + size);
+}
+
+
+void Compressor::endEvent(void) {
+    if (buffer.size() >= block_size) {
+        submit();
+    }
+}
+
+
+void Compressor::flush(void) {
+    if (!buffer.empty()) {
+        submit();
+    }
+}
+
+
+void Compressor::submit(void) {
+    if (!file) {
+        buffer.clear();
+        return;
+    }
+
+    ++chunk_count;
+
+    CompressorJob *job = new CompressorJob;
+    job->codec = codec;
+    job->input.swap(buffer);
+    job->crc = 0;
+    job->done = false;
+
+    if (codec == CODEC_GZIP) {
+        job->dictionary = dictionary;
+
+        /* Keep the last 32KB of data as the dictionary for the next block */
+        size_t tail_size = job->input.size();
+        if (tail_size > DICTIONARY_SIZE) {
+            tail_size = DICTIONARY_SIZE;
+        }
+        dictionary.insert(dictionary.end(), job->input.end() - tail_size, job->input.end());
+        if (dictionary.size() > DICTIONARY_SIZE) {
+            dictionary.erase(dictionary.begin(), dictionary.end() - DICTIONARY_SIZE);
+        }
+    }
+
+    buffer.reserve(block_size);
+
+    OS::LockMutex(mutex);
+    while (queued.size() >= max_queued) {
+        OS::WaitCondition(done_cond, mutex);
+    }
+    queued.push_back(job);
+    if (threads.empty()) {
+        /* No thread could be started, so do it here */
+        OS::UnlockMutex(mutex);
+        z_stream stream;
+        init_stream(&stream);
+        compress(job, &stream);
+        deflateEnd(&stream);
+        OS::LockMutex(mutex);
+        job->done = true;
+        writeQueued();
+    } else {
+        pending.push_back(job);
+        OS::SignalCondition(work_cond);
+    }
+    OS::UnlockMutex(mutex);
+}
+
+
+/**
+ * Write out the finished jobs at the front of the queue.  Must be called with
+ * the mutex held.  Only one thread writes at a time, so that the blocks reach
+ * the file in order.
+ */
+void Compressor::writeQueued(void) {
+    while (!writing && !queued.empty() && queued.front()->done) {
+        CompressorJob *job = queued.front();
+        queued.pop_front();
+
+        if (ring) {
+            ring_chunks.push_back(std::make_pair(ring_count++, std::vector<char>()));
+            ring_chunks.back().second.swap(job->output);
+            total_size += job->input.size();
+            delete job;
+            OS::BroadcastCondition(done_cond);
+            continue;
+        }
+
+        writing = true;
+        OS::UnlockMutex(mutex);
+
+        fwrite(&job->output[0], job->output.size(), 1, file);
+        fflush(file);
+        offsets.push_back(file_offset);
+        file_offset += job->output.size();
+        if (codec == CODEC_GZIP) {
+            crc = crc32_combine(crc, job->crc, job->input.size());
+        }
+        total_size += job->input.size();
+        delete job;
+
+        OS::LockMutex(mutex);
+        writing = false;
+        OS::BroadcastCondition(done_cond);
+    }
+}
+
+
+void Compressor::run(void) {
+    z_stream stream;
+    init_stream(&stream);
+
+    OS::LockMutex(mutex);
+    for (;;) {
+        while (pending.empty() && !quit) {
+            OS::WaitCondition(work_cond, mutex);
+        }
+        if (pending.empty()) {
+            break;
+        }
+
+        CompressorJob *job = pending.front();
+        pending.pop_front();
+        OS::UnlockMutex(mutex);
+
+        compress(job, &stream);
+
+        OS::LockMutex(mutex);
+        job->done = true;
+        writeQueued();
+    }
+    OS::UnlockMutex(mutex);
+
+    deflateEnd(&stream);
+}
+
+
+void Compressor::threadFunction(void *arg) {
+    Compressor *compressor = (Compressor *)arg;
+    compressor->run();
+}
+
+
+void Compressor::discard(size_t begin, size_t end) {
+    if (!ring || !file) {
+        return;
+    }
+
+    OS::LockMutex(mutex);
+    std::deque<std::pair<size_t, std::vector<char> > >::iterator it = ring_chunks.begin();
+    while (it != ring_chunks.end()) {
+        if (it->first >= begin && it->first < end) {
+            it = ring_chunks.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    OS::UnlockMutex(mutex);
+}
+
+
+const std::vector<unsigned long long> &Compressor::sync(void) {
+    if (file) {
+        flush();
+
+        OS::LockMutex(mutex);
+        while (!queued.empty() || writing) {
+            OS::WaitCondition(done_cond, mutex);
+        }
+
+        if (ring) {
+            offsets.assign(ring_count, TRACE_FILE_MAGIC_SIZE);
+            file_offset = TRACE_FILE_MAGIC_SIZE;
+            for (size_t i = 0; i < ring_chunks.size(); ++i) {
+                offsets[ring_chunks[i].first] = file_offset;
+                file_offset += ring_chunks[i].second.size();
+            }
+        }
+        OS::UnlockMutex(mutex);
+    }
+    return offsets;
+}
+
+
+void Compressor::writeIndex(const void *data, size_t size) {
+    if (!file || codec == CODEC_GZIP) {
+        return;
+    }
+
+    sync();
+
+    if (ring) {
+        file = freopen(filename.c_str(), "wb", file);
+        if (!file) {
+            return;
+        }
+
+        fwrite(TRACE_FILE_MAGIC, TRACE_FILE_MAGIC_SIZE, 1, file);
+        OS::LockMutex(mutex);
+        for (size_t i = 0; i < ring_chunks.size(); ++i) {
+            const std::vector<char> &chunk = ring_chunks[i].second;
+            fwrite(&chunk[0], chunk.size(), 1, file);
+        }
+        OS::UnlockMutex(mutex);
+    }
+
+    CompressorJob job;
+    job.codec = codec;
+    job.input.assign((const char *)data, (const char *)data + size);
+    compress_chunk(&job);
+    job.output[0] |= CHUNK_INDEX;
+
+    char trailer[TRACE_INDEX_TRAILER_SIZE];
+    write_uint32(trailer, (unsigned long)file_offset);
+    write_uint32(trailer + 4, (unsigned long)(file_offset >> 32));
+    memcpy(trailer + 8, TRACE_INDEX_MAGIC, 4);
+
+    fwrite(&job.output[0], job.output.size(), 1, file);
+    fwrite(trailer, sizeof trailer, 1, file);
+    fflush(file);
+    file_offset += job.output.size() + sizeof trailer;
+}
+
+
+void Compressor::close(void) {
+    if (!mutex) {
+        return;
+    }
+
+    flush();
+
+    OS::LockMutex(mutex);
+    while (!queued.empty()) {
+        OS::WaitCondition(done_cond, mutex);
+    }
+    quit = true;
+    OS::BroadcastCondition(work_cond);
+    OS::UnlockMutex(mutex);
+
+    for (std::vector<OS::Thread *>::iterator it = threads.begin(); it != threads.end(); ++it) {
+        OS::JoinThread(*it);
+    }
+    threads.clear();
+
+    OS::DeleteCondition(done_cond);
+    OS::DeleteCondition(work_cond);
+    OS::DeleteMutex(mutex);
+    done_cond = NULL;
+    work_cond = NULL;
+    mutex = NULL;
+
+    ring_chunks.clear();
+
+    if (!file) {
+        return;
+    }
+
+    if (codec == CODEC_GZIP) {
+        /* Final empty block, and gzip trailer */
+        char trailer[10] = {0x03, 0x00};
+        write_uint32(trailer + 2, crc);
+        write_uint32(trailer + 6, (unsigned long)total_size);
+        fwrite(trailer, sizeof trailer, 1, file);
+    }
+
+    fclose(file);
+    file = NULL;
+}
+
+
+} /* namespace Trace */
@@ -0,0 +1,197 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Parallel trace compression.
+ */
+
+#ifndef _TRACE_COMPRESSOR_HPP_
+#define _TRACE_COMPRESSOR_HPP_
+
+
+#include <stdio.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "os.hpp"
+#include "trace_file.hpp"
+
+
+namespace Trace {
+
+
+struct CompressorJob;
+
+
+/**
+ * Writes a trace file, compressing blocks on a pool of threads.
+ *
+ * Each block becomes a chunk of the container described in trace_file.hpp,
+ * compressed with the chosen codec.
+ *
+ * With CODEC_GZIP the file is instead a single gzip stream, pigz style: each
+ * block is a raw deflate stream primed with the last 32KB of the previous
+ * block as dictionary and terminated with a sync flush, so the
+ * concatenation of all blocks is a single valid deflate stream.
+ *
+ * Either way the blocks are written to the file in order, as soon as they
+ * are done.  Memory usage is bounded: endEvent() blocks while too many blocks
+ * are in flight.
+ *
+ * In ring mode the chunks are instead kept in memory, until discarded, and
+ * the whole file is rewritten from them whenever the index is written.
+ */
+class Compressor
+{
+protected:
+    FILE *file;
+    Codec codec;
+
+    std::vector<OS::Thread *> threads;
+
+    OS::Mutex *mutex;
+    OS::Condition *work_cond;
+    OS::Condition *done_cond;
+
+    /* Jobs waiting for a thread */
+    std::deque<CompressorJob *> pending;
+
+    /* All jobs not yet written, in order */
+    std::deque<CompressorJob *> queued;
+
+    size_t max_queued;
+    bool writing;
+    bool quit;
+
+    /* Block being filled */
+    std::vector<char> buffer;
+    size_t block_size;
+
+    /* Tail of the previous block */
+    std::vector<char> dictionary;
+
+    unsigned long crc;
+    unsigned long long total_size;
+
+    /* Blocks submitted so far */
+    size_t chunk_count;
+
+    /* File offset of every chunk written so far */
+    std::vector<unsigned long long> offsets;
+    unsigned long long file_offset;
+
+    /* Chunks kept in ring mode, by index */
+    bool ring;
+    std::string filename;
+    std::deque<std::pair<size_t, std::vector<char> > > ring_chunks;
+    size_t ring_count;
+
+public:
+    Compressor();
+
+    ~Compressor();
+
+    bool open(const char *filename, Codec codec, bool ring = false);
+
+    void write(const void *data, size_t size);
+
+    /**
+     * Mark the end of an event.  Blocks are only ever cut at event
+     * boundaries, so that each chunk can be decoded on its own.
+     */
+    void endEvent(void);
+
+    /**
+     * Send the current block for compression, without waiting for it.
+     */
+    void flush(void);
+
+    /**
+     * Whether blocks end up as separate chunks, as opposed to a gzip stream.
+     */
+    bool chunked(void) const {
+        return codec != CODEC_GZIP;
+    }
+
+    /**
+     * Data of the block being filled, so far.
+     */
+    const char *blockData(void) const {
+        return &buffer[0];
+    }
+
+    size_t blockSize(void) const {
+        return buffer.size();
+    }
+
+    /**
+     * Index of the block being filled.
+     */
+    size_t currentChunk(void) const {
+        return chunk_count;
+    }
+
+    /**
+     * Forget the chunks from begin up to, but not including, end, in ring
+     * mode.  Chunks still being compressed are forgotten by a later call.
+     */
+    void discard(size_t begin, size_t end);
+
+    /**
+     * Wait for all blocks to be written, returning the file offset of each.
+     *
+     * In ring mode these are the offsets the chunks will have in the file,
+     * with the discarded chunks placed at the first one.
+     */
+    const std::vector<unsigned long long> &sync(void);
+
+    /**
+     * Append the index chunk.  Only meaningful for the chunked container.
+     *
+     * In ring mode this writes out the whole file, with the chunks kept so far.
+     */
+    void writeIndex(const void *data, size_t size);
+
+    /**
+     * Wait for all blocks to be written, and terminate the gzip stream.
+     */
+    void close(void);
+
+protected:
+    void submit(void);
+
+    void writeQueued(void);
+
+    void run(void);
+
+    static void threadFunction(void *arg);
+};
+
+
+} /* namespace Trace */
+
+#endif /* _TRACE_COMPRESSOR_HPP_ */
@@ -0,0 +1,399 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <iostream>
+
+#include <zlib.h>
+
+#include "trace_file.hpp"
+#include "trace_lz.hpp"
+
+
+namespace Trace {
+
+
+bool File::push_previous(void) {
+    if (!max_previous || !chunk_buffer) {
+        return false;
+    }
+    previous.push_front(chunk_buffer);
+    chunk_buffer = NULL;
+    if (previous.size() > max_previous) {
+        previous.back()->unref();
+        previous.pop_back();
+    }
+    return true;
+}
+
+
+void File::forget_previous(void) {
+    for (std::deque<Buffer *>::iterator it = previous.begin(); it != previous.end(); ++it) {
+        (*it)->unref();
+    }
+    previous.clear();
+}
+
+
+size_t File::read_slow(void *buf, size_t size) {
+    char *dst = (char *)buf;
+    size_t total = 0;
+    while (total < size) {
+        if (cur == end && !fill()) {
+            break;
+        }
+        size_t count = end - cur;
+        if (count > size - total) {
+            count = size - total;
+        }
+        memcpy(dst + total, cur, count);
+        cur += count;
+        total += count;
+    }
+    return total;
+}
+
+
+void File::skip_slow(size_t size) {
+    while (size) {
+        if (cur == end && !fill()) {
+            break;
+        }
+        size_t count = end - cur;
+        if (count > size) {
+            count = size;
+        }
+        cur += count;
+        size -= count;
+    }
+}
+
+
+unsigned long long File::read_uint_slow(void) {
+    unsigned long long value = 0;
+    int c;
+    unsigned shift = 0;
+    do {
+        c = read_byte();
+        if (c == -1) {
+            break;
+        }
+        value |= (unsigned long long)(c & 0x7f) << shift;
+        shift += 7;
+    } while(c & 0x80);
+    return value;
+}
+
+
+/**
+ * Legacy gzip stream.
+ */
+class GzipFile : public File
+{
+protected:
+    gzFile file;
+    std::vector<char> buffer;
+
+public:
+    GzipFile(gzFile _file) : file(_file), buffer(256*1024) {}
+
+    ~GzipFile() {
+        gzclose(file);
+    }
+
+protected:
+    bool fill(void) {
+        int count = gzread(file, &buffer[0], buffer.size());
+        if (count <= 0) {
+            return false;
+        }
+        cur = &buffer[0];
+        end = cur + count;
+        return true;
+    }
+};
+
+
+static inline unsigned
+read_uint32(const unsigned char *buf) {
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((unsigned)buf[3] << 24);
+}
+
+
+static inline unsigned long long
+read_uint64(const unsigned char *buf) {
+    return read_uint32(buf) | ((unsigned long long)read_uint32(buf + 4) << 32);
+}
+
+
+static inline int
+seek_file(FILE *file, long long offset, int whence) {
+#ifdef _WIN32
+    return _fseeki64(file, offset, whence);
+#else
+    return fseeko(file, offset, whence);
+#endif
+}
+
+
+static inline long long
+tell_file(FILE *file) {
+#ifdef _WIN32
+    return _ftelli64(file);
+#else
+    return ftello(file);
+#endif
+}
+
+
+/**
+ * Chunked container.
+ */
+class ChunkedFile : public File
+{
+protected:
+    FILE *file;
+    std::vector<char> compressed;
+
+    unsigned long long index;
+    bool reading_index;
+
+public:
+    ChunkedFile(FILE *_file) :
+        file(_file),
+        index(0),
+        reading_index(false)
+    {
+        unsigned char trailer[TRACE_INDEX_TRAILER_SIZE];
+        if (seek_file(file, -TRACE_INDEX_TRAILER_SIZE, SEEK_END) == 0 &&
+            fread(trailer, sizeof trailer, 1, file) == 1 &&
+            memcmp(trailer + 8, TRACE_INDEX_MAGIC, 4) == 0) {
+            index = read_uint64(trailer);
+        }
+        seek_file(file, TRACE_FILE_MAGIC_SIZE, SEEK_SET);
+    }
+
+    ~ChunkedFile() {
+        fclose(file);
+    }
+
+    unsigned long long index_offset(void) {
+        return index;
+    }
+
+    bool seek(unsigned long long offset) {
+        if (seek_file(file, offset, SEEK_SET) != 0) {
+            return false;
+        }
+        reading_index = index && offset == index;
+        cur = end = NULL;
+
+        /* The chunks before are no longer the ones read last */
+        if (chunk_buffer) {
+            chunk_buffer->unref();
+            chunk_buffer = NULL;
+        }
+        forget_previous();
+        return true;
+    }
+
+    bool load_previous(unsigned long long offset) {
+        if (!max_previous) {
+            return false;
+        }
+
+        long long resume = tell_file(file);
+
+        unsigned char header[TRACE_CHUNK_HEADER_SIZE];
+        Buffer *buffer = NULL;
+        bool ok = seek_file(file, offset, SEEK_SET) == 0 &&
+                  fread(header, sizeof header, 1, file) == 1 &&
+                  !(header[0] & CHUNK_INDEX);
+        if (ok) {
+            size_t size = read_uint32(header + 5);
+            buffer = (new Buffer(size))->ref();
+            ok = read_data(header[0], read_uint32(header + 1), buffer->data, size);
+        }
+
+        seek_file(file, resume, SEEK_SET);
+
+        if (!ok) {
+            if (buffer) {
+                buffer->unref();
+            }
+            return false;
+        }
+
+        previous.push_front(buffer);
+        if (previous.size() > max_previous) {
+            previous.back()->unref();
+            previous.pop_back();
+        }
+        return true;
+    }
+
+protected:
+    /**
+     * Read the data of the chunk whose header was just read, into size
+     * bytes at data.
+     */
+    bool read_data(unsigned codec, size_t compressed_size, char *data, size_t size) {
+        if (codec == CODEC_STORED) {
+            /* Read straight into place */
+            if (compressed_size != size) {
+                std::cerr << "error: failed to decompress trace chunk\n";
+                return false;
+            }
+            if (size && fread(data, size, 1, file) != 1) {
+                std::cerr << "warning: truncated trace chunk\n";
+                return false;
+            }
+            return true;
+        }
+
+        if (compressed.size() < compressed_size) {
+            compressed.resize(compressed_size);
+        }
+
+        if (compressed_size &&
+            fread(&compressed[0], compressed_size, 1, file) != 1) {
+            std::cerr << "warning: truncated trace chunk\n";
+            return false;
+        }
+
+        bool ok;
+        switch (codec) {
+        case CODEC_ZLIB:
+            {
+                uLongf dest_size = size;
+                ok = uncompress((Bytef *)data, &dest_size,
+                                (const Bytef *)&compressed[0], compressed_size) == Z_OK &&
+                     dest_size == size;
+            }
+            break;
+        case CODEC_LZ:
+            ok = lz_decompress(&compressed[0], compressed_size, data, size);
+            break;
+        default:
+            std::cerr << "error: unknown trace chunk codec " << codec << "\n";
+            ok = false;
+            break;
+        }
+
+        if (!ok) {
+            std::cerr << "error: failed to decompress trace chunk\n";
+        }
+        return ok;
+    }
+
+    bool fill(void) {
+        long long start = tell_file(file);
+
+        unsigned char header[TRACE_CHUNK_HEADER_SIZE];
+        if (fread(header, sizeof header, 1, file) != 1) {
+            return false;
+        }
+
+        unsigned codec = header[0];
+        if (codec & CHUNK_INDEX) {
+            if (!reading_index) {
+                /* End of the events; stay put */
+                seek_file(file, -TRACE_CHUNK_HEADER_SIZE, SEEK_CUR);
+                return false;
+            }
+            codec &= ~CHUNK_INDEX;
+        }
+        size_t compressed_size = read_uint32(header + 1);
+        size_t size = read_uint32(header + 5);
+
+        if (!size) {
+            if (compressed_size && seek_file(file, compressed_size, SEEK_CUR) != 0) {
+                return false;
+            }
+            return fill();
+        }
+
+        /*
+         * Decompress into a new buffer if the previous one is kept, or blobs
+         * still refer to it, and leave that to them.
+         */
+        if (chunk_buffer && !push_previous() &&
+            (chunk_buffer->shared() || chunk_buffer->size < size)) {
+            chunk_buffer->unref();
+            chunk_buffer = NULL;
+        }
+        if (!chunk_buffer) {
+            chunk_buffer = (new Buffer(size))->ref();
+        }
+        char *data = chunk_buffer->data;
+
+        if (!read_data(codec, compressed_size, data, size)) {
+            return false;
+        }
+
+        cur = data;
+        end = cur + size;
+        chunk_start = start;
+        chunk_data = data;
+        ++chunks;
+        return true;
+    }
+};
+
+
+File *File::open(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    unsigned char magic[TRACE_FILE_MAGIC_SIZE];
+    size_t count = fread(magic, 1, sizeof magic, file);
+
+    if (count == sizeof magic &&
+        memcmp(magic, TRACE_FILE_MAGIC, TRACE_FILE_MAGIC_SIZE) == 0) {
+        return new ChunkedFile(file);
+    }
+
+    fclose(file);
+
+    if (count >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        gzFile gzfile = gzopen(filename, "rb");
+        if (gzfile) {
+            return new GzipFile(gzfile);
+        }
+        return NULL;
+    }
+
+    std::cerr << "error: " << filename << " is not a trace file\n";
+    return NULL;
+}
+
+
+} /* namespace Trace */
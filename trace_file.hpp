@@ -0,0 +1,299 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Trace file container.
+ *
+ * Traces are written as a sequence of independently compressed chunks:
+ *
+ *   file = MAGIC chunk* ( index_chunk index_offset INDEX_MAGIC )?
+ *
+ *   chunk = codec compressed_size uncompressed_size BYTE*
+ *
+ * where codec is a byte, and the sizes are little endian 32bit integers.
+ * Chunks always hold whole events.  The first chunk holds nothing but the
+ * format version.
+ *
+ * Complete traces end with an index, so that readers can start anywhere.  The
+ * index chunk has the CHUNK_INDEX flag set in its codec, and is followed by
+ * its own offset as a little endian 64bit integer.  Its contents use the
+ * encoding of trace_format.hpp:
+ *
+ *   index = count (chunk_offset first_call first_frame blob_distance)*
+ *           first_frame count first_call*
+ *           count (kind id chunk_offset signature)*
+ *
+ * listing, in order:
+ *
+ * - every chunk, with the number of the first call entered in it, the frame
+ *   current at its start, and how many chunks back its blob references reach
+ *   at most (zero if it has none);
+ *
+ * - the first call of every frame from the given one on;
+ *
+ * - the definition of every signature, with the chunk where it first appears
+ *   in the event stream.
+ *
+ * Flight recorder traces leave out the chunks between the first frame and the
+ * last ones, so call numbers may jump from one chunk to the next.
+ *
+ * Older traces are a single gzip stream instead, which is still supported
+ * for reading, and writing.
+ */
+
+#ifndef _TRACE_FILE_HPP_
+#define _TRACE_FILE_HPP_
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include <deque>
+#include <vector>
+
+#include "trace_buffer.hpp"
+
+
+namespace Trace {
+
+
+#define TRACE_FILE_MAGIC "\x7f" "apt"
+#define TRACE_FILE_MAGIC_SIZE 4
+
+#define TRACE_CHUNK_HEADER_SIZE 9
+
+#define TRACE_INDEX_MAGIC "\x7f" "apx"
+#define TRACE_INDEX_TRAILER_SIZE 12
+
+#define CHUNK_INDEX 0x80
+
+
+enum Codec {
+    CODEC_STORED = 0,
+    CODEC_ZLIB,
+    CODEC_LZ,
+
+    /* Not a chunk codec: a single gzip stream, as written by older versions */
+    CODEC_GZIP = 0xff
+};
+
+
+/**
+ * Buffered trace file reader.
+ */
+class File
+{
+protected:
+    const char *cur;
+    const char *end;
+
+    /* Number of chunks read so far */
+    unsigned chunks;
+
+    /* What cur and end point into, when its data can be kept */
+    Buffer *chunk_buffer;
+
+    /* Offset of the current chunk in the file, and start of its data */
+    unsigned long long chunk_start;
+    const char *chunk_data;
+
+    /* Buffers of the chunks before the current one, most recent first */
+    std::deque<Buffer *> previous;
+    size_t max_previous;
+
+    File() : cur(NULL), end(NULL), chunks(0), chunk_buffer(NULL), chunk_start(0), chunk_data(NULL), max_previous(0) {}
+
+public:
+    /**
+     * Open a trace file, detecting its format.
+     */
+    static File *open(const char *filename);
+
+    virtual ~File() {
+        if (chunk_buffer) {
+            chunk_buffer->unref();
+        }
+        forget_previous();
+    }
+
+    inline int read_byte(void) {
+        if (cur == end && !fill()) {
+            return -1;
+        }
+        return (unsigned char)*cur++;
+    }
+
+    /**
+     * Next byte, without consuming it.
+     */
+    inline int peek_byte(void) {
+        if (cur == end && !fill()) {
+            return -1;
+        }
+        return (unsigned char)*cur;
+    }
+
+    inline size_t read(void *buf, size_t size) {
+        if (size <= (size_t)(end - cur)) {
+            memcpy(buf, cur, size);
+            cur += size;
+            return size;
+        }
+        return read_slow(buf, size);
+    }
+
+    inline void skip(size_t size) {
+        if (size <= (size_t)(end - cur)) {
+            cur += size;
+        } else {
+            skip_slow(size);
+        }
+    }
+
+    /**
+     * Consume the next size bytes in place, if they are all in the buffer,
+     * returning NULL otherwise.  They are only valid until the next read.
+     */
+    inline const char *take(size_t size) {
+        if (size <= (size_t)(end - cur)) {
+            const char *data = cur;
+            cur += size;
+            return data;
+        }
+        return NULL;
+    }
+
+    /**
+     * Decode an unsigned integer (see trace_format.hpp), straight from the
+     * buffer unless it may straddle the end of it.
+     */
+    inline unsigned long long read_uint(void) {
+        if (end - cur < 10) {
+            return read_uint_slow();
+        }
+        const unsigned char *p = (const unsigned char *)cur;
+        unsigned long long value = *p & 0x7f;
+        unsigned shift = 7;
+        while (shift < 64 && (*p++ & 0x80)) {
+            value |= (unsigned long long)(*p & 0x7f) << shift;
+            shift += 7;
+        }
+        cur = (const char *)p;
+        return value;
+    }
+
+    /**
+     * Buffer holding the current chunk, which whatever was just taken from
+     * it can be kept alive with, or NULL if the data will be overwritten.
+     */
+    inline Buffer *buffer(void) const {
+        return chunk_buffer;
+    }
+
+    /**
+     * Keep the buffers of up to count chunks before the current one, which
+     * blobs may refer back to.
+     */
+    inline void keep_previous(size_t count) {
+        max_previous = count;
+    }
+
+    /**
+     * Buffer of the chunk the given number of chunks before the current one,
+     * or NULL if it was not kept.
+     */
+    inline Buffer *previous_buffer(size_t distance) const {
+        if (distance < 1 || distance > previous.size()) {
+            return NULL;
+        }
+        return previous[distance - 1];
+    }
+
+    /**
+     * Read the chunk at the given offset as the latest one before the next
+     * chunk, after seeking, so that blobs can refer back to it.
+     */
+    virtual bool load_previous(unsigned long long offset) {
+        return false;
+    }
+
+    /**
+     * Number of the chunk being read, for telling chunks apart.
+     */
+    inline unsigned chunk(void) const {
+        return chunks;
+    }
+
+    /**
+     * Offset of the current chunk, which seek() can return to, and how far
+     * into its uncompressed data reading is.  Both are zero for gzip files.
+     */
+    inline unsigned long long chunk_offset(void) const {
+        return chunk_start;
+    }
+
+    inline size_t chunk_position(void) const {
+        return chunk_data ? cur - chunk_data : 0;
+    }
+
+    /**
+     * Offset of the index chunk, or zero if the file has none.
+     */
+    virtual unsigned long long index_offset(void) {
+        return 0;
+    }
+
+    /**
+     * Continue reading from the chunk at the given offset.
+     */
+    virtual bool seek(unsigned long long offset) {
+        return false;
+    }
+
+protected:
+    /**
+     * Make the current buffer the latest previous one, if they are kept,
+     * returning whether it was.
+     */
+    bool push_previous(void);
+
+    void forget_previous(void);
+
+    size_t read_slow(void *buf, size_t size);
+
+    void skip_slow(size_t size);
+
+    unsigned long long read_uint_slow(void);
+
+    /**
+     * Refill the buffer, returning false at the end of file.
+     */
+    virtual bool fill(void) = 0;
+};
+
+
+} /* namespace Trace */
+
+#endif /* _TRACE_FILE_HPP_ */
@@ -37,6 +37,9 @@
  *
  *   call_detail = ARG index value
  *               | RET value
+ *               | THREAD thread_id
+ *               | TIME time_delta
+ *               | BACKTRACE backtrace_sig
  *               | END
  *
  *   value = NULL
@@ -48,9 +51,12 @@
  *         | DOUBLE double
  *         | STRING string
  *         | BLOB string
+ *         | BLOB_REF chunk_distance offset
+ *         | BLOB_OFFSET int value
  *         | ENUM enum_sig
  *         | BITMASK bitmask_sig value
  *         | ARRAY length value+
+ *         | SCALAR_ARRAY type size length (BYTE)*
  *         | STRUCT struct_sig value+
  *         | OPAQUE int
  *
@@ -63,16 +69,48 @@
  *   bitmask_sig = id count (name value)+
  *               | id
  *
+ *   backtrace_sig = id count (module offset)*
+ *                 | id
+ *
  *   string = length (BYTE)*
  *
+ * BLOB_REF repeats a blob of at least BLOB_REF_MIN_SIZE bytes written before,
+ * instead of writing the same bytes again.  It gives the chunk of the file
+ * (see trace_file.hpp) the BLOB was written in, as the number of chunks before
+ * the current one, up to BLOB_REF_MAX_DISTANCE, and the offset of the BLOB
+ * within the uncompressed data of that chunk.
+ *
+ * BLOB_OFFSET is followed by a BLOB or BLOB_REF holding only the part of an
+ * array starting the given number of bytes in, e.g., the vertices actually
+ * used by a draw call.  Its pointer refers to where the array would start.
+ *
+ * SCALAR_ARRAY holds length numbers of size bytes each, stored little endian,
+ * where type is SINT, UINT, FLOAT or DOUBLE.
+ *
+ * When timing is enabled, the enter event of a call records the time right
+ * before the call is dispatched, and the leave event the time right after it
+ * returns, both in nanoseconds since tracing started.  Each time is given as
+ * the difference to the previous time in the file, or in the chunk, with the
+ * sign in the lowest bit.
+ *
+ * When backtraces are enabled, the enter event of a call also records where
+ * it was made from, as a signature like any other, so that each call stack is
+ * only written once.  Frames are given innermost first, as a module path and
+ * an offset into it, to be symbolized offline.
+ *
  */
 
 #ifndef _TRACE_FORMAT_HPP_
 #define _TRACE_FORMAT_HPP_
 
+#include <stddef.h>
+
 namespace Trace {
 
-#define TRACE_VERSION 1
+#define TRACE_VERSION 7
+
+#define BLOB_REF_MIN_SIZE 256
+#define BLOB_REF_MAX_DISTANCE 8
 
 enum Event {
     EVENT_ENTER = 0,
@@ -84,6 +122,8 @@ enum CallDetail {
     CALL_ARG,
     CALL_RET,
     CALL_THREAD,
+    CALL_TIME,
+    CALL_BACKTRACE,
 };
 
 enum Type {
@@ -101,8 +141,46 @@ enum Type {
     TYPE_ARRAY,
     TYPE_STRUCT,
     TYPE_OPAQUE,
+    TYPE_BLOB_REF,
+    TYPE_BLOB_OFFSET,
+    TYPE_SCALAR_ARRAY,
 };
 
+/*
+ * Kinds of signatures, as listed in the index of chunked traces (see
+ * trace_file.hpp).
+ */
+enum SigKind {
+    SIG_FUNCTION = 0,
+    SIG_STRUCT,
+    SIG_ENUM,
+    SIG_BITMASK,
+    SIG_BACKTRACE,
+    SIG_KIND_COUNT
+};
+
+
+static inline bool
+HostIsBigEndian(void) {
+    const unsigned one = 1;
+    return *(const unsigned char *)&one == 0;
+}
+
+/**
+ * Copy count numbers of size bytes each, reversing the bytes of every one,
+ * to convert scalar arrays between big and little endian.
+ */
+static inline void
+SwapScalars(char *dst, const char *src, size_t size, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t j = 0; j < size; ++j) {
+            dst[j] = src[size - 1 - j];
+        }
+        dst += size;
+        src += size;
+    }
+}
+
 
 } /* namespace Trace */
 
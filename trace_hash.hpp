@@ -0,0 +1,149 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Fast non-cryptographic hashing of trace data.
+ */
+
+#ifndef _TRACE_HASH_HPP_
+#define _TRACE_HASH_HPP_
+
+
+#include <stddef.h>
+#include <string.h>
+
+
+namespace Trace {
+
+
+#define HASH_PRIME1 11400714785074694791ULL
+#define HASH_PRIME2 14029467366897019727ULL
+#define HASH_PRIME3  1609587929392839161ULL
+#define HASH_PRIME4  9650029242287828579ULL
+#define HASH_PRIME5  2870177450012600261ULL
+
+
+static inline unsigned long long
+hash_rotl(unsigned long long x, unsigned r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline unsigned long long
+hash_read64(const unsigned char *p) {
+    unsigned long long value;
+    memcpy(&value, p, sizeof value);
+    return value;
+}
+
+static inline unsigned
+hash_read32(const unsigned char *p) {
+    unsigned value;
+    memcpy(&value, p, sizeof value);
+    return value;
+}
+
+static inline unsigned long long
+hash_round(unsigned long long acc, unsigned long long input) {
+    acc += input * HASH_PRIME2;
+    acc = hash_rotl(acc, 31);
+    return acc * HASH_PRIME1;
+}
+
+static inline unsigned long long
+hash_merge(unsigned long long acc, unsigned long long value) {
+    acc ^= hash_round(0, value);
+    return acc * HASH_PRIME1 + HASH_PRIME4;
+}
+
+
+/**
+ * 64bit hash of a block of memory, following the xxHash64 algorithm.
+ *
+ * The bulk of the data goes through four independent lanes, which keeps the
+ * multipliers busy and lets compilers vectorize the loop.  Results are only
+ * meaningful within a process, as the data is read in native byte order.
+ */
+static inline unsigned long long
+hash64(const void *data, size_t size, unsigned long long seed = 0) {
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + size;
+    unsigned long long h;
+
+    if (size >= 32) {
+        const unsigned char *limit = end - 32;
+        unsigned long long v1 = seed + HASH_PRIME1 + HASH_PRIME2;
+        unsigned long long v2 = seed + HASH_PRIME2;
+        unsigned long long v3 = seed;
+        unsigned long long v4 = seed - HASH_PRIME1;
+        do {
+            v1 = hash_round(v1, hash_read64(p));
+            v2 = hash_round(v2, hash_read64(p + 8));
+            v3 = hash_round(v3, hash_read64(p + 16));
+            v4 = hash_round(v4, hash_read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = hash_rotl(v1, 1) + hash_rotl(v2, 7) + hash_rotl(v3, 12) + hash_rotl(v4, 18);
+        h = hash_merge(h, v1);
+        h = hash_merge(h, v2);
+        h = hash_merge(h, v3);
+        h = hash_merge(h, v4);
+    } else {
+        h = seed + HASH_PRIME5;
+    }
+
+    h += size;
+
+    while (p + 8 <= end) {
+        h ^= hash_round(0, hash_read64(p));
+        h = hash_rotl(h, 27) * HASH_PRIME1 + HASH_PRIME4;
+        p += 8;
+    }
+
+    if (p + 4 <= end) {
+        h ^= hash_read32(p) * HASH_PRIME1;
+        h = hash_rotl(h, 23) * HASH_PRIME2 + HASH_PRIME3;
+        p += 4;
+    }
+
+    while (p < end) {
+        h ^= *p * HASH_PRIME5;
+        h = hash_rotl(h, 11) * HASH_PRIME1;
+        ++p;
+    }
+
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+
+} /* namespace Trace */
+
+#endif /* _TRACE_HASH_HPP_ */
@@ -0,0 +1,249 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <string.h>
+
+#include "trace_lz.hpp"
+
+
+namespace Trace {
+
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+
+/* Last 5 bytes are always literals, and the last match must start at least
+ * 12 bytes before the end, as in LZ4 */
+#define LAST_LITERALS 5
+#define MF_LIMIT 12
+
+#define HASH_LOG 14
+#define HASH_SIZE (1 << HASH_LOG)
+
+
+static inline unsigned
+read32(const unsigned char *p) {
+    unsigned value;
+    memcpy(&value, p, sizeof value);
+    return value;
+}
+
+
+static inline unsigned
+hash32(unsigned value) {
+    return (value * 2654435761U) >> (32 - HASH_LOG);
+}
+
+
+static inline unsigned char *
+write_length(unsigned char *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+
+static inline unsigned char *
+write_sequence(unsigned char *op,
+               const unsigned char *literals, size_t literal_length,
+               size_t offset, size_t match_length)
+{
+    unsigned char *token = op++;
+
+    if (literal_length >= 15) {
+        *token = 15 << 4;
+        op = write_length(op, literal_length - 15);
+    } else {
+        *token = (unsigned char)(literal_length << 4);
+    }
+
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (offset) {
+        *op++ = offset & 0xff;
+        *op++ = (offset >> 8) & 0xff;
+
+        match_length -= MIN_MATCH;
+        if (match_length >= 15) {
+            *token |= 15;
+            op = write_length(op, match_length - 15);
+        } else {
+            *token |= (unsigned char)match_length;
+        }
+    }
+
+    return op;
+}
+
+
+size_t
+lz_compress(const void *src, size_t size, void *dst) {
+    const unsigned char *base = (const unsigned char *)src;
+    const unsigned char *ip = base;
+    const unsigned char *anchor = base;
+    const unsigned char *iend = base + size;
+    unsigned char *op = (unsigned char *)dst;
+
+    if (size > MF_LIMIT) {
+        const unsigned char *mflimit = iend - MF_LIMIT;
+        const unsigned char *matchlimit = iend - LAST_LITERALS;
+
+        unsigned table[HASH_SIZE];
+        memset(table, 0, sizeof table);
+
+        ++ip;
+        unsigned misses = 0;
+        while (ip < mflimit) {
+            unsigned sequence = read32(ip);
+            unsigned h = hash32(sequence);
+            const unsigned char *ref = base + table[h];
+            table[h] = (unsigned)(ip - base);
+
+            if (ref >= ip ||
+                ip - ref > MAX_OFFSET ||
+                read32(ref) != sequence) {
+                /* Skip faster over incompressible data */
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            /* Extend the match backwards */
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+
+            /* And forwards */
+            const unsigned char *match_end = ip + MIN_MATCH;
+            ref += MIN_MATCH;
+            while (match_end < matchlimit && *match_end == *ref) {
+                ++match_end;
+                ++ref;
+            }
+
+            size_t match_length = match_end - ip;
+            size_t offset = match_end - ref;
+            op = write_sequence(op, anchor, ip - anchor, offset, match_length);
+
+            ip = match_end;
+            anchor = ip;
+
+            if (ip < mflimit) {
+                table[hash32(read32(ip - 2))] = (unsigned)(ip - 2 - base);
+            }
+        }
+    }
+
+    /* Last literals */
+    op = write_sequence(op, anchor, iend - anchor, 0, 0);
+
+    return op - (unsigned char *)dst;
+}
+
+
+bool
+lz_decompress(const void *src, size_t src_size, void *dst, size_t dst_size) {
+    const unsigned char *ip = (const unsigned char *)src;
+    const unsigned char *iend = ip + src_size;
+    unsigned char *op = (unsigned char *)dst;
+    unsigned char *oend = op + dst_size;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15) {
+            unsigned char c;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                c = *ip++;
+                literal_length += c;
+            } while (c == 255);
+        }
+
+        if (literal_length > (size_t)(iend - ip) ||
+            literal_length > (size_t)(oend - op)) {
+            return false;
+        }
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        if (ip >= iend) {
+            /* Last sequence has no match */
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (unsigned char *)dst)) {
+            return false;
+        }
+
+        size_t match_length = token & 15;
+        if (match_length == 15) {
+            unsigned char c;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                c = *ip++;
+                match_length += c;
+            } while (c == 255);
+        }
+        match_length += MIN_MATCH;
+
+        if (match_length > (size_t)(oend - op)) {
+            return false;
+        }
+
+        const unsigned char *match = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, match, match_length);
+            op += match_length;
+        } else {
+            /* Overlapping copy, e.g., runs */
+            while (match_length--) {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return op == oend;
+}
+
+
+} /* namespace Trace */
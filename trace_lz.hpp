@@ -0,0 +1,66 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Simple and very fast LZ77 compression, using LZ4's block format.
+ */
+
+#ifndef _TRACE_LZ_HPP_
+#define _TRACE_LZ_HPP_
+
+
+#include <stddef.h>
+
+
+namespace Trace {
+
+
+/**
+ * Worst case size of the compressed data.
+ */
+inline size_t
+lz_compress_bound(size_t size) {
+    return size + size/255 + 16;
+}
+
+
+/**
+ * Compress size bytes from src into dst, which must have room for
+ * lz_compress_bound(size) bytes.  Returns the compressed size.
+ */
+size_t
+lz_compress(const void *src, size_t size, void *dst);
+
+
+/**
+ * Decompress exactly dst_size bytes.  Returns false if the data is corrupt.
+ */
+bool
+lz_decompress(const void *src, size_t src_size, void *dst, size_t dst_size);
+
+
+} /* namespace Trace */
+
+#endif /* _TRACE_LZ_HPP_ */
@@ -31,6 +31,35 @@
 namespace Trace {
 
 
+void Arena::grow(size_t size) {
+    /* Blocks double in size, so that large calls need few of them */
+    block_size = block_size ? block_size * 2 : first_block_size;
+    while (block_size < size + 16) {
+        block_size *= 2;
+    }
+
+    Block *block = (Block *)::operator new(block_size);
+    block->next = blocks;
+    blocks = block;
+
+    /* Keep allocations 16 byte aligned past the header */
+    cur = (char *)block + 16;
+    end = (char *)block + block_size;
+}
+
+
+void Arena::clear(void) {
+    while (blocks) {
+        Block *next = blocks->next;
+        ::operator delete(blocks);
+        blocks = next;
+    }
+    cur = NULL;
+    end = NULL;
+    block_size = 0;
+}
+
+
 Call::~Call() {
     for (unsigned i = 0; i < args.size(); ++i) {
         delete args[i];
@@ -56,9 +85,7 @@ Array::~Array() {
 }
 
 Blob::~Blob() {
-    // TODO: Don't leak blobs.  Blobs are often bound and accessed during many
-    // calls, so we can't delete them here.
-    //delete [] buf;
+    buffer->unref();
 }
 
 
@@ -119,7 +146,7 @@ double Enum   ::toDouble(void) const { return sig->second->toDouble(); }
 // pointer cast
 void * Value  ::toPointer(void) const { assert(0); return NULL; }
 void * Null   ::toPointer(void) const { return NULL; }
-void * Blob   ::toPointer(void) const { return buf; }
+void * Blob   ::toPointer(void) const { return buf - offset; }
 void * Pointer::toPointer(void) const { return (void *)value; }
 
 
@@ -288,16 +315,17 @@ public:
     }
 
     void visit(Array *array) {
-        if (array->values.size() == 1) {
+        size_t size = array->size();
+        if (size == 1) {
             os << "&";
-            _visit(array->values[0]);
+            _visit(array->value(0));
         }
         else {
             const char *sep = "";
             os << "{";
-            for (std::vector<Value *>::iterator it = array->values.begin(); it != array->values.end(); ++it) {
+            for (size_t i = 0; i < size; ++i) {
                 os << sep;
-                _visit(*it);
+                _visit(array->value(i));
                 sep = ", ";
             }
             os << "}";
@@ -356,8 +384,8 @@ static Null null;
 const Value & Value::operator[](size_t index) const {
     const Array *array = dynamic_cast<const Array *>(unwrap(this));
     if (array) {
-        if (index < array->values.size()) {
-            return *array->values[index];
+        if (index < array->size()) {
+            return *array->value(index);
         }
     }
     return null;
@@ -32,6 +32,8 @@
 
 
 #include <assert.h>
+#include <stddef.h>
+#include <string.h>
 
 #include <string>
 #include <map>
@@ -39,6 +41,8 @@
 #include <vector>
 #include <iostream>
 
+#include "trace_buffer.hpp"
+
 
 namespace Trace {
 
@@ -48,9 +52,64 @@ class Dumper;
 class UInt;
 
 
+/*
+ * Bump allocator, releasing everything allocated from it at once.
+ */
+class Arena
+{
+protected:
+    struct Block {
+        Block *next;
+    };
+
+    Block *blocks;
+    char *cur;
+    char *end;
+    size_t block_size;
+    size_t first_block_size;
+
+    void grow(size_t size);
+
+private:
+    Arena(const Arena &);
+    Arena & operator=(const Arena &);
+
+public:
+    /*
+     * The first block holds first_size bytes, including its header, so that
+     * arenas known to hold little don't take more.
+     */
+    Arena(size_t first_size = 1024) : blocks(NULL), cur(NULL), end(NULL), block_size(0), first_block_size(first_size) {}
+    ~Arena() { clear(); }
+
+    inline void *allocate(size_t size) {
+        size = (size + 15) & ~(size_t)15;
+        if (size > (size_t)(end - cur)) {
+            grow(size);
+        }
+        void *ptr = cur;
+        cur += size;
+        return ptr;
+    }
+
+    void clear(void);
+};
+
+
 class Value
 {
 public:
+    /*
+     * Values are always allocated from an arena, typically the one of their
+     * call.  Deleting them only runs their destructor; the memory goes back
+     * with the arena.
+     */
+    static inline void *operator new(size_t size, Arena *arena) {
+        return arena->allocate(size);
+    }
+    static inline void operator delete(void *, Arena *) {}
+    static inline void operator delete(void *) {}
+
     virtual ~Value() {}
     virtual void visit(Visitor &visitor) = 0;
 
@@ -232,18 +291,86 @@ public:
     bool toBool(void) const;
     void visit(Visitor &visitor);
 
+    /*
+     * Use these rather than values, which is left empty by arrays that
+     * build their elements on demand.
+     */
+    virtual size_t size(void) const { return values.size(); }
+    virtual Value *value(size_t index) const { return values[index]; }
+
     std::vector<Value *> values;
 };
 
 
-class Blob : public Value
+/*
+ * Array of numbers decoded at once.  The elements are kept in a single block
+ * of T, and values of type V are only built for the ones asked for, e.g.,
+ * when visiting the array.
+ */
+template <class T, class V>
+class ScalarArray : public Array
 {
 public:
-    Blob(size_t _size) {
-        size = _size;
-        buf = new char[_size];
+    ScalarArray(Arena *_arena, const char *data, size_t len) :
+        Array(0),
+        arena(_arena),
+        length(len),
+        built(NULL)
+    {
+        elements = (T *)arena->allocate(len * sizeof(T));
+        if (len) {
+            memcpy(elements, data, len * sizeof(T));
+        }
     }
 
+    ~ScalarArray() {
+        if (built) {
+            for (size_t i = 0; i < length; ++i) {
+                delete built[i];
+            }
+        }
+    }
+
+    const T *data(void) const {
+        return elements;
+    }
+
+    size_t size(void) const {
+        return length;
+    }
+
+    Value *value(size_t index) const {
+        if (!built) {
+            built = (Value **)arena->allocate(length * sizeof *built);
+            memset(built, 0, length * sizeof *built);
+        }
+        if (!built[index]) {
+            built[index] = new (arena) V(elements[index]);
+        }
+        return built[index];
+    }
+
+protected:
+    /* Where the elements and the values built from them are allocated */
+    Arena *arena;
+
+    size_t length;
+    T *elements;
+    mutable Value **built;
+};
+
+
+class Blob : public Value
+{
+public:
+    /* View of the size bytes at buf, within buffer */
+    Blob(Buffer *_buffer, char *_buf, size_t _size) :
+        size(_size),
+        buf(_buf),
+        offset(0),
+        buffer(_buffer->ref())
+    {}
+
     ~Blob();
 
     bool toBool(void) const;
@@ -252,6 +379,15 @@ public:
 
     size_t size;
     char *buf;
+
+    /* How far into the original array the data starts */
+    size_t offset;
+
+    /*
+     * Holds the data.  Take a reference to it to use the data after the blob
+     * is gone, e.g., for client arrays read by later calls.
+     */
+    Buffer *buffer;
 };
 
 
@@ -295,6 +431,19 @@ protected:
 std::ostream & operator <<(std::ostream &os, Value *value);
 
 
+/*
+ * Return address in the module (executable or shared library) a call was made
+ * from, relative to where the module was loaded.
+ */
+struct StackFrame {
+    std::string module;
+    unsigned long long offset;
+};
+
+/* Innermost frame first */
+typedef std::vector<StackFrame> Backtrace;
+
+
 class Call
 {
 public:
@@ -304,11 +453,31 @@ public:
     };
 
     unsigned no;
+    unsigned thread_id;
     const Signature *sig;
     std::vector<Value *> args;
     Value *ret;
 
-    Call(Signature *_sig) : sig(_sig), args(_sig->arg_names.size()), ret(0) { }
+    /*
+     * Nanoseconds since tracing started, right before the call was dispatched
+     * and right after it returned, if the trace has timings.
+     */
+    bool timed;
+    long long time_start;
+    long long time_end;
+
+    /* Where the call was made from, if the trace has backtraces */
+    const Backtrace *backtrace;
+
+    /*
+     * Holds the values of the call, so they last as long as the call does,
+     * whatever else is parsed meanwhile.  Most arguments are scalars, so the
+     * first block is sized for one small value per argument and the return
+     * value, and calls with blobs or arrays grow it.
+     */
+    Arena arena;
+
+    Call(Signature *_sig) : thread_id(0), sig(_sig), args(_sig->arg_names.size()), ret(0), timed(false), time_start(0), time_end(0), backtrace(0), arena(16 + 32 * (_sig->arg_names.size() + 1)) { }
     ~Call();
 
     inline const std::string & name(void) const {
@@ -27,9 +27,11 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include <zlib.h>
+#include <algorithm>
 
+#include "trace_file.hpp"
 #include "trace_parser.hpp"
 
 
@@ -41,8 +43,15 @@ namespace Trace {
 
 Parser::Parser() {
     file = NULL;
+    last_time = 0;
+    time_chunk = 0;
     next_call_no = 0;
+    event_chunk = 0;
+    start_call = 0;
+    index_loaded = false;
+    first_frame = 0;
     version = 0;
+    arena = &sig_arena;
 }
 
 
@@ -52,10 +61,11 @@ Parser::~Parser() {
 
 
 bool Parser::open(const char *filename) {
-    file = gzopen(filename, "rb");
+    file = File::open(filename);
     if (!file) {
         return false;
     }
+    file->keep_previous(BLOB_REF_MAX_DISTANCE);
 
     version = read_uint();
     if (version > TRACE_VERSION) {
@@ -63,6 +73,14 @@ bool Parser::open(const char *filename) {
         return false;
     }
 
+    /*
+     * Traces written in flight recorder mode start at a later call, and rely
+     * on the index for the signatures defined before it.
+     */
+    if (load_index()) {
+        seek_call(chunks[0].first_call);
+    }
+
     return true;
 }
 
@@ -83,36 +101,467 @@ deleteAll(const Container &c)
     deleteAll(c.begin(), c.end());
 }
 
+void PendingCalls::insert(Call *call) {
+    if (2*(count + 1) > slots.size()) {
+        grow();
+    }
+    size_t mask = slots.size() - 1;
+    size_t i = call->no & mask;
+    while (slots[i]) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = call;
+    ++count;
+}
+
+
+Call *PendingCalls::take(unsigned no) {
+    size_t mask = slots.size() - 1;
+    size_t i = no & mask;
+    while (slots[i] && slots[i]->no != no) {
+        i = (i + 1) & mask;
+    }
+    Call *call = slots[i];
+    if (!call) {
+        return NULL;
+    }
+
+    /*
+     * Shift back the calls that follow in the same run, unless they are
+     * already past their own slot, so that lookups need no tombstones.
+     */
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (!slots[j]) {
+            break;
+        }
+        size_t home = slots[j]->no & mask;
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i] = NULL;
+    --count;
+    return call;
+}
+
+
+static bool
+call_no_less(const Call *a, const Call *b) {
+    return a->no < b->no;
+}
+
+
+void PendingCalls::list(std::vector<Call *> &calls) const {
+    calls.clear();
+    for (size_t i = 0; i < slots.size(); ++i) {
+        if (slots[i]) {
+            calls.push_back(slots[i]);
+        }
+    }
+    std::sort(calls.begin(), calls.end(), call_no_less);
+}
+
+
+void PendingCalls::grow(void) {
+    std::vector<Call *> old;
+    old.swap(slots);
+    slots.assign(old.size() * 2, NULL);
+    count = 0;
+    for (size_t i = 0; i < old.size(); ++i) {
+        if (old[i]) {
+            insert(old[i]);
+        }
+    }
+}
+
+
+void PendingCalls::clear(void) {
+    slots.assign(64, NULL);
+    count = 0;
+}
+
+
 void Parser::close(void) {
     if (file) {
-        gzclose(file);
+        delete file;
         file = NULL;
     }
 
-    deleteAll(calls);
+    std::vector<Call *> pending;
+    calls.list(pending);
+    deleteAll(pending);
     deleteAll(functions);
     deleteAll(structs);
     deleteAll(enums);
     deleteAll(bitmasks);
+    deleteAll(backtraces);
+    sig_arena.clear();
+    arena = &sig_arena;
+    calls.clear();
+    functions.clear();
+    structs.clear();
+    enums.clear();
+    bitmasks.clear();
+    backtraces.clear();
+
+    for (unsigned kind = 0; kind < SIG_KIND_COUNT; ++kind) {
+        defined[kind].clear();
+        sig_offsets[kind].clear();
+    }
+    last_time = 0;
+    time_chunk = 0;
+    next_call_no = 0;
+    event_chunk = 0;
+    start_call = 0;
+    index_loaded = false;
+    chunks.clear();
+    first_frame = 0;
+    frames.clear();
+}
+
+
+bool Parser::load_index(void) {
+    if (index_loaded) {
+        return !chunks.empty();
+    }
+    index_loaded = true;
+
+    /* Where the events resume, should the index turn out to be unusable */
+    unsigned long long resume_offset = file->chunk_offset();
+    size_t resume_position = file->chunk_position();
+
+    unsigned long long offset = file->index_offset();
+    if (!offset || !file->seek(offset)) {
+        return false;
+    }
+
+    size_t count = read_uint();
+    chunks.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        chunks[i].offset = read_uint();
+        chunks[i].first_call = read_uint();
+        chunks[i].first_frame = read_uint();
+        chunks[i].blob_distance = read_uint();
+    }
+
+    first_frame = read_uint();
+    count = read_uint();
+    frames.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        frames[i] = read_uint();
+    }
+
+    count = read_uint();
+    for (size_t i = 0; i < count; ++i) {
+        unsigned kind = read_uint();
+        size_t id = read_uint();
+        unsigned long long chunk_offset = read_uint();
+        switch (kind) {
+        case SIG_FUNCTION:
+            read_function_sig(id);
+            break;
+        case SIG_STRUCT:
+            read_struct_sig(id);
+            break;
+        case SIG_ENUM:
+            read_enum_sig(id);
+            break;
+        case SIG_BITMASK:
+            read_bitmask_sig(id);
+            break;
+        case SIG_BACKTRACE:
+            read_backtrace_sig(id);
+            break;
+        default:
+            std::cerr << "error: unknown signature kind " << kind << " in index\n";
+            chunks.clear();
+            break;
+        }
+        if (chunks.empty()) {
+            break;
+        }
+
+        std::vector<unsigned long long> &offsets = sig_offsets[kind];
+        if (id >= offsets.size()) {
+            offsets.resize(id + 1, ~0ULL);
+        }
+        offsets[id] = chunk_offset;
+    }
+
+    if (chunks.empty()) {
+        file->seek(resume_offset);
+        file->skip(resume_position);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Parser::has_index(void) {
+    return load_index();
+}
+
+
+bool Parser::seek_call(unsigned call_no) {
+    if (!load_index()) {
+        if (call_no < next_call_no) {
+            return false;
+        }
+        start_call = call_no;
+        return true;
+    }
+
+    /* Last chunk starting at or before the call */
+    size_t lo = 0;
+    size_t hi = chunks.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (chunks[mid].first_call <= call_no) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return seek_chunk(lo, call_no);
+}
+
+
+/**
+ * Continue parsing from the start of the given chunk of the index, skipping
+ * the calls before call_no.
+ */
+bool Parser::seek_chunk(size_t index, unsigned call_no) {
+    const ChunkEntry &chunk = chunks[index];
+
+    if (!file->seek(chunk.offset)) {
+        return false;
+    }
+
+    /* Load the earlier chunks that blobs from here on refer back to */
+    size_t first = index;
+    for (size_t i = index; i < chunks.size() && i < index + BLOB_REF_MAX_DISTANCE; ++i) {
+        size_t distance = std::min<size_t>(chunks[i].blob_distance, i);
+        first = std::min(first, i - distance);
+    }
+    for (size_t i = first; i < index; ++i) {
+        file->load_previous(chunks[i].offset);
+    }
+
+    std::vector<Call *> pending;
+    calls.list(pending);
+    deleteAll(pending);
+    calls.clear();
+    next_call_no = chunk.first_call;
+    start_call = call_no;
+
+    /* Signatures defined in earlier chunks won't be defined again */
+    for (unsigned kind = 0; kind < SIG_KIND_COUNT; ++kind) {
+        const std::vector<unsigned long long> &offsets = sig_offsets[kind];
+        defined[kind].assign(offsets.size(), false);
+        for (size_t id = 0; id < offsets.size(); ++id) {
+            defined[kind][id] = offsets[id] < chunk.offset;
+        }
+    }
+
+    return true;
+}
+
+
+bool Parser::seek_frame(unsigned frame_no) {
+    if (!load_index()) {
+        return skip_frames(frame_no);
+    }
+    if (frame_no >= first_frame && frame_no - first_frame < frames.size()) {
+        return seek_call(frames[frame_no - first_frame]);
+    }
+
+    /*
+     * Frames that were current when a chunk started, e.g., the first one, or
+     * the first after a gap in flight recorder traces, start there as far as
+     * the trace goes.
+     */
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (chunks[i].first_frame == frame_no) {
+            return seek_call(chunks[i].first_call);
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Whether calls to the given function end a frame, i.e., whether the tracers
+ * mark the end of a frame after them.
+ */
+static bool
+ends_frame(const std::string &name) {
+    if (name == "glXSwapBuffers" ||
+        name == "wglSwapBuffers" ||
+        name == "wglSwapLayerBuffers") {
+        return true;
+    }
+
+    /* IDirect3DDevice9::Present and the like */
+    size_t pos = name.rfind("::");
+    if (pos == std::string::npos) {
+        return false;
+    }
+    pos += 2;
+    return name.compare(pos, std::string::npos, "Present") == 0 ||
+           name.compare(pos, std::string::npos, "PresentEx") == 0;
+}
+
+
+/**
+ * Find the given frame without an index, by scanning forward from the start
+ * for the calls ending the frames before it.  Calls entered before the frame
+ * starts but left after are skipped, as when seeking to a call.
+ */
+bool Parser::skip_frames(unsigned frame_no) {
+    if (next_call_no || start_call) {
+        /* Don't know which frame this is */
+        return false;
+    }
+
+    CallLocation location;
+    for (unsigned frame = 0; frame < frame_no; ) {
+        if (!scan_call(location)) {
+            return false;
+        }
+        if (ends_frame(location.sig->name)) {
+            ++frame;
+        }
+    }
+    start_call = next_call_no;
+    return true;
+}
+
+
+/**
+ * Seeking into the middle of a chunk would lose what the events before the
+ * call in it define, i.e., signatures, the time the next one is relative to,
+ * and the calls still pending, so start from the chunk and skip over those
+ * events as scan_call() does.
+ */
+bool Parser::seek(const CallLocation &location) {
+    if (!load_index()) {
+        return false;
+    }
+
+    size_t lo = 0;
+    size_t hi = chunks.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (chunks[mid].offset < location.chunk_offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == chunks.size() || chunks[lo].offset != location.chunk_offset ||
+        !seek_chunk(lo, location.no)) {
+        return false;
+    }
+
+    do {
+        int c = file->peek_byte();
+        if (file->chunk() != event_chunk) {
+            enter_chunk();
+        }
+        if (c == -1 || file->chunk_offset() != location.chunk_offset) {
+            return false;
+        }
+        if (file->chunk_position() >= location.offset) {
+            break;
+        }
+
+        read_byte();
+        unsigned thread_id;
+        switch(c) {
+        case Trace::EVENT_ENTER:
+            {
+                size_t id = read_uint();
+                if (needs_definition(SIG_FUNCTION, id)) {
+                    read_function_sig(id);
+                }
+                ++next_call_no;
+                skip_call_details(thread_id);
+            }
+            break;
+        case Trace::EVENT_LEAVE:
+            read_uint();
+            skip_call_details(thread_id);
+            break;
+        default:
+            std::cerr << "error: unknown event " << c << "\n";
+            exit(1);
+        }
+    } while(true);
+
+    return file->chunk_position() == location.offset && next_call_no == location.no;
+}
+
+
+/**
+ * Number calls from where the chunk just entered starts, as flight recorder
+ * traces leave out the chunks between the first frame and the last ones.
+ */
+void Parser::enter_chunk(void) {
+    event_chunk = file->chunk();
+
+    unsigned long long offset = file->chunk_offset();
+    size_t lo = 0;
+    size_t hi = chunks.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (chunks[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < chunks.size() && chunks[lo].offset == offset) {
+        next_call_no = chunks[lo].first_call;
+    }
 }
 
 
 Call *Parser::parse_call(void) {
     do {
         int c = read_byte();
+        if (file->chunk() != event_chunk) {
+            enter_chunk();
+        }
         switch(c) {
         case Trace::EVENT_ENTER:
             parse_enter();
             break;
         case Trace::EVENT_LEAVE:
-            return parse_leave();
+            {
+                Call *call = parse_leave();
+                if (call) {
+                    if (call->no >= start_call) {
+                        return call;
+                    }
+                    delete call;
+                }
+            }
+            break;
         default:
             std::cerr << "error: unknown event " << c << "\n";
             exit(1);
         case -1:
-            for (CallList::iterator it = calls.begin(); it != calls.end(); ++it) {
-                std::cerr << "warning: incomplete call " << (*it)->name() << "\n";
-                std::cerr << **it << "\n";
+            {
+                std::vector<Call *> pending;
+                calls.list(pending);
+                for (std::vector<Call *>::iterator it = pending.begin(); it != pending.end(); ++it) {
+                    std::cerr << "warning: incomplete call " << (*it)->name() << "\n";
+                    std::cerr << **it << "\n";
+                }
             }
             return NULL;
         }
@@ -134,18 +583,132 @@ T *lookup(std::vector<T *> &map, size_t index) {
 }
 
 
+/**
+ * Whether the definition of a signature follows its id, that is, whether this
+ * is the first time it is seen since the start, or since seeking.
+ */
+bool Parser::needs_definition(SigKind kind, size_t id) {
+    std::vector<bool> &map = defined[kind];
+    if (id >= map.size()) {
+        map.resize(id + 1);
+    } else if (map[id]) {
+        return false;
+    }
+    map[id] = true;
+    return true;
+}
+
+
+/*
+ * Signature definitions.  A signature may be defined more than once, when
+ * seeking, in which case the first definition is kept, so that the calls
+ * already parsed stay valid.
+ */
+
+Call::Signature *Parser::read_function_sig(size_t id) {
+    Call::Signature *sig = new Call::Signature;
+    sig->name = read_string();
+    unsigned size = read_uint();
+    for (unsigned i = 0; i < size; ++i) {
+        sig->arg_names.push_back(read_string());
+    }
+
+    Call::Signature *prev = lookup(functions, id);
+    if (prev) {
+        delete sig;
+        return prev;
+    }
+    functions[id] = sig;
+    return sig;
+}
+
+
+Struct::Signature *Parser::read_struct_sig(size_t id) {
+    Struct::Signature *sig = new Struct::Signature;
+    sig->name = read_string();
+    unsigned size = read_uint();
+    for (unsigned i = 0; i < size; ++i) {
+        sig->member_names.push_back(read_string());
+    }
+
+    Struct::Signature *prev = lookup(structs, id);
+    if (prev) {
+        delete sig;
+        return prev;
+    }
+    structs[id] = sig;
+    return sig;
+}
+
+
+Enum::Signature *Parser::read_enum_sig(size_t id) {
+    std::string name = read_string();
+
+    /* The value is shared by all the calls referring to the signature */
+    Arena *call_arena = arena;
+    arena = &sig_arena;
+    Value *value = parse_value();
+    arena = call_arena;
+
+    Enum::Signature *sig = new Enum::Signature(name, value);
+
+    Enum::Signature *prev = lookup(enums, id);
+    if (prev) {
+        delete sig;
+        return prev;
+    }
+    enums[id] = sig;
+    return sig;
+}
+
+
+Bitmask::Signature *Parser::read_bitmask_sig(size_t id) {
+    size_t size = read_uint();
+    Bitmask::Signature *sig = new Bitmask::Signature(size);
+    for (Bitmask::Signature::iterator it = sig->begin(); it != sig->end(); ++it) {
+        it->first = read_string();
+        it->second = read_uint();
+        if (it->second == 0 && it != sig->begin()) {
+            std::cerr << "warning: bitmask " << it->first << " is zero but is not first flag\n";
+        }
+    }
+
+    Bitmask::Signature *prev = lookup(bitmasks, id);
+    if (prev) {
+        delete sig;
+        return prev;
+    }
+    bitmasks[id] = sig;
+    return sig;
+}
+
+
+Backtrace *Parser::read_backtrace_sig(size_t id) {
+    size_t size = read_uint();
+    Backtrace *sig = new Backtrace(size);
+    for (Backtrace::iterator it = sig->begin(); it != sig->end(); ++it) {
+        it->module = read_string();
+        it->offset = read_uint();
+    }
+
+    Backtrace *prev = lookup(backtraces, id);
+    if (prev) {
+        delete sig;
+        return prev;
+    }
+    backtraces[id] = sig;
+    return sig;
+}
+
+
 void Parser::parse_enter(void) {
     size_t id = read_uint();
 
-    Call::Signature *sig = lookup(functions, id);
-    if (!sig) {
-        sig = new Call::Signature;
-        sig->name = read_string();
-        unsigned size = read_uint();
-        for (unsigned i = 0; i < size; ++i) {
-            sig->arg_names.push_back(read_string());
-        }
-        functions[id] = sig;
+    Call::Signature *sig;
+    if (needs_definition(SIG_FUNCTION, id)) {
+        sig = read_function_sig(id);
+    } else {
+        sig = lookup(functions, id);
     }
     assert(sig);
 
@@ -153,7 +716,7 @@ void Parser::parse_enter(void) {
     call->no = next_call_no++;
 
     if (parse_call_details(call)) {
-        calls.push_back(call);
+        calls.insert(call);
     } else {
         delete call;
     }
@@ -162,15 +725,12 @@ void Parser::parse_enter(void) {
 
 Call *Parser::parse_leave(void) {
     unsigned call_no = read_uint();
-    Call *call = NULL;
-    for (CallList::iterator it = calls.begin(); it != calls.end(); ++it) {
-        if ((*it)->no == call_no) {
-            call = *it;
-            calls.erase(it);
-            break;
-        }
-    }
+    Call *call = calls.take(call_no);
     if (!call) {
+        /* Entered before where parsing started, so skip it */
+        Call::Signature sig;
+        Call skipped(&sig);
+        parse_call_details(&skipped);
         return NULL;
     }
 
@@ -183,7 +743,61 @@ Call *Parser::parse_leave(void) {
 }
 
 
+bool Parser::scan_call(CallLocation &location) {
+    do {
+        int c = read_byte();
+        if (file->chunk() != event_chunk) {
+            enter_chunk();
+        }
+        switch(c) {
+        case Trace::EVENT_ENTER:
+            {
+                /* Chunks hold whole events, so this is where it started */
+                size_t enter_offset = file->chunk_position();
+                if (enter_offset) {
+                    --enter_offset;
+                }
+
+                size_t id = read_uint();
+                Call::Signature *sig;
+                if (needs_definition(SIG_FUNCTION, id)) {
+                    sig = read_function_sig(id);
+                } else {
+                    sig = lookup(functions, id);
+                }
+                assert(sig);
+
+                unsigned no = next_call_no++;
+                unsigned thread_id = 0;
+                if (skip_call_details(thread_id) && no >= start_call) {
+                    location.no = no;
+                    location.thread_id = thread_id;
+                    location.sig = sig;
+                    location.chunk_offset = file->chunk_offset();
+                    location.offset = enter_offset;
+                    return true;
+                }
+            }
+            break;
+        case Trace::EVENT_LEAVE:
+            {
+                read_uint();
+                unsigned thread_id;
+                skip_call_details(thread_id);
+            }
+            break;
+        default:
+            std::cerr << "error: unknown event " << c << "\n";
+            exit(1);
+        case -1:
+            return false;
+        }
+    } while(true);
+}
+
+
 bool Parser::parse_call_details(Call *call) {
+    arena = &call->arena;
     do {
         int c = read_byte();
         switch(c) {
@@ -195,6 +809,15 @@ bool Parser::parse_call_details(Call *call) {
         case Trace::CALL_RET:
             call->ret = parse_value();
             break;
+        case Trace::CALL_THREAD:
+            call->thread_id = read_uint();
+            break;
+        case Trace::CALL_TIME:
+            parse_time(call);
+            break;
+        case Trace::CALL_BACKTRACE:
+            parse_backtrace(call);
+            break;
         default:
             std::cerr << "error: unknown call detail " << c << "\n";
             exit(1);
@@ -215,19 +838,188 @@ void Parser::parse_arg(Call *call) {
 }
 
 
+/**
+ * Times are relative to the previous one in the same chunk.
+ */
+long long Parser::read_time(void) {
+    unsigned long long value = read_uint();
+    long long delta = (long long)(value >> 1) ^ -(long long)(value & 1);
+
+    if (file->chunk() != time_chunk) {
+        time_chunk = file->chunk();
+        last_time = 0;
+    }
+    last_time += delta;
+    return last_time;
+}
+
+
+void Parser::parse_time(Call *call) {
+    read_time();
+
+    if (call->timed) {
+        call->time_end = last_time;
+    } else {
+        call->timed = true;
+        call->time_start = last_time;
+        call->time_end = last_time;
+    }
+}
+
+
+void Parser::parse_backtrace(Call *call) {
+    size_t id = read_uint();
+    if (needs_definition(SIG_BACKTRACE, id)) {
+        call->backtrace = read_backtrace_sig(id);
+    } else {
+        call->backtrace = lookup(backtraces, id);
+    }
+    assert(call->backtrace);
+}
+
+
+/*
+ * Counterparts of the above that only read what is needed to follow the
+ * event stream: signature definitions, and the chunk's time base.
+ */
+
+bool Parser::skip_call_details(unsigned &thread_id) {
+    do {
+        int c = read_byte();
+        switch(c) {
+        case Trace::CALL_END:
+            return true;
+        case Trace::CALL_ARG:
+            read_uint();
+            skip_value();
+            break;
+        case Trace::CALL_RET:
+            skip_value();
+            break;
+        case Trace::CALL_THREAD:
+            thread_id = read_uint();
+            break;
+        case Trace::CALL_TIME:
+            read_time();
+            break;
+        case Trace::CALL_BACKTRACE:
+            {
+                size_t id = read_uint();
+                if (needs_definition(SIG_BACKTRACE, id)) {
+                    read_backtrace_sig(id);
+                }
+            }
+            break;
+        default:
+            std::cerr << "error: unknown call detail " << c << "\n";
+            exit(1);
+        case -1:
+            return false;
+        }
+    } while(true);
+}
+
+
+void Parser::skip_value(void) {
+    int c = read_byte();
+    switch(c) {
+    case Trace::TYPE_NULL:
+    case Trace::TYPE_FALSE:
+    case Trace::TYPE_TRUE:
+        break;
+    case Trace::TYPE_SINT:
+    case Trace::TYPE_UINT:
+    case Trace::TYPE_OPAQUE:
+        read_uint();
+        break;
+    case Trace::TYPE_BLOB_REF:
+        read_uint();
+        read_uint();
+        break;
+    case Trace::TYPE_FLOAT:
+        file->skip(sizeof(float));
+        break;
+    case Trace::TYPE_DOUBLE:
+        file->skip(sizeof(double));
+        break;
+    case Trace::TYPE_STRING:
+    case Trace::TYPE_BLOB:
+        file->skip(read_uint());
+        break;
+    case Trace::TYPE_ENUM:
+        {
+            size_t id = read_uint();
+            if (needs_definition(SIG_ENUM, id)) {
+                read_enum_sig(id);
+            }
+        }
+        break;
+    case Trace::TYPE_BITMASK:
+        {
+            size_t id = read_uint();
+            if (needs_definition(SIG_BITMASK, id)) {
+                read_bitmask_sig(id);
+            }
+            read_uint();
+        }
+        break;
+    case Trace::TYPE_ARRAY:
+        {
+            size_t len = read_uint();
+            for (size_t i = 0; i < len; ++i) {
+                skip_value();
+            }
+        }
+        break;
+    case Trace::TYPE_SCALAR_ARRAY:
+        {
+            read_byte();
+            size_t size = read_uint();
+            size_t len = read_uint();
+            file->skip(size*len);
+        }
+        break;
+    case Trace::TYPE_STRUCT:
+        {
+            size_t id = read_uint();
+            Struct::Signature *sig;
+            if (needs_definition(SIG_STRUCT, id)) {
+                sig = read_struct_sig(id);
+            } else {
+                sig = lookup(structs, id);
+            }
+            assert(sig);
+            for (size_t i = 0; i < sig->member_names.size(); ++i) {
+                skip_value();
+            }
+        }
+        break;
+    case Trace::TYPE_BLOB_OFFSET:
+        read_uint();
+        skip_value();
+        break;
+    default:
+        std::cerr << "error: unknown type " << c << "\n";
+        exit(1);
+    case -1:
+        break;
+    }
+}
+
+
 Value *Parser::parse_value(void) {
     int c;
     Value *value;
     c = read_byte();
     switch(c) {
     case Trace::TYPE_NULL:
-        value = new Null;
+        value = new (arena) Null;
         break;
     case Trace::TYPE_FALSE:
-        value = new Bool(false);
+        value = new (arena) Bool(false);
         break;
     case Trace::TYPE_TRUE:
-        value = new Bool(true);
+        value = new (arena) Bool(true);
         break;
     case Trace::TYPE_SINT:
         value = parse_sint();
@@ -262,6 +1054,15 @@ Value *Parser::parse_value(void) {
     case Trace::TYPE_OPAQUE:
         value = parse_opaque();
         break;
+    case Trace::TYPE_BLOB_REF:
+        value = parse_blob_ref();
+        break;
+    case Trace::TYPE_BLOB_OFFSET:
+        value = parse_blob_offset();
+        break;
+    case Trace::TYPE_SCALAR_ARRAY:
+        value = parse_scalar_array();
+        break;
     default:
         std::cerr << "error: unknown type " << c << "\n";
         exit(1);
@@ -279,74 +1080,66 @@ Value *Parser::parse_value(void) {
 
 
 Value *Parser::parse_sint() {
-    return new SInt(-(signed long long)read_uint());
+    return new (arena) SInt(-(signed long long)read_uint());
 }
 
 
 Value *Parser::parse_uint() {
-    return new UInt(read_uint());
+    return new (arena) UInt(read_uint());
 }
 
 
 Value *Parser::parse_float() {
     float value;
-    gzread(file, &value, sizeof value);
-    return new Float(value);
+    file->read(&value, sizeof value);
+    return new (arena) Float(value);
 }
 
 
 Value *Parser::parse_double() {
     double value;
-    gzread(file, &value, sizeof value);
-    return new Float(value);
+    file->read(&value, sizeof value);
+    return new (arena) Float(value);
 }
 
 
 Value *Parser::parse_string() {
-    return new String(read_string());
+    return new (arena) String(read_string());
 }
 
 
 Value *Parser::parse_enum() {
     size_t id = read_uint();
-    Enum::Signature *sig = lookup(enums, id);
-    if (!sig) {
-        std::string name = read_string();
-        Value *value = parse_value();
-        sig = new Enum::Signature(name, value);
-        enums[id] = sig;
+    Enum::Signature *sig;
+    if (needs_definition(SIG_ENUM, id)) {
+        sig = read_enum_sig(id);
+    } else {
+        sig = lookup(enums, id);
     }
     assert(sig);
-    return new Enum(sig);
+    return new (arena) Enum(sig);
 }
 
 
 Value *Parser::parse_bitmask() {
     size_t id = read_uint();
-    Bitmask::Signature *sig = lookup(bitmasks, id);
-    if (!sig) {
-        size_t size = read_uint();
-        sig = new Bitmask::Signature(size);
-        for (Bitmask::Signature::iterator it = sig->begin(); it != sig->end(); ++it) {
-            it->first = read_string();
-            it->second = read_uint();
-            if (it->second == 0 && it != sig->begin()) {
-                std::cerr << "warning: bitmask " << it->first << " is zero but is not first flag\n";
-            }
-        }
-        bitmasks[id] = sig;
+    Bitmask::Signature *sig;
+    if (needs_definition(SIG_BITMASK, id)) {
+        sig = read_bitmask_sig(id);
+    } else {
+        sig = lookup(bitmasks, id);
     }
     assert(sig);
 
     unsigned long long value = read_uint();
 
-    return new Bitmask(sig, value);
+    return new (arena) Bitmask(sig, value);
 }
 
 
 Value *Parser::parse_array(void) {
     size_t len = read_uint();
-    Array *array = new Array(len);
+    Array *array = new (arena) Array(len);
     for (size_t i = 0; i < len; ++i) {
         array->values[i] = parse_value();
     }
@@ -354,12 +1147,183 @@ Value *Parser::parse_array(void) {
 }
 
 
+/**
+ * Keep an array of numbers, stored as E, for values of type V.
+ */
+template <class E, class V>
+static Value *
+decode_scalars(Arena *arena, const char *data, size_t len) {
+    return new (arena) ScalarArray<E, V>(arena, data, len);
+}
+
+
+/**
+ * Whether scalars of the given type can be stored in size bytes.
+ */
+static bool
+valid_scalar(int type, size_t size) {
+    switch (type) {
+    case Trace::TYPE_SINT:
+    case Trace::TYPE_UINT:
+        return size == 1 || size == 2 || size == 4 || size == 8;
+    case Trace::TYPE_FLOAT:
+        return size == sizeof(float);
+    case Trace::TYPE_DOUBLE:
+        return size == sizeof(double);
+    default:
+        return false;
+    }
+}
+
+
+Value *Parser::parse_scalar_array(void) {
+    int type = read_byte();
+    size_t size = read_uint();
+    size_t len = read_uint();
+
+    if (!valid_scalar(type, size) || len > ~(size_t)0 / size) {
+        std::cerr << "error: invalid array of type " << type << " and size " << size << "\n";
+        return new (arena) Null;
+    }
+
+    /*
+     * Decode straight from the file buffer when possible.  Chunks hold whole
+     * events, so an array that doesn't fit in the rest of the chunk is bogus;
+     * otherwise read it piecewise, so as not to trust the length with a
+     * single allocation.
+     */
+    char *copy = NULL;
+    const char *data = file->take(size*len);
+    if (!data) {
+        size_t total = size*len;
+        size_t count = 0;
+        if (!file->buffer()) {
+            while (count < total) {
+                size_t piece = std::min(total - count, std::max(count, (size_t)4096));
+                char *grown = new char[count + piece];
+                if (copy) {
+                    memcpy(grown, copy, count);
+                    delete [] copy;
+                }
+                copy = grown;
+                size_t read = file->read(copy + count, piece);
+                count += read;
+                if (read < piece) {
+                    break;
+                }
+            }
+        }
+        if (count < total) {
+            delete [] copy;
+            std::cerr << "error: invalid array of " << len << " elements\n";
+            return new (arena) Null;
+        }
+        data = copy;
+    }
+
+    if (size > 1 && HostIsBigEndian()) {
+        char *swapped = new char[size*len];
+        SwapScalars(swapped, data, size, len);
+        delete [] copy;
+        data = copy = swapped;
+    }
+
+    Value *value = NULL;
+    switch (type) {
+    case Trace::TYPE_SINT:
+        switch (size) {
+        case 1: value = decode_scalars<signed char, SInt>(arena, data, len); break;
+        case 2: value = decode_scalars<short, SInt>(arena, data, len); break;
+        case 4: value = decode_scalars<int, SInt>(arena, data, len); break;
+        case 8: value = decode_scalars<long long, SInt>(arena, data, len); break;
+        }
+        break;
+    case Trace::TYPE_UINT:
+        switch (size) {
+        case 1: value = decode_scalars<unsigned char, UInt>(arena, data, len); break;
+        case 2: value = decode_scalars<unsigned short, UInt>(arena, data, len); break;
+        case 4: value = decode_scalars<unsigned int, UInt>(arena, data, len); break;
+        case 8: value = decode_scalars<unsigned long long, UInt>(arena, data, len); break;
+        }
+        break;
+    case Trace::TYPE_FLOAT:
+        if (size == sizeof(float)) {
+            value = decode_scalars<float, Float>(arena, data, len);
+        }
+        break;
+    case Trace::TYPE_DOUBLE:
+        if (size == sizeof(double)) {
+            value = decode_scalars<double, Float>(arena, data, len);
+        }
+        break;
+    }
+
+    delete [] copy;
+
+    assert(value);
+    return value;
+}
+
+
 Value *Parser::parse_blob(void) {
     size_t size = read_uint();
-    Blob *blob = new Blob(size);
-    if (size) {
-        gzread(file, blob->buf, (unsigned)size);
+
+    /* Refer to the data in place when the file buffer can be kept */
+    Buffer *buffer = file->buffer();
+    char *data = buffer ? (char *)file->take(size) : NULL;
+    if (!data) {
+        buffer = new Buffer(size);
+        data = buffer->data;
+        if (size) {
+            file->read(data, size);
+        }
     }
+
+    return new (arena) Blob(buffer, data, size);
+}
+
+
+Value *Parser::parse_blob_ref(void) {
+    size_t distance = read_uint();
+    size_t offset = read_uint();
+
+    /* The blob is where it was first written, in this chunk or a kept one */
+    Buffer *buffer = distance ? file->previous_buffer(distance) : file->buffer();
+    if (buffer && offset < buffer->size && buffer->data[offset] == Trace::TYPE_BLOB) {
+        const unsigned char *p = (const unsigned char *)buffer->data + offset + 1;
+        const unsigned char *end = (const unsigned char *)buffer->data + buffer->size;
+        unsigned long long size = 0;
+        unsigned shift = 0;
+        while (p < end && shift < 64) {
+            size |= (unsigned long long)(*p & 0x7f) << shift;
+            shift += 7;
+            if (!(*p++ & 0x80)) {
+                if (size <= (unsigned long long)(end - p)) {
+                    return new (arena) Blob(buffer, (char *)p, size);
+                }
+                break;
+            }
+        }
+    }
+
+    std::cerr << "error: invalid blob reference " << distance << ":" << offset << "\n";
+    return new (arena) Null;
+}
+
+
+Value *Parser::parse_blob_offset(void) {
+    unsigned long long offset = read_uint();
+    Value *value = parse_value();
+    Blob *blob = dynamic_cast<Blob *>(value);
+
+    /* The whole array, from the pointer on, must be addressable */
+    if (!blob ||
+        offset > (unsigned long long)(size_t)blob->buf ||
+        offset > ~(size_t)0 - blob->size) {
+        std::cerr << "error: invalid blob offset " << offset << "\n";
+        return new (arena) Null;
+    }
+    blob->offset = offset;
     return blob;
 }
 
@@ -367,19 +1331,15 @@ Value *Parser::parse_blob(void) {
 Value *Parser::parse_struct() {
     size_t id = read_uint();
 
-    Struct::Signature *sig = lookup(structs, id);
-    if (!sig) {
-        sig = new Struct::Signature;
-        sig->name = read_string();
-        unsigned size = read_uint();
-        for (unsigned i = 0; i < size; ++i) {
-            sig->member_names.push_back(read_string());
-        }
-        structs[id] = sig;
+    Struct::Signature *sig;
+    if (needs_definition(SIG_STRUCT, id)) {
+        sig = read_struct_sig(id);
+    } else {
+        sig = lookup(structs, id);
     }
     assert(sig);
 
-    Struct *value = new Struct(sig);
+    Struct *value = new (arena) Struct(sig);
 
     for (size_t i = 0; i < sig->member_names.size(); ++i) {
         value->members[i] = parse_value();
@@ -392,19 +1352,20 @@ Value *Parser::parse_struct() {
 Value *Parser::parse_opaque() {
     unsigned long long addr;
     addr = read_uint();
-    return new Pointer(addr);
+    return new (arena) Pointer(addr);
 }
 
 
 std::string Parser::read_string(void) {
     size_t len = read_uint();
-    if (!len) {
-        return std::string();
+    std::string value;
+    const char *data = file->take(len);
+    if (data) {
+        value.assign(data, len);
+    } else {
+        value.resize(len);
+        value.resize(file->read(&value[0], len));
     }
-    char * buf = new char[len];
-    gzread(file, buf, (unsigned)len);
-    std::string value(buf, len);
-    delete [] buf;
 #if TRACE_VERBOSE
     std::cerr << "\tSTRING \"" << value << "\"\n";
 #endif
@@ -412,18 +1373,8 @@ std::string Parser::read_string(void) {
 }
 
 
-unsigned long long Parser::read_uint(void) {
-    unsigned long long value = 0;
-    int c;
-    unsigned shift = 0;
-    do {
-        c = gzgetc(file);
-        if (c == -1) {
-            break;
-        }
-        value |= (unsigned long long)(c & 0x7f) << shift;
-        shift += 7;
-    } while(c & 0x80);
+inline unsigned long long Parser::read_uint(void) {
+    unsigned long long value = file->read_uint();
 #if TRACE_VERBOSE
     std::cerr << "\tUINT " << value << "\n";
 #endif
@@ -432,7 +1383,7 @@ unsigned long long Parser::read_uint(void) {
 
 
 inline int Parser::read_byte(void) {
-    int c = gzgetc(file);
+    int c = file->read_byte();
 #if TRACE_VERBOSE
     if (c < 0)
         std::cerr << "\tEOF" << "\n";
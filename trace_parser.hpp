@@ -28,8 +28,8 @@
 
 
 #include <iostream>
-#include <list>
 #include <string>
+#include <vector>
 
 #include "trace_format.hpp"
 #include "trace_model.hpp"
@@ -38,13 +38,65 @@
 namespace Trace {
 
 
+class File;
+
+
+/**
+ * Calls entered but not left yet, by number.
+ *
+ * This is a hash table with open addressing, where a call number hashes to
+ * itself.  The numbers of pending calls are mostly consecutive, so they
+ * rarely collide, and long outstanding calls just keep their slot.
+ */
+class PendingCalls
+{
+protected:
+    std::vector<Call *> slots;
+    size_t count;
+
+    void grow(void);
+
+public:
+    PendingCalls() : slots(64), count(0) {}
+
+    void insert(Call *call);
+
+    /**
+     * Remove and return the call with the given number, if any.
+     */
+    Call *take(unsigned no);
+
+    /**
+     * All the pending calls, in order.
+     */
+    void list(std::vector<Call *> &calls) const;
+
+    void clear(void);
+};
+
+
+/**
+ * Where a call is, as found by Parser::scan_call(), without its arguments.
+ */
+struct CallLocation {
+    unsigned no;
+    unsigned thread_id;
+    const Call::Signature *sig;
+
+    /* Chunk the call was entered in, as File::chunk_offset() gives, and
+     * offset of the enter event within the chunk's data, which
+     * Parser::seek() returns to */
+    unsigned long long chunk_offset;
+    size_t offset;
+};
+
+
 class Parser
 {
 protected:
-    void *file;
+    File *file;
 
-    typedef std::list<Call *> CallList;
-    CallList calls;
+    PendingCalls calls;
 
     typedef std::vector<Call::Signature *> FunctionMap;
     FunctionMap functions;
@@ -58,8 +110,47 @@ protected:
     typedef std::vector<Bitmask::Signature *> BitmaskMap;
     BitmaskMap bitmasks;
 
+    typedef std::vector<Backtrace *> BacktraceMap;
+    BacktraceMap backtraces;
+
+    /* Where values are allocated, the arena of the call being parsed */
+    Arena *arena;
+
+    /* Values of enum signatures, which outlive any call */
+    Arena sig_arena;
+
+    /* Which signatures were already defined in the events read so far */
+    std::vector<bool> defined[SIG_KIND_COUNT];
+
+    /* Last call time read, which the next one is relative to */
+    long long last_time;
+    unsigned time_chunk;
+
     unsigned next_call_no;
 
+    /* File::chunk() of the last event read */
+    unsigned event_chunk;
+
+    /* Calls before this one are skipped, after seeking */
+    unsigned start_call;
+
+    /*
+     * Index of the trace, see trace_file.hpp.
+     */
+    struct ChunkEntry {
+        unsigned long long offset;
+        unsigned first_call;
+        unsigned first_frame;
+        unsigned blob_distance;
+    };
+
+    bool index_loaded;
+    std::vector<ChunkEntry> chunks;
+    /* First call of every frame listed, starting with frame first_frame */
+    unsigned first_frame;
+    std::vector<unsigned> frames;
+    std::vector<unsigned long long> sig_offsets[SIG_KIND_COUNT];
+
 public:
     unsigned long long version;
 
@@ -73,7 +164,59 @@ public:
 
     Call *parse_call(void);
 
+    /**
+     * Find the next call entered, skipping over its arguments, return value
+     * and everything else that doesn't keep the signatures up to date.  This
+     * is much faster than parse_call() for a pass over the whole trace, but
+     * the two can't be mixed, other than by seeking in between.
+     */
+    bool scan_call(CallLocation &location);
+
+    /**
+     * Whether the trace ends with an index, which seeking back requires.
+     */
+    bool has_index(void);
+
+    /**
+     * Continue parsing from the given call.  Without an index this can only
+     * skip forward.
+     */
+    bool seek_call(unsigned call_no);
+
+    /**
+     * Continue parsing from the first call of the given frame.  Without an
+     * index this scans forward for the calls that end frames, so it only works
+     * before anything else was read.
+     */
+    bool seek_frame(unsigned frame_no);
+
+    /**
+     * Continue parsing from a call found by scan_call(), of this or another
+     * parser of the same file.  Requires an index.
+     */
+    bool seek(const CallLocation &location);
+
 protected:
+    bool load_index(void);
+
+    bool seek_chunk(size_t index, unsigned call_no);
+
+    bool skip_frames(unsigned frame_no);
+
+    void enter_chunk(void);
+
+    bool needs_definition(SigKind kind, size_t id);
+
+    Call::Signature *read_function_sig(size_t id);
+
+    Struct::Signature *read_struct_sig(size_t id);
+
+    Enum::Signature *read_enum_sig(size_t id);
+
+    Bitmask::Signature *read_bitmask_sig(size_t id);
+
+    Backtrace *read_backtrace_sig(size_t id);
+
     void parse_enter(void);
 
     Call *parse_leave(void);
@@ -82,6 +225,16 @@ protected:
 
     void parse_arg(Call *call);
 
+    void parse_time(Call *call);
+
+    void parse_backtrace(Call *call);
+
+    long long read_time(void);
+
+    bool skip_call_details(unsigned &thread_id);
+
+    void skip_value(void);
+
     Value *parse_value(void);
 
     Value *parse_sint();
@@ -100,15 +253,21 @@ protected:
 
     Value *parse_array(void);
 
+    Value *parse_scalar_array(void);
+
     Value *parse_blob(void);
 
+    Value *parse_blob_ref(void);
+
+    Value *parse_blob_offset(void);
+
     Value *parse_struct();
 
     Value *parse_opaque();
 
     std::string read_string(void);
 
-    unsigned long long read_uint(void);
+    inline unsigned long long read_uint(void);
 
     inline int read_byte(void);
 };
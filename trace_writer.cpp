@@ -30,23 +30,852 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
 #include <vector>
 
-#include <zlib.h>
-
 #include "os.hpp"
+#include "trace_compressor.hpp"
+#include "trace_hash.hpp"
 #include "trace_writer.hpp"
 #include "trace_format.hpp"
 
 
+/*
+ * Calls are encoded by the application threads into per-thread event
+ * buffers, without taking any lock.  Complete events are handed over through
+ * a lock-free queue to a single writer thread, which is the only one to ever
+ * touch the trace file.  Compression is further offloaded to a pool of
+ * threads by the Compressor.
+ */
+
+
 namespace Trace {
 
 
-static gzFile g_gzFile = NULL;
+/**
+ * Part of an event buffer that the writer thread may leave out.
+ *
+ * Several threads may define the same signature concurrently, so the writer
+ * thread drops all but the first definition that actually reaches the file.
+ *
+ * Large blobs are marked too, so that the writer thread can replace the ones
+ * it wrote recently by references.
+ */
+struct EventRef {
+    int kind;  /* SigKind, or REF_BLOB */
+    Id id;
+    size_t offset;
+    size_t length;
+};
+
+static const int REF_BLOB = SIG_KIND_COUNT;
+
+
+/**
+ * Pseudo-event marking the end of a frame.  It is never written to the file.
+ */
+static const int EVENT_FRAME = -1;
+
+
+struct ThreadState;
+
+
+struct EventBuffer : public Encoder {
+    EventBuffer * volatile next;
+
+    ThreadState *state;
+
+    int type;
+    unsigned call;
+
+    /* OS::GetTimestamp() of the event, when timing calls */
+    unsigned long long time;
+
+    std::vector<EventRef> refs;
+
+    /* Arguments copied at the end of the buffer, when deferring them */
+    ArgsDumper dumper;
+    size_t args_offset;
+
+    EventBuffer(ThreadState *_state) :
+        next(NULL),
+        state(_state),
+        type(EVENT_ENTER),
+        call(0),
+        time(0),
+        dumper(NULL),
+        args_offset(0)
+    {
+        buf = NULL;
+        size = 0;
+        capacity = 0;
+    }
+};
+
+
+/*
+ * Flat bitset of signature ids, which are small and dense.
+ */
+class SigSet
+{
+protected:
+    std::vector<unsigned> words;
+
+public:
+    /**
+     * Mark the id as seen, returning whether it already was.
+     */
+    inline bool insert(Id id) {
+        size_t word = id / 32;
+        unsigned bit = 1U << (id % 32);
+        if (word >= words.size()) {
+            words.resize(word + 1 + word/2);
+        }
+        unsigned old = words[word];
+        words[word] = old | bit;
+        return (old & bit) != 0;
+    }
+
+    inline void clear(void) {
+        std::fill(words.begin(), words.end(), 0U);
+    }
+};
+
+
+struct BacktraceEntry {
+    Id id;
+    std::vector<void *> frames;
+};
+
+
+struct ThreadState {
+    unsigned id;
+
+    /* Signatures this thread already emitted to the current trace file */
+    unsigned generation;
+    SigSet sigs[SIG_KIND_COUNT];
+
+    /* Event being encoded */
+    EventBuffer *event;
+
+    /* Events free for reuse, only touched by the owner thread */
+    EventBuffer *free;
+
+    /* Events given back by the writer thread */
+    EventBuffer * volatile returned;
+
+    /* Call stacks seen by this thread, by hash of their frames */
+    std::multimap<unsigned long long, BacktraceEntry> backtraces;
+
+    ThreadState(unsigned _id) :
+        id(_id),
+        generation(0),
+        event(NULL),
+        free(NULL),
+        returned(NULL)
+    {}
+};
+
+
+static THREAD_LOCAL ThreadState *t_state = NULL;
+
+THREAD_LOCAL Encoder *t_encoder = NULL;
+
+static volatile long thread_count = 0;
+static volatile long call_count = 0;
+
+/*
+ * Bytes in the event queue.  Application threads are stalled when this gets
+ * too large, instead of letting memory usage grow without bounds.
+ */
+static volatile long queued_bytes = 0;
+#define MAX_QUEUED_BYTES (64*1024*1024)
+
+/*
+ * The writer thread sleeps on writer_cond while the queue is empty, after
+ * announcing it in writer_sleeping.  Only the thread that takes the
+ * announcement back takes the mutex to wake it, so that calls don't pay for a
+ * system call while the writer keeps up, nor while it is waking up.
+ */
+static volatile long writer_sleeping = 0;
+static OS::Mutex *writer_mutex = NULL;
+static OS::Condition *writer_cond = NULL;
+
+static volatile bool running = false;
+static volatile bool stopping = false;
+static volatile bool stopped = false;
+static volatile unsigned generation = 0;
+static OS::Thread *writer_thread = NULL;
+
+/*
+ * Timing of calls, enabled with the TRACE_TIMESTAMPS=1 environment variable.
+ */
+static bool timestamps = false;
+static unsigned long long timestamp_base = 0;
+
+bool defer_args = false;
+
+/*
+ * Call stacks, recorded with the TRACE_BACKTRACE=<depth> environment variable.
+ * A few more frames than asked are captured, to make up for those of the
+ * tracer itself, which are left out.  TRACE_BACKTRACE_FP=1 follows frame
+ * pointers instead of unwinding, which is much faster, but only sees through
+ * code built with them.
+ */
+#define MAX_BACKTRACE_DEPTH 64
+#define BACKTRACE_TRACER_FRAMES 8
+static unsigned backtrace_depth = 0;
+static bool backtrace_fp = false;
+static volatile long backtrace_count = 0;
+static char tracer_module[1024];
+
+
+/*
+ * Lock-free multiple producer, single consumer queue of events.
+ *
+ * See http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+ */
+
+static EventBuffer queue_stub(NULL);
+static EventBuffer * volatile queue_head = &queue_stub;
+static EventBuffer *queue_tail = &queue_stub;
+
+static void
+PushEvent(EventBuffer *event) {
+    event->next = NULL;
+    EventBuffer *prev = (EventBuffer *)OS::AtomicExchangePointer((void * volatile *)&queue_head, event);
+    prev->next = event;
+}
+
+static EventBuffer *
+PopEvent(void) {
+    EventBuffer *tail = queue_tail;
+    EventBuffer *next = tail->next;
+    if (tail == &queue_stub) {
+        if (!next) {
+            return NULL;
+        }
+        queue_tail = next;
+        tail = next;
+        next = next->next;
+    }
+    if (next) {
+        queue_tail = next;
+        return tail;
+    }
+    if (tail != queue_head) {
+        /* A producer is half-way through a push */
+        return NULL;
+    }
+    PushEvent(&queue_stub);
+    next = tail->next;
+    if (next) {
+        queue_tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static inline bool
+QueueEmpty(void) {
+    return queue_tail == queue_head;
+}
+
+static void
+WakeWriter(void) {
+    OS::LockMutex(writer_mutex);
+    OS::SignalCondition(writer_cond);
+    OS::UnlockMutex(writer_mutex);
+}
+
+
+/*
+ * Writer thread.
+ */
+
+static Compressor *compressor = NULL;
+
+/*
+ * Flushing policy, set with the TRACE_FLUSH environment variable:
+ *
+ *   TRACE_FLUSH=call    flush after every call (slow, but survives anything)
+ *   TRACE_FLUSH=frame   flush at frame boundaries
+ *   TRACE_FLUSH=<ms>    flush every given number of milliseconds
+ *
+ * By default the trace is flushed both at frame boundaries and every second.
+ * Crashes and exits are handled separately, by draining the writer.
+ */
+static bool flush_calls = false;
+static bool flush_frames = true;
+static long long flush_interval = 1000000;
+
+static bool dirty = false;
+static long long last_flush = 0;
+
+static unsigned call_no = 0;
+static std::map<unsigned, unsigned> pending_calls;
+static SigSet sigs[SIG_KIND_COUNT];
+
+/*
+ * What goes into the index, see trace_file.hpp.
+ */
+struct ChunkInfo {
+    size_t chunk;
+    unsigned first_call;
+    unsigned first_frame;
+    unsigned blob_distance;
+};
+
+struct SigDef {
+    SigKind kind;
+    Id id;
+    size_t chunk;
+    std::string data;
+};
+
+static unsigned frame_no = 0;
+static std::vector<ChunkInfo> chunks;
+
+/* First call of every frame after frame_base */
+static std::deque<unsigned> frames;
+static unsigned frame_base = 0;
+
+/*
+ * One definition per signature.  These are kept even once the chunks they
+ * were written in are discarded from the ring, as the threads won't define
+ * them again.
+ */
+static std::vector<SigDef> sig_defs;
+
+/*
+ * Flight recorder mode, set with the TRACE_RING=<frames> environment
+ * variable: only the chunks of the last given number of frames are kept, in
+ * memory, and the trace file is written from them on exit, on a crash, or
+ * on SIGUSR1.  Every chunk can be decoded on its own, with the signatures in
+ * the index, so the kept frames make a valid trace.
+ *
+ * The chunks up to the end of the first frame, where applications usually
+ * set things up, are always kept too, but the GL state changed by the frames
+ * discarded in between is not recreated.
+ */
+static unsigned ring_frames = 0;
+static std::deque<size_t> ring_starts;
+static size_t ring_pinned = 0;
+static volatile bool dump_requested = false;
+
+/*
+ * Dump requests come from a signal handler, which can't wake the writer
+ * thread, so it checks for them this often (in microseconds) while idle.
+ */
+#define DUMP_POLL_INTERVAL 100000
+
+/* Nanoseconds per timestamp tick */
+static double timestamp_scale = 0;
+
+/* Last time written, which the next one is relative to */
+static long long last_time = 0;
+static size_t time_chunk = ~(size_t)0;
+
+static inline void
+FileWrite(const void *sBuffer, size_t dwBytesToWrite) {
+    if (compressor == NULL)
+        return;
+
+    compressor->write(sBuffer, dwBytesToWrite);
+}
+
+static inline void
+FileWriteByte(char c) {
+    FileWrite(&c, 1);
+}
+
+static inline void
+FileWriteUInt(unsigned long long value) {
+    char buf[ENCODED_UINT_MAX_SIZE];
+    FileWrite(buf, EncodeUInt(buf, value) - buf);
+}
+
+static void
+Flush(void) {
+    if (dirty && compressor) {
+        compressor->flush();
+        dirty = false;
+    }
+    if (flush_interval) {
+        last_flush = OS::GetTime();
+    }
+}
+
+/*
+ * Large blobs written in the last BLOB_REF_MAX_DISTANCE chunks, by hash.
+ * Collisions simply evict older entries.  Each entry keeps a copy of the
+ * encoded blob to compare against, as the chunks are gone to the compressor,
+ * up to BLOB_CACHE_SIZE bytes for all of them.
+ */
+struct BlobEntry {
+    size_t chunk;
+    unsigned long long hash;
+    size_t offset;
+    std::string data;
+};
+
+#define BLOB_TABLE_SIZE 4096
+#define BLOB_CACHE_SIZE (32*1024*1024)
+static BlobEntry blob_table[BLOB_TABLE_SIZE];
+static size_t blob_cache_size = 0;
+static size_t blob_chunk = ~(size_t)0;
+
+/* Whether application threads mark blobs, i.e., the file is chunked */
+static bool blob_refs = false;
+
+static void
+ForgetBlob(BlobEntry &entry) {
+    blob_cache_size -= entry.data.size();
+    std::string().swap(entry.data);
+}
+
+static void
+ResetBlobs(void) {
+    for (size_t i = 0; i < BLOB_TABLE_SIZE; ++i) {
+        ForgetBlob(blob_table[i]);
+    }
+    blob_chunk = ~(size_t)0;
+}
+
+/**
+ * Write a blob value, or a reference to an identical blob written recently.
+ */
+static void
+WriteBlob(const char *buf, size_t length) {
+    if (!compressor || !compressor->chunked()) {
+        FileWrite(buf, length);
+        return;
+    }
+
+    /* The ring drops old chunks, so references can't leave the current one */
+    size_t max_distance = ring_frames ? 0 : BLOB_REF_MAX_DISTANCE;
+
+    size_t chunk = compressor->currentChunk();
+    if (chunk != blob_chunk) {
+        blob_chunk = chunk;
+        for (size_t i = 0; i < BLOB_TABLE_SIZE; ++i) {
+            if (chunk - blob_table[i].chunk > max_distance) {
+                ForgetBlob(blob_table[i]);
+            }
+        }
+    }
+
+    unsigned long long hash = hash64(buf, length);
+    BlobEntry &entry = blob_table[hash & (BLOB_TABLE_SIZE - 1)];
+    if (entry.hash == hash &&
+        entry.data.size() == length &&
+        memcmp(entry.data.data(), buf, length) == 0) {
+        unsigned distance = chunk - entry.chunk;
+        FileWriteByte(Trace::TYPE_BLOB_REF);
+        FileWriteUInt(distance);
+        FileWriteUInt(entry.offset);
+        if (distance > chunks.back().blob_distance) {
+            chunks.back().blob_distance = distance;
+        }
+        return;
+    }
+
+    ForgetBlob(entry);
+    if (blob_cache_size + length <= BLOB_CACHE_SIZE) {
+        entry.chunk = chunk;
+        entry.hash = hash;
+        entry.offset = compressor->blockSize();
+        entry.data.assign(buf, length);
+        blob_cache_size += length;
+    }
+    FileWrite(buf, length);
+}
+
+/**
+ * Measure the length of a timestamp tick against the OS clock.
+ */
+static double
+CalibrateTimestamps(void) {
+    long long start_time = OS::GetTime();
+    unsigned long long start = OS::GetTimestamp();
+    OS::Sleep(20000);
+    long long end_time = OS::GetTime();
+    unsigned long long end = OS::GetTimestamp();
+    if (end == start) {
+        return 0;
+    }
+    return (end_time - start_time) * 1000.0 / (double)(end - start);
+}
+
+/**
+ * Write the time of an event.  Times are delta encoded, from the start of
+ * each chunk, so that readers can start at any chunk.
+ */
+static void
+WriteTime(unsigned long long timestamp) {
+    if (compressor && compressor->chunked() &&
+        compressor->currentChunk() != time_chunk) {
+        time_chunk = compressor->currentChunk();
+        last_time = 0;
+    }
+
+    long long time = (long long)((long long)(timestamp - timestamp_base) * timestamp_scale);
+    long long delta = time - last_time;
+    last_time = time;
+
+    FileWriteByte(Trace::CALL_TIME);
+    FileWriteUInt(((unsigned long long)delta << 1) ^ (unsigned long long)(delta >> 63));
+}
+
+/**
+ * Note where chunks start, for the index.
+ */
+static inline void
+IndexChunk(void) {
+    size_t chunk = compressor->currentChunk();
+    if (chunks.empty() || chunks.back().chunk != chunk) {
+        ChunkInfo info;
+        info.chunk = chunk;
+        info.first_call = call_no;
+        info.first_frame = frame_no;
+        info.blob_distance = 0;
+        chunks.push_back(info);
+    }
+}
+
+/**
+ * Note where a frame starts, discarding the frames that no longer fit in the
+ * ring.
+ */
+static void
+RingFrame(void) {
+    /* The frame was just flushed, so this chunk holds nothing from it */
+    if (!ring_pinned) {
+        ring_pinned = compressor->currentChunk();
+    }
+
+    ring_starts.push_back(compressor->currentChunk());
+    if (ring_starts.size() <= ring_frames + 1) {
+        return;
+    }
+
+    ring_starts.pop_front();
+    size_t first = ring_starts.front();
+    if (first <= ring_pinned) {
+        return;
+    }
+    compressor->discard(ring_pinned, first);
+
+    size_t begin = 0;
+    while (begin < chunks.size() && chunks[begin].chunk < ring_pinned) {
+        ++begin;
+    }
+    size_t end = begin;
+    while (end < chunks.size() && chunks[end].chunk < first) {
+        ++end;
+    }
+    chunks.erase(chunks.begin() + begin, chunks.begin() + end);
+
+    /* Drop the frames that started before what is left after the gap */
+    unsigned base = begin < chunks.size() ? chunks[begin].first_frame : frame_no;
+    while (frame_base < base && !frames.empty()) {
+        frames.pop_front();
+        ++frame_base;
+    }
+}
+
+static void
+WriteEvent(EventBuffer *event) {
+    if (event->type == EVENT_FRAME) {
+        ++frame_no;
+        frames.push_back(call_no);
+        if (flush_frames) {
+            Flush();
+        }
+        if (ring_frames && compressor) {
+            RingFrame();
+        }
+        return;
+    }
+
+    std::map<unsigned, unsigned>::iterator it;
+    if (event->type == EVENT_LEAVE) {
+        it = pending_calls.find(event->call);
+        if (it == pending_calls.end()) {
+            /* Call entered before the trace was (re)opened */
+            return;
+        }
+    }
+
+    if (compressor) {
+        IndexChunk();
+    }
+
+    if (event->type == EVENT_ENTER) {
+        pending_calls[event->call] = call_no;
+        ++call_no;
+        FileWriteByte(Trace::EVENT_ENTER);
+    } else {
+        FileWriteByte(Trace::EVENT_LEAVE);
+        FileWriteUInt(it->second);
+        pending_calls.erase(it);
+    }
+
+    size_t pos = 0;
+    for (std::vector<EventRef>::const_iterator it = event->refs.begin(); it != event->refs.end(); ++it) {
+        FileWrite(event->buf + pos, it->offset - pos);
+        if (it->kind == REF_BLOB) {
+            WriteBlob(event->buf + it->offset, it->length);
+        } else if (!sigs[it->kind].insert(it->id)) {
+            FileWrite(event->buf + it->offset, it->length);
+
+            if (compressor) {
+                SigDef def;
+                def.kind = (SigKind)it->kind;
+                def.id = it->id;
+                def.chunk = compressor->currentChunk();
+                sig_defs.push_back(def);
+                sig_defs.back().data.assign(event->buf + it->offset, it->length);
+            }
+        }
+        pos = it->offset + it->length;
+    }
+    FileWrite(event->buf + pos, event->size - pos);
+    /* The time goes last, so the call details are ended here */
+    if (timestamps) {
+        WriteTime(event->time);
+    }
+    FileWriteByte(Trace::CALL_END);
+    if (compressor) {
+        compressor->endEvent();
+    }
+
+    dirty = true;
+    if (flush_calls) {
+        Flush();
+    }
+}
+
+static inline void Write(const void *sBuffer, size_t dwBytesToWrite);
+
+/*
+ * The writer thread encodes deferred arguments as if it were the thread that
+ * made the call, into a buffer of its own.
+ */
+static ThreadState *writer_state = NULL;
+static EventBuffer *expanded = NULL;
+
+static ThreadState *GetThreadState(void);
+
+static EventBuffer *
+ExpandEvent(EventBuffer *event) {
+    if (!writer_state) {
+        writer_state = new ThreadState(0);
+        expanded = new EventBuffer(writer_state);
+    }
+    t_state = writer_state;
+    GetThreadState();
+
+    expanded->type = event->type;
+    expanded->call = event->call;
+    expanded->time = event->time;
+    expanded->size = 0;
+    expanded->refs = event->refs;
+
+    writer_state->event = expanded;
+    t_encoder = expanded;
+    Write(event->buf, event->args_offset);
+    event->dumper(event->buf + event->args_offset);
+    writer_state->event = NULL;
+    t_encoder = NULL;
+
+    return expanded;
+}
+
+static void
+RecycleEvent(EventBuffer *event) {
+    ThreadState *state = event->state;
+    EventBuffer *head;
+    do {
+        head = state->returned;
+        event->next = head;
+    } while (!OS::AtomicCompareExchangePointer((void * volatile *)&state->returned, head, event));
+}
+
+static inline void
+IndexUInt(std::string &index, unsigned long long value) {
+    char buf[ENCODED_UINT_MAX_SIZE];
+    index.append(buf, EncodeUInt(buf, value) - buf);
+}
+
+/**
+ * Append the index of chunks, frames and signatures, so that readers can
+ * start anywhere in the trace.
+ */
+static void
+WriteIndex(void) {
+    const std::vector<unsigned long long> &offsets = compressor->sync();
+    std::string index;
+
+    IndexUInt(index, chunks.size());
+    for (std::vector<ChunkInfo>::const_iterator it = chunks.begin(); it != chunks.end(); ++it) {
+        assert(it->chunk < offsets.size());
+        IndexUInt(index, offsets[it->chunk]);
+        IndexUInt(index, it->first_call);
+        IndexUInt(index, it->first_frame);
+        IndexUInt(index, it->blob_distance);
+    }
+
+    /* frames starts with the frame after frame_base */
+    IndexUInt(index, frame_base + 1);
+    IndexUInt(index, frames.size());
+    for (std::deque<unsigned>::const_iterator it = frames.begin(); it != frames.end(); ++it) {
+        IndexUInt(index, *it);
+    }
+
+    IndexUInt(index, sig_defs.size());
+    for (std::vector<SigDef>::const_iterator it = sig_defs.begin(); it != sig_defs.end(); ++it) {
+        assert(it->chunk < offsets.size());
+        IndexUInt(index, it->kind);
+        IndexUInt(index, it->id);
+        IndexUInt(index, offsets[it->chunk]);
+        index.append(it->data);
+    }
+
+    compressor->writeIndex(index.data(), index.size());
+}
+
+/**
+ * Block until an event is queued, the writer is stopped, or the next timed
+ * flush is due.
+ */
+static void
+WaitForEvents(void) {
+    long long timeout = 0;
+    if (dirty && flush_interval) {
+        timeout = last_flush + flush_interval - OS::GetTime();
+        if (timeout <= 0) {
+            return;
+        }
+    } else if (ring_frames) {
+        timeout = DUMP_POLL_INTERVAL;
+    }
+
+    OS::LockMutex(writer_mutex);
+
+    /*
+     * Both the announcement and the push of an event are full barriers, so
+     * either the queue is seen non-empty here, or the pushing thread sees the
+     * announcement and signals once the wait below has released the mutex.
+     */
+    OS::AtomicExchange(&writer_sleeping, 1);
+    if (QueueEmpty() && !stopping) {
+        if (timeout) {
+            OS::TimedWaitCondition(writer_cond, writer_mutex, timeout);
+        } else {
+            OS::WaitCondition(writer_cond, writer_mutex);
+        }
+    }
+    OS::AtomicExchange(&writer_sleeping, 0);
+
+    OS::UnlockMutex(writer_mutex);
+}
+
+static void
+WriterThread(void *) {
+    unsigned count = 0;
+    unsigned idle = 0;
+    if (timestamps) {
+        timestamp_scale = CalibrateTimestamps();
+    }
+    last_flush = OS::GetTime();
+    for (;;) {
+        EventBuffer *event = PopEvent();
+        if (event) {
+            long size = event->size;
+            WriteEvent(event->dumper ? ExpandEvent(event) : event);
+            RecycleEvent(event);
+            OS::AtomicAdd(&queued_bytes, -size);
+            idle = 0;
+
+            /* Don't query the time on every single call */
+            if (++count % 256 != 0) {
+                continue;
+            }
+        } else {
+            if (stopping && QueueEmpty()) {
+                break;
+            }
+
+            /* Spin a little before going to sleep */
+            if (++idle < 64) {
+                continue;
+            }
+            idle = 0;
+            WaitForEvents();
+        }
+
+        if (dirty && flush_interval &&
+            OS::GetTime() - last_flush >= flush_interval) {
+            Flush();
+        }
+
+        if (dump_requested && compressor) {
+            dump_requested = false;
+            OS::DebugMessage("apitrace: writing the last %u frames\n", ring_frames);
+            WriteIndex();
+        }
+    }
+    Flush();
+    stopped = true;
+}
+
+/**
+ * Wait for the writer thread to write out all pending events.
+ *
+ * A timeout (in microseconds) can be given for when the process is in an
+ * unknown state, e.g. crashing, and the writer thread might never finish.
+ * Returns whether the writer thread finished.
+ */
+static bool
+StopWriter(long long timeout) {
+    if (!writer_thread) {
+        return true;
+    }
+
+    stopping = true;
+    WakeWriter();
+    if (timeout) {
+        long long deadline = OS::GetTime() + timeout;
+        while (!stopped) {
+            if (OS::GetTime() >= deadline) {
+                OS::DebugMessage("apitrace: warning: timed out flushing the trace\n");
+                return false;
+            }
+            OS::Sleep(1000);
+        }
+    }
+    OS::JoinThread(writer_thread);
+    writer_thread = NULL;
+    stopping = false;
+    stopped = false;
+    return true;
+}
+
+
+static void
+UserCallback(void) {
+    dump_requested = true;
+}
+
 static void _Close(void) {
-    if (g_gzFile != NULL) {
-        gzclose(g_gzFile);
-        g_gzFile = NULL;
+    if (compressor != NULL) {
+        WriteIndex();
+        delete compressor;
+        compressor = NULL;
     }
 }
 
@@ -70,198 +899,562 @@ static void _Open(const char *szExtension) {
 
         for (;;) {
             FILE *file;
- 
+
             if (dwCounter)
                 snprintf(szFileName, PATH_MAX, "%s%c%s.%u.%s", szCurrentDir, PATH_SEP, szProcessName, dwCounter, szExtension);
             else
                 snprintf(szFileName, PATH_MAX, "%s%c%s.%s", szCurrentDir, PATH_SEP, szProcessName, szExtension);
- 
+
             file = fopen(szFileName, "rb");
             if (file == NULL)
                 break;
- 
+
             fclose(file);
- 
+
             ++dwCounter;
         }
     }
 
     OS::DebugMessage("apitrace: tracing to %s\n", szFileName);
 
-    g_gzFile = gzopen(szFileName, "wb");
-}
+    /*
+     * Compression codec, set with the TRACE_CODEC environment variable:
+     *
+     *   TRACE_CODEC=lz      fast LZ compression (default)
+     *   TRACE_CODEC=zlib    slower, but smaller traces
+     *   TRACE_CODEC=gzip    single gzip stream, readable by older versions
+     *   TRACE_CODEC=none    no compression at all
+     */
+    Codec codec = CODEC_LZ;
+    const char *codec_name = getenv("TRACE_CODEC");
+    if (codec_name) {
+        if (strcmp(codec_name, "zlib") == 0) {
+            codec = CODEC_ZLIB;
+        } else if (strcmp(codec_name, "gzip") == 0) {
+            codec = CODEC_GZIP;
+        } else if (strcmp(codec_name, "none") == 0) {
+            codec = CODEC_STORED;
+        } else if (strcmp(codec_name, "lz") != 0) {
+            OS::DebugMessage("apitrace: warning: unknown codec %s\n", codec_name);
+        }
+    }
 
-static inline void Write(const void *sBuffer, size_t dwBytesToWrite) {
-    if (g_gzFile == NULL)
-        return;
+    const char *ring = getenv("TRACE_RING");
+    ring_frames = ring ? atoi(ring) : 0;
+    if (ring_frames && codec == CODEC_GZIP) {
+        OS::DebugMessage("apitrace: warning: TRACE_RING does not support gzip, using lz\n");
+    }
 
-    gzwrite(g_gzFile, sBuffer, dwBytesToWrite);
-}
+    compressor = new Compressor;
+    if (!compressor->open(szFileName, codec, ring_frames != 0)) {
+        OS::DebugMessage("apitrace: error: failed to open %s\n", szFileName);
+        delete compressor;
+        compressor = NULL;
+    }
 
-static inline void 
-WriteByte(char c) {
-    Write(&c, 1);
-}
+    /* Only chunks can be referred back to, so don't bother otherwise */
+    blob_refs = compressor && compressor->chunked();
 
-void inline 
-WriteUInt(unsigned long long value) {
-    char buf[2 * sizeof value];
-    unsigned len;
+    const char *timing = getenv("TRACE_TIMESTAMPS");
+    timestamps = timing && strcmp(timing, "0") != 0;
 
-    len = 0;
-    do {
-        assert(len < sizeof buf);
-        buf[len] = 0x80 | (value & 0x7f);
-        value >>= 7;
-        ++len;
-    } while (value);
+    const char *defer = getenv("TRACE_DEFER");
+    defer_args = defer && strcmp(defer, "0") != 0;
 
-    assert(len);
-    buf[len - 1] &= 0x7f;
+    const char *backtrace = getenv("TRACE_BACKTRACE");
+    if (backtrace) {
+        int depth = atoi(backtrace);
+        if (depth > MAX_BACKTRACE_DEPTH - BACKTRACE_TRACER_FRAMES) {
+            depth = MAX_BACKTRACE_DEPTH - BACKTRACE_TRACER_FRAMES;
+        }
+        unsigned long long offset;
+        if (depth > 0 &&
+            OS::GetModuleOffset((const void *)&BeginEnter, tracer_module, sizeof tracer_module, &offset)) {
+            backtrace_depth = depth;
+        }
 
-    Write(buf, len);
-}
+        const char *fp = getenv("TRACE_BACKTRACE_FP");
+        backtrace_fp = fp && strcmp(fp, "0") != 0;
+    }
+
+    const char *flush = getenv("TRACE_FLUSH");
+    if (flush) {
+        if (strcmp(flush, "call") == 0) {
+            flush_calls = true;
+            flush_frames = false;
+            flush_interval = 0;
+        } else if (strcmp(flush, "frame") == 0) {
+            flush_calls = false;
+            flush_frames = true;
+            flush_interval = 0;
+        } else {
+            flush_calls = false;
+            flush_frames = false;
+            flush_interval = atol(flush) * 1000LL;
+        }
+    }
 
-static inline void 
-WriteFloat(float value) {
-    assert(sizeof value == 4);
-    Write((const char *)&value, sizeof value);
+    /* The ring is cut at frame boundaries, and only written out when asked */
+    if (ring_frames) {
+        flush_calls = false;
+        flush_frames = true;
+        flush_interval = 0;
+    }
 }
 
-static inline void 
-WriteDouble(double value) {
-    assert(sizeof value == 8);
-    Write((const char *)&value, sizeof value);
+static void
+ExitCallback(void) {
+    Close();
 }
 
-static inline void 
-WriteString(const char *str) {
-    size_t len = strlen(str);
-    WriteUInt(len);
-    Write(str, len);
+/**
+ * Called when the application crashes.  Salvage as much of the trace as
+ * possible, without waiting forever, as the process state is unknown.
+ */
+static void
+ExceptionCallback(void) {
+    if (running) {
+        OS::DebugMessage("apitrace: flushing trace due to an exception\n");
+        if (StopWriter(2000000)) {
+            _Close();
+        }
+        running = false;
+    }
 }
 
 void Open(void) {
-    if (!g_gzFile) {
+    if (running) {
+        return;
+    }
+
+    OS::AcquireMutex();
+    if (!running) {
+        static bool registered = false;
+        if (!registered) {
+            atexit(ExitCallback);
+            OS::SetExceptionCallback(ExceptionCallback);
+            registered = true;
+        }
+
         _Open("trace");
-        WriteUInt(TRACE_VERSION);
+        timestamp_base = OS::GetTimestamp();
+        FileWriteUInt(TRACE_VERSION);
+        if (compressor) {
+            /* Keep the version out of the way of seeking */
+            compressor->flush();
+            if (ring_frames) {
+                ring_starts.push_back(compressor->currentChunk());
+            }
+        }
+
+        static bool user_registered = false;
+        if (ring_frames && !user_registered) {
+            OS::SetUserCallback(UserCallback);
+            user_registered = true;
+        }
+
+        /* Invalidate the signatures cached by every thread */
+        ++generation;
+
+        if (!writer_mutex) {
+            writer_mutex = OS::NewMutex();
+            writer_cond = OS::NewCondition();
+        }
+
+        writer_thread = OS::StartThread(WriterThread, NULL);
+        running = true;
     }
+    OS::ReleaseMutex();
 }
 
-static unsigned call_no = 0;
+/**
+ * Match a function name against a pattern where '*' stands for any
+ * characters.
+ */
+static bool
+MatchPattern(const char *pattern, const char *pattern_end, const char *name) {
+    while (pattern != pattern_end) {
+        if (*pattern == '*') {
+            ++pattern;
+            do {
+                if (MatchPattern(pattern, pattern_end, name)) {
+                    return true;
+                }
+            } while (*name++);
+            return false;
+        }
+        if (*pattern++ != *name++) {
+            return false;
+        }
+    }
+    return *name == '\0';
+}
 
-inline bool lookup(std::vector<bool> &map, size_t index) {
-    if (index >= map.size()) {
-        map.resize(index + 1);
+/*
+ * Calls left out of the trace, set with the TRACE_FILTER environment
+ * variable, as a comma separated list of function name patterns, e.g.:
+ *
+ *   TRACE_FILTER=glGet*,glIs*
+ *
+ * The "nosideeffects" entry matches all the functions that are not replayed
+ * when retracing, such as most queries.
+ */
+bool IsFiltered(const FunctionSig &function, bool sideeffects) {
+    const char *filter = getenv("TRACE_FILTER");
+    if (!filter) {
         return false;
-    } else {
-        return map[index];
     }
-}
 
-static std::vector<bool> functions;
-static std::vector<bool> structs;
-static std::vector<bool> enums;
-static std::vector<bool> bitmasks;
+    bool filtered = false;
+    while (!filtered) {
+        const char *end = strchr(filter, ',');
+        if (!end) {
+            end = filter + strlen(filter);
+        }
+        size_t length = end - filter;
+        if (length == strlen("nosideeffects") &&
+            strncmp(filter, "nosideeffects", length) == 0) {
+            filtered = !sideeffects;
+        } else if (length) {
+            filtered = MatchPattern(filter, end, function.name);
+        }
+        if (!*end) {
+            break;
+        }
+        filter = end + 1;
+    }
 
+    if (filtered) {
+        OS::DebugMessage("apitrace: leaving out %s\n", function.name);
+    }
+    return filtered;
+}
 
 void Close(void) {
-    _Close();
-    call_no = 0;
-    functions = std::vector<bool>();
-    structs = std::vector<bool>();
-    enums = std::vector<bool>();
-    bitmasks = std::vector<bool>();
+    OS::AcquireMutex();
+    if (running) {
+        StopWriter(0);
+        running = false;
+
+        _Close();
+        call_no = 0;
+        pending_calls.clear();
+        for (unsigned kind = 0; kind < SIG_KIND_COUNT; ++kind) {
+            sigs[kind] = SigSet();
+        }
+        ResetBlobs();
+        frame_no = 0;
+        chunks.clear();
+        frames.clear();
+        frame_base = 0;
+        sig_defs.clear();
+        last_time = 0;
+        time_chunk = ~(size_t)0;
+        ring_starts.clear();
+        ring_pinned = 0;
+    }
+    OS::ReleaseMutex();
 }
 
-unsigned BeginEnter(const FunctionSig &function) {
-    OS::AcquireMutex();
-    Open();
-    WriteByte(Trace::EVENT_ENTER);
-    WriteUInt(function.id);
-    if (!lookup(functions, function.id)) {
-        WriteString(function.name);
-        WriteUInt(function.num_args);
-        for (unsigned i = 0; i < function.num_args; ++i) {
-            WriteString(function.args[i]);
+
+/*
+ * Application threads.
+ */
+
+static ThreadState *
+GetThreadState(void) {
+    ThreadState *state = t_state;
+    if (!state) {
+        state = new ThreadState(OS::AtomicIncrement(&thread_count) - 1);
+        t_state = state;
+    }
+    if (state->generation != generation) {
+        state->generation = generation;
+        for (unsigned kind = 0; kind < SIG_KIND_COUNT; ++kind) {
+            state->sigs[kind].clear();
         }
-        functions[function.id] = true;
     }
-    return call_no++;
+    return state;
 }
 
-void EndEnter(void) {
-    WriteByte(Trace::CALL_END);
-    gzflush(g_gzFile, Z_SYNC_FLUSH);
-    OS::ReleaseMutex();
+static void
+BeginEvent(ThreadState *state, int type, unsigned call) {
+    assert(!state->event);
+
+    EventBuffer *event = state->free;
+    if (!event) {
+        event = (EventBuffer *)OS::AtomicExchangePointer((void * volatile *)&state->returned, NULL);
+        if (!event) {
+            event = new EventBuffer(state);
+        }
+    }
+    state->free = event->next;
+
+    event->next = NULL;
+    event->type = type;
+    event->call = call;
+    event->size = 0;
+    event->refs.clear();
+    event->dumper = NULL;
+
+    state->event = event;
+    t_encoder = event;
 }
 
-void BeginLeave(unsigned call) {
-    OS::AcquireMutex();
-    WriteByte(Trace::EVENT_LEAVE);
-    WriteUInt(call);
+static void
+EndEvent(void) {
+    ThreadState *state = t_state;
+    EventBuffer *event = state->event;
+    state->event = NULL;
+    t_encoder = NULL;
+
+    if (!running) {
+        /* Nobody to write this event */
+        event->next = state->free;
+        state->free = event;
+        return;
+    }
+
+    /*
+     * The call is about to be dispatched.  Any wait for the writer below is
+     * the tracer's, not the call's.
+     */
+    if (timestamps && event->type == Trace::EVENT_ENTER) {
+        event->time = OS::GetTimestamp();
+    }
+
+    /* Wait for the writer to catch up if it's too far behind */
+    if (OS::AtomicAdd(&queued_bytes, event->size) > MAX_QUEUED_BYTES) {
+        while (queued_bytes > MAX_QUEUED_BYTES && running && !stopping) {
+            OS::Sleep(100);
+        }
+    }
+
+    PushEvent(event);
+    if (writer_sleeping && OS::AtomicExchange(&writer_sleeping, 0)) {
+        WakeWriter();
+    }
 }
 
-void EndLeave(void) {
-    WriteByte(Trace::CALL_END);
-    gzflush(g_gzFile, Z_SYNC_FLUSH);
-    OS::ReleaseMutex();
+bool GrowEncoder(Encoder *encoder, size_t size) {
+    const size_t max_size = ~(size_t)0;
+    if (size > max_size - encoder->size) {
+        OS::DebugMessage("apitrace: warning: %s: can't encode %lu bytes\n", __FUNCTION__, (unsigned long)size);
+        return false;
+    }
+    size_t needed = encoder->size + size;
+    size_t capacity = encoder->capacity ? encoder->capacity : 4096;
+    while (capacity < needed) {
+        capacity = capacity <= max_size/2 ? capacity * 2 : needed;
+    }
+    char *buf = (char *)realloc(encoder->buf, capacity);
+    if (!buf) {
+        OS::DebugMessage("apitrace: warning: %s: out of memory\n", __FUNCTION__);
+        return false;
+    }
+    encoder->buf = buf;
+    encoder->capacity = capacity;
+    return true;
 }
 
-void BeginArg(unsigned index) {
-    WriteByte(Trace::CALL_ARG);
-    WriteUInt(index);
+static inline void Write(const void *sBuffer, size_t dwBytesToWrite) {
+    char *ptr = BeginEncode(dwBytesToWrite);
+    if (ptr) {
+        memcpy(ptr, sBuffer, dwBytesToWrite);
+        EndEncode(ptr + dwBytesToWrite);
+    }
 }
 
-void BeginReturn(void) {
-    WriteByte(Trace::CALL_RET);
+static inline void
+WriteByte(char c) {
+    EncodeTag(c);
 }
 
-void BeginArray(size_t length) {
-    WriteByte(Trace::TYPE_ARRAY);
-    WriteUInt(length);
+static inline void
+WriteUInt(unsigned long long value) {
+    char *ptr = BeginEncode(ENCODED_UINT_MAX_SIZE);
+    if (ptr) {
+        EndEncode(EncodeUInt(ptr, value));
+    }
 }
 
-void BeginStruct(const StructSig *sig) {
-    WriteByte(Trace::TYPE_STRUCT);
-    WriteUInt(sig->id);
-    if (!lookup(structs, sig->id)) {
-        WriteString(sig->name);
-        WriteUInt(sig->num_members);
-        for (unsigned i = 0; i < sig->num_members; ++i) {
-            WriteString(sig->members[i]);
+static inline void
+WriteString(const char *str) {
+    size_t len = strlen(str);
+    WriteUInt(len);
+    Write(str, len);
+}
+
+/**
+ * Start a signature definition, returning whether the signature still needs
+ * to be defined by this thread.
+ */
+static inline bool
+BeginSig(SigKind kind, Id id) {
+    ThreadState *state = t_state;
+    if (state->sigs[kind].insert(id)) {
+        return false;
+    }
+
+    EventRef sig;
+    sig.kind = kind;
+    sig.id = id;
+    sig.offset = state->event->size;
+    sig.length = 0;
+    state->event->refs.push_back(sig);
+    return true;
+}
+
+static inline void
+EndSig(void) {
+    EventBuffer *event = t_state->event;
+    EventRef &sig = event->refs.back();
+    sig.length = event->size - sig.offset;
+}
+
+/**
+ * Write the frames of a call stack, as module and offset pairs, leaving out
+ * the innermost ones that belong to the tracer.  This is only done once per
+ * stack, so resolving the modules needs not be fast.
+ */
+static void
+WriteBacktraceSig(void * const *frames, unsigned count) {
+    std::vector<std::string> modules;
+    std::vector<unsigned long long> offsets;
+    bool inside = true;
+    for (unsigned i = 0; i < count && modules.size() < backtrace_depth; ++i) {
+        char module[1024];
+        unsigned long long offset;
+        if (!OS::GetModuleOffset(frames[i], module, sizeof module, &offset)) {
+            module[0] = 0;
+            offset = (unsigned long long)(size_t)frames[i];
+        }
+        if (inside && strcmp(module, tracer_module) == 0) {
+            continue;
         }
-        structs[sig->id] = true;
+        inside = false;
+        modules.push_back(module);
+        offsets.push_back(offset);
+    }
+
+    WriteUInt(modules.size());
+    for (unsigned i = 0; i < modules.size(); ++i) {
+        WriteString(modules[i].c_str());
+        WriteUInt(offsets[i]);
     }
 }
 
-void LiteralBool(bool value) {
-    WriteByte(value ? Trace::TYPE_TRUE : Trace::TYPE_FALSE);
+static void
+WriteBacktrace(ThreadState *state) {
+    void *frames[MAX_BACKTRACE_DEPTH];
+    unsigned count = backtrace_fp
+        ? OS::GetFrameBacktrace(frames, backtrace_depth + BACKTRACE_TRACER_FRAMES)
+        : OS::GetBacktrace(frames, backtrace_depth + BACKTRACE_TRACER_FRAMES);
+    if (!count) {
+        return;
+    }
+
+    /*
+     * Stacks are told apart by the raw return addresses, which is cheap.
+     * Those with the same hash are compared in full, so that a collision
+     * never gives a call the stack of another.
+     */
+    unsigned long long hash = hash64(frames, count * sizeof frames[0]);
+    std::multimap<unsigned long long, BacktraceEntry>::iterator it, end;
+    for (it = state->backtraces.lower_bound(hash), end = state->backtraces.upper_bound(hash); it != end; ++it) {
+        const std::vector<void *> &seen = it->second.frames;
+        if (seen.size() == count && memcmp(&seen[0], frames, count * sizeof frames[0]) == 0) {
+            break;
+        }
+    }
+    if (it == end) {
+        BacktraceEntry entry;
+        entry.id = (Id)OS::AtomicIncrement(&backtrace_count) - 1;
+        entry.frames.assign(frames, frames + count);
+        it = state->backtraces.insert(std::make_pair(hash, entry));
+    }
+    Id id = it->second.id;
+
+    WriteByte(Trace::CALL_BACKTRACE);
+    WriteUInt(id);
+    if (BeginSig(SIG_BACKTRACE, id)) {
+        WriteBacktraceSig(frames, count);
+        EndSig();
+    }
 }
 
-void LiteralSInt(signed long long value) {
-    if (value < 0) {
-        WriteByte(Trace::TYPE_SINT);
-        WriteUInt(-value);
-    } else {
-        WriteByte(Trace::TYPE_UINT);
-        WriteUInt(value);
+unsigned BeginEnter(const FunctionSig &function) {
+    Open();
+    ThreadState *state = GetThreadState();
+    unsigned call = (unsigned)OS::AtomicIncrement(&call_count) - 1;
+    BeginEvent(state, Trace::EVENT_ENTER, call);
+    WriteUInt(function.id);
+    if (BeginSig(SIG_FUNCTION, function.id)) {
+        if (function.encoded) {
+            Write(function.encoded, function.encoded_size);
+        } else {
+            WriteString(function.name);
+            WriteUInt(function.num_args);
+            for (unsigned i = 0; i < function.num_args; ++i) {
+                WriteString(function.args[i]);
+            }
+        }
+        EndSig();
+    }
+    WriteByte(Trace::CALL_THREAD);
+    WriteUInt(state->id);
+    if (backtrace_depth) {
+        WriteBacktrace(state);
     }
+    return call;
 }
 
-void LiteralUInt(unsigned long long value) {
-    WriteByte(Trace::TYPE_UINT);
-    WriteUInt(value);
+void DeferArgs(ArgsDumper dumper, const void *args, size_t size) {
+    EventBuffer *event = t_state->event;
+    assert(!event->dumper);
+    event->dumper = dumper;
+    event->args_offset = event->size;
+    Write(args, size);
 }
 
-void LiteralFloat(float value) {
-    WriteByte(Trace::TYPE_FLOAT);
-    WriteFloat(value);
+void EndEnter(void) {
+    EndEvent();
 }
 
-void LiteralDouble(double value) {
-    WriteByte(Trace::TYPE_DOUBLE);
-    WriteDouble(value);
+void BeginLeave(unsigned call) {
+    unsigned long long time = timestamps ? OS::GetTimestamp() : 0;
+    ThreadState *state = GetThreadState();
+    BeginEvent(state, Trace::EVENT_LEAVE, call);
+    state->event->time = time;
+}
+
+void EndLeave(void) {
+    EndEvent();
+}
+
+void EndFrame(void) {
+    if (!running) {
+        return;
+    }
+    BeginEvent(GetThreadState(), EVENT_FRAME, 0);
+    EndEvent();
+}
+
+void BeginStruct(const StructSig *sig) {
+    WriteByte(Trace::TYPE_STRUCT);
+    WriteUInt(sig->id);
+    if (BeginSig(SIG_STRUCT, sig->id)) {
+        if (sig->encoded) {
+            Write(sig->encoded, sig->encoded_size);
+        } else {
+            WriteString(sig->name);
+            WriteUInt(sig->num_members);
+            for (unsigned i = 0; i < sig->num_members; ++i) {
+                WriteString(sig->members[i]);
+            }
+        }
+        EndSig();
+    }
 }
 
 void LiteralString(const char *str) {
@@ -297,27 +1490,91 @@ void LiteralBlob(const void *data, size_t size) {
         LiteralNull();
         return;
     }
+
+    ThreadState *state = t_state;
+    bool dedup = blob_refs && size >= BLOB_REF_MIN_SIZE && state && state->event;
+    size_t offset = dedup ? state->event->size : 0;
+
     WriteByte(Trace::TYPE_BLOB);
     WriteUInt(size);
     if (size) {
         Write(data, size);
     }
+
+    if (dedup) {
+        EventRef blob;
+        blob.kind = REF_BLOB;
+        blob.id = 0;
+        blob.offset = offset;
+        blob.length = state->event->size - offset;
+        state->event->refs.push_back(blob);
+    }
+}
+
+/**
+ * Write only the size bytes found offset bytes into data, to be read back as
+ * a pointer to data.
+ */
+void LiteralBlobOffset(const void *data, size_t offset, size_t size) {
+    if (!data) {
+        LiteralNull();
+        return;
+    }
+
+    if (offset) {
+        WriteByte(Trace::TYPE_BLOB_OFFSET);
+        WriteUInt(offset);
+    }
+    LiteralBlob((const char *)data + offset, size);
+}
+
+void LiteralArray(Type type, size_t size, const void *values, size_t length) {
+    const size_t header_size = 2 + 2*ENCODED_UINT_MAX_SIZE;
+    if (!values || (size && length > (~(size_t)0 - header_size) / size)) {
+        LiteralNull();
+        return;
+    }
+
+    /* Reserve room for the whole array at once, so that it is never cut
+     * short */
+    size_t data_size = size*length;
+    char *ptr = BeginEncode(header_size + data_size);
+    if (!ptr) {
+        LiteralNull();
+        return;
+    }
+
+    *ptr++ = (char)Trace::TYPE_SCALAR_ARRAY;
+    *ptr++ = (char)type;
+    ptr = EncodeUInt(ptr, size);
+    ptr = EncodeUInt(ptr, length);
+
+    if (size > 1 && Trace::HostIsBigEndian()) {
+        Trace::SwapScalars(ptr, (const char *)values, size, length);
+    } else {
+        memcpy(ptr, values, data_size);
+    }
+    EndEncode(ptr + data_size);
 }
 
 void LiteralEnum(const EnumSig *sig) {
     WriteByte(Trace::TYPE_ENUM);
     WriteUInt(sig->id);
-    if (!lookup(enums, sig->id)) {
-        WriteString(sig->name);
+    if (BeginSig(SIG_ENUM, sig->id)) {
+        if (sig->encoded) {
+            Write(sig->encoded, sig->encoded_size);
+        } else {
+            WriteString(sig->name);
+        }
         LiteralSInt(sig->value);
-        enums[sig->id] = true;
+        EndSig();
     }
 }
 
 void LiteralBitmask(const BitmaskSig &bitmask, unsigned long long value) {
     WriteByte(Trace::TYPE_BITMASK);
     WriteUInt(bitmask.id);
-    if (!lookup(bitmasks, bitmask.id)) {
+    if (BeginSig(SIG_BITMASK, bitmask.id)) {
         WriteUInt(bitmask.count);
         for (unsigned i = 0; i < bitmask.count; ++i) {
             if (i != 0 && bitmask.values[i].value == 0) {
@@ -326,24 +1583,11 @@ void LiteralBitmask(const BitmaskSig &bitmask, unsigned long long value) {
             WriteString(bitmask.values[i].name);
             WriteUInt(bitmask.values[i].value);
         }
-        bitmasks[bitmask.id] = true;
+        EndSig();
     }
     WriteUInt(value);
 }
 
-void LiteralNull(void) {
-    WriteByte(Trace::TYPE_NULL);
-}
-
-void LiteralOpaque(const void *addr) {
-    if (!addr) {
-        LiteralNull();
-        return;
-    }
-    WriteByte(Trace::TYPE_OPAQUE);
-    WriteUInt((size_t)addr);
-}
-
 void Abort(void) {
     Close();
     OS::Abort();
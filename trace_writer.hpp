@@ -31,16 +31,28 @@
 #define _TRACE_WRITER_HPP_
 
 #include <stddef.h>
+#include <string.h>
+
+#include "os.hpp"
+#include "trace_format.hpp"
 
 namespace Trace {
 
     typedef unsigned Id;
 
+    /*
+     * Signatures may carry their definition already encoded, as the generated
+     * tracers do, so that it is written with a single copy.  Otherwise it is
+     * encoded from the other fields.
+     */
+
     struct FunctionSig {
         Id id;
         const char *name;
         unsigned num_args;
         const char **args;
+        const char *encoded;
+        size_t encoded_size;
     };
 
     struct StructSig {
@@ -48,12 +60,17 @@ namespace Trace {
         const char *name;
         unsigned num_members;
         const char **members;
+        const char *encoded;
+        size_t encoded_size;
     };
 
     struct EnumSig {
         Id id;
         const char *name;
         signed long long value;
+        /* Only the name, the value is not known to the generator */
+        const char *encoded;
+        size_t encoded_size;
     };
 
     struct BitmaskVal {
@@ -76,34 +93,178 @@ namespace Trace {
     void BeginLeave(unsigned call);
     void EndLeave(void);
 
-    void BeginArg(unsigned index);
+    /**
+     * Whether calls to the given function are left out of the trace, as set
+     * with TRACE_FILTER.  The generated wrappers only ask once per function.
+     */
+    bool IsFiltered(const FunctionSig &function, bool sideeffects);
+
+    /**
+     * Function encoding the arguments of a call from a copy of their values.
+     */
+    typedef void (*ArgsDumper)(const void *args);
+
+    /* Whether to defer encoding arguments, set with TRACE_DEFER=1 */
+    extern bool defer_args;
+
+    /**
+     * Copy the arguments of the call being entered, leaving their encoding to
+     * the writer thread.
+     */
+    void DeferArgs(ArgsDumper dumper, const void *args, size_t size);
+
+    /**
+     * Mark the end of a frame, i.e., after the call that presents it.
+     */
+    void EndFrame(void);
+
+    /**
+     * Buffer the calling thread encodes its current event into.
+     *
+     * Most values are encoded inline by the generated wrappers, with a single
+     * bounds check, straight into this buffer.
+     */
+    struct Encoder {
+        char *buf;
+        size_t size;
+        size_t capacity;
+    };
+
+    /* Only set while the calling thread is encoding an event */
+    extern THREAD_LOCAL Encoder *t_encoder;
+
+    /* Returns false if size more bytes can't be made room for */
+    bool GrowEncoder(Encoder *encoder, size_t size);
+
+    /* Longest variable length encoding of an integer */
+    #define ENCODED_UINT_MAX_SIZE 10
+
+    /**
+     * Make room for size more bytes in the current event, returning where to
+     * write them, or NULL if no event is being encoded.
+     */
+    inline char *BeginEncode(size_t size) {
+        Encoder *encoder = t_encoder;
+        if (!encoder) {
+            return NULL;
+        }
+        if (size > encoder->capacity - encoder->size &&
+            !GrowEncoder(encoder, size)) {
+            return NULL;
+        }
+        return encoder->buf + encoder->size;
+    }
+
+    inline void EndEncode(char *end) {
+        Encoder *encoder = t_encoder;
+        encoder->size = end - encoder->buf;
+    }
+
+    inline char *EncodeUInt(char *ptr, unsigned long long value) {
+        while (value >= 0x80) {
+            *ptr++ = (char)(0x80 | (value & 0x7f));
+            value >>= 7;
+        }
+        *ptr++ = (char)value;
+        return ptr;
+    }
+
+    inline void EncodeTagUInt(int tag, unsigned long long value) {
+        char *ptr = BeginEncode(1 + ENCODED_UINT_MAX_SIZE);
+        if (ptr) {
+            *ptr++ = (char)tag;
+            EndEncode(EncodeUInt(ptr, value));
+        }
+    }
+
+    inline void EncodeTag(int tag) {
+        char *ptr = BeginEncode(1);
+        if (ptr) {
+            *ptr++ = (char)tag;
+            EndEncode(ptr);
+        }
+    }
+
+    template <class T>
+    inline void EncodeTagBytes(int tag, T value) {
+        char *ptr = BeginEncode(1 + sizeof value);
+        if (ptr) {
+            *ptr++ = (char)tag;
+            memcpy(ptr, &value, sizeof value);
+            EndEncode(ptr + sizeof value);
+        }
+    }
+
+    inline void BeginArg(unsigned index) {
+        EncodeTagUInt(CALL_ARG, index);
+    }
     inline void EndArg(void) {}
 
-    void BeginReturn(void);
+    inline void BeginReturn(void) {
+        EncodeTag(CALL_RET);
+    }
     inline void EndReturn(void) {}
 
-    void BeginArray(size_t length);
+    inline void BeginArray(size_t length) {
+        EncodeTagUInt(TYPE_ARRAY, length);
+    }
     inline void EndArray(void) {}
 
+    /**
+     * Write a whole array of numbers at once, given their type (TYPE_SINT,
+     * TYPE_UINT, TYPE_FLOAT or TYPE_DOUBLE) and size in bytes.
+     */
+    void LiteralArray(Type type, size_t size, const void *values, size_t length);
+
     inline void BeginElement(void) {}
     inline void EndElement(void) {}
 
     void BeginStruct(const StructSig *sig);
     inline void EndStruct(void) {}
 
-    void LiteralBool(bool value);
-    void LiteralSInt(signed long long value);
-    void LiteralUInt(unsigned long long value);
-    void LiteralFloat(float value);
-    void LiteralDouble(double value);
+    inline void LiteralNull(void) {
+        EncodeTag(TYPE_NULL);
+    }
+
+    inline void LiteralBool(bool value) {
+        EncodeTag(value ? TYPE_TRUE : TYPE_FALSE);
+    }
+
+    inline void LiteralSInt(signed long long value) {
+        if (value < 0) {
+            EncodeTagUInt(TYPE_SINT, -value);
+        } else {
+            EncodeTagUInt(TYPE_UINT, value);
+        }
+    }
+
+    inline void LiteralUInt(unsigned long long value) {
+        EncodeTagUInt(TYPE_UINT, value);
+    }
+
+    inline void LiteralFloat(float value) {
+        EncodeTagBytes(TYPE_FLOAT, value);
+    }
+
+    inline void LiteralDouble(double value) {
+        EncodeTagBytes(TYPE_DOUBLE, value);
+    }
+
     void LiteralString(const char *str);
     void LiteralString(const char *str, size_t size);
     void LiteralWString(const wchar_t *str);
     void LiteralBlob(const void *data, size_t size);
+    void LiteralBlobOffset(const void *data, size_t offset, size_t size);
     void LiteralEnum(const EnumSig *sig);
     void LiteralBitmask(const BitmaskSig &bitmask, unsigned long long value);
-    void LiteralNull(void);
-    void LiteralOpaque(const void *ptr);
+
+    inline void LiteralOpaque(const void *addr) {
+        if (!addr) {
+            LiteralNull();
+            return;
+        }
+        EncodeTagUInt(TYPE_OPAQUE, (size_t)addr);
+    }
 
     void Abort(void);
 }
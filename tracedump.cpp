@@ -29,18 +29,201 @@
  */
 
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+
 #include "trace_parser.hpp"
 
 
+static void usage(void) {
+    std::cout <<
+        "Usage: tracedump [OPTION] TRACE...\n"
+        "Dump TRACE to standard output.\n"
+        "\n"
+        "  -c CALLNO    start at call CALLNO\n"
+        "  -f FRAME     start at frame FRAME\n"
+        "  -t           show when each call started, and how long it took, in\n"
+        "               microseconds (for traces with timings)\n"
+        "  -b           show where each call was made from (for traces with\n"
+        "               backtraces)\n"
+        "  -s           only show how many times each function was called\n";
+}
+
+
+/**
+ * Name the function and source line of a stack frame with addr2line, when
+ * available.  Each frame is only looked up once.
+ */
+static std::string symbolize(const Trace::StackFrame &frame) {
+#ifdef _WIN32
+    (void)frame;
+    return std::string();
+#else
+    typedef std::map<std::pair<std::string, unsigned long long>, std::string> SymbolMap;
+    static SymbolMap symbols;
+
+    std::pair<std::string, unsigned long long> key(frame.module, frame.offset);
+    SymbolMap::const_iterator it = symbols.find(key);
+    if (it != symbols.end()) {
+        return it->second;
+    }
+
+    std::string symbol;
+    if (!frame.module.empty() && frame.offset &&
+        frame.module.find('\'') == std::string::npos) {
+        /* Return addresses point past the call instruction */
+        char command[1280];
+        snprintf(command, sizeof command, "addr2line -f -C -e '%s' 0x%llx 2>/dev/null",
+                 frame.module.c_str(), frame.offset - 1);
+        FILE *pipe = popen(command, "r");
+        if (pipe) {
+            char function[1024];
+            char line[1024];
+            if (fgets(function, sizeof function, pipe) &&
+                fgets(line, sizeof line, pipe)) {
+                function[strcspn(function, "\n")] = 0;
+                line[strcspn(line, "\n")] = 0;
+                if (strcmp(function, "??") != 0) {
+                    symbol = function;
+                    if (strncmp(line, "??", 2) != 0) {
+                        symbol += std::string(" (") + line + ")";
+                    }
+                }
+            }
+            pclose(pipe);
+        }
+    }
+
+    symbols[key] = symbol;
+    return symbol;
+#endif
+}
+
+
+static void dumpBacktrace(const Trace::Backtrace &backtrace) {
+    for (unsigned i = 0; i < backtrace.size(); ++i) {
+        const Trace::StackFrame &frame = backtrace[i];
+        std::cout << "    #" << i << " " << frame.module << "+0x" << std::hex << frame.offset << std::dec;
+        std::string symbol = symbolize(frame);
+        if (!symbol.empty()) {
+            std::cout << " " << symbol;
+        }
+        std::cout << "\n";
+    }
+}
+
+
+/**
+ * Start at the given call.  With an index, find where it was entered without
+ * decoding the calls before it in its chunk, and resume from there.
+ */
+static bool seekCall(Trace::Parser &p, unsigned call_no) {
+    if (!p.seek_call(call_no)) {
+        return false;
+    }
+    if (!p.has_index()) {
+        return true;
+    }
+
+    Trace::CallLocation location;
+    if (!p.scan_call(location)) {
+        /* No such call, so nothing to show */
+        return true;
+    }
+    return p.seek(location);
+}
+
+
+/**
+ * Count the calls to each function, without decoding their arguments.
+ */
+static void dumpSummary(Trace::Parser &p) {
+    typedef std::map<std::string, unsigned long long> CountMap;
+    CountMap counts;
+    unsigned long long total = 0;
+
+    Trace::CallLocation location;
+    while (p.scan_call(location)) {
+        ++counts[location.sig->name];
+        ++total;
+    }
+
+    for (CountMap::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+        std::cout << it->second << " " << it->first << "\n";
+    }
+    std::cout << total << " calls\n";
+}
+
+
 int main(int argc, char **argv)
 {
-    for (int i = 1; i < argc; ++i) {
+    unsigned start_call = 0;
+    unsigned start_frame = 0;
+    bool timings = false;
+    bool backtraces = false;
+    bool summary = false;
+
+    int i;
+    for (i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if (arg[0] != '-') {
+            break;
+        }
+
+        if (!strcmp(arg, "--")) {
+            ++i;
+            break;
+        } else if (!strcmp(arg, "-c") && i + 1 < argc) {
+            start_call = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-f") && i + 1 < argc) {
+            start_frame = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-t")) {
+            timings = true;
+        } else if (!strcmp(arg, "-b")) {
+            backtraces = true;
+        } else if (!strcmp(arg, "-s")) {
+            summary = true;
+        } else if (!strcmp(arg, "--help")) {
+            usage();
+            return 0;
+        } else {
+            std::cerr << "error: unknown option " << arg << "\n";
+            usage();
+            return 1;
+        }
+    }
+
+    for ( ; i < argc; ++i) {
         Trace::Parser p;
         if (p.open(argv[i])) {
+            if (start_frame && !p.seek_frame(start_frame)) {
+                std::cerr << "error: cannot seek to frame " << start_frame << " of " << argv[i] << "\n";
+                continue;
+            }
+            if (start_call && !seekCall(p, start_call)) {
+                std::cerr << "error: cannot seek to call " << start_call << " of " << argv[i] << "\n";
+                continue;
+            }
+
+            if (summary) {
+                dumpSummary(p);
+                continue;
+            }
+
             Trace::Call *call;
             call = p.parse_call();
             while (call) {
+                if (timings && call->timed) {
+                    std::cout << "[" << call->time_start / 1000.0 << " +" << (call->time_end - call->time_start) / 1000.0 << "] ";
+                }
                 std::cout << *call;
+                if (backtraces && call->backtrace) {
+                    dumpBacktrace(*call->backtrace);
+                }
                 delete call;
                 call = p.parse_call();
             }
@@ -100,6 +100,7 @@ __getPublicProcAddress(LPCSTR lpProcName)
     print
     print '#include "glproc.hpp"'
     print '#include "glsize.hpp"'
+    print '#include "gltrace.hpp"'
     print
     api = API()
     api.add_api(glapi)